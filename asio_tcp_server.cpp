@@ -1,266 +1,107 @@
 // C++
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
 #include <iostream>
+#include <limits>
 #include <memory>
-#include <queue>
-#include <vector>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
 
 // Boost
 #include <boost/asio.hpp>
-#include <boost/bind/bind.hpp>
 
-// Namespaces
-using boost::asio::ip::tcp;
-
-// Aliases
-using ByteBuffer = std::vector<unsigned char>;
-
-class TCPConnection : public std::enable_shared_from_this<TCPConnection>
+// Templates
+#include "metrics.hpp"
+#include "opcode_dispatcher.hpp"
+#include "packet_logger.hpp"
+#include "session_task.hpp"
+#include "tcp_server.hpp"
+
+// Consts
+// How many connections the stats command lists individually
+const size_t STATS_CONNECTION_LIMIT = 20;
+// The client's answer to TCPConnection::KEEPALIVE_MESSAGE
+const uint16_t PONG_OPCODE = 0x18;
+
+// The coroutine version of TCPConnection::echo
+SessionTask<> echoSession(std::shared_ptr<TCPConnection> _connection);
+SessionTask<> echoSession(std::shared_ptr<TCPConnection> _connection)
 {
-	public:
-		/*****************
-		 * Constructors
-		 ****************/
-		// Default constructor
-		TCPConnection() = delete;
-
-		// Deconstructor
-		~TCPConnection() {};
-
-		static std::shared_ptr<TCPConnection> create(boost::asio::io_context& _ioContext) { return std::shared_ptr<TCPConnection>(new TCPConnection(_ioContext)); }
-
-		/*****************
-		 * Server Functions
-		 ****************/
-		void start()
-		{
-			char iv1[4] = { 70, 114, 122, rand() % 127 };
-			char iv2[4] = { 82,  48, 120, rand() % 127 };
-		
-			// This is the packet for the v62 MapleStory Global(NA) handshake
-			ByteBuffer buff;
-			buff.push_back(0x0E);
-			buff.push_back(83);
-			buff.push_back(1);
-			buff.push_back(49);
-			for(int i = 0; i < 4; ++i) { buff.push_back(iv1[i]); }
-			for(int i = 0; i < 4; ++i) { buff.push_back(iv2[i]); }
-			buff.push_back(8);
-			buff.push_back('\0');
-
-			this->writeBufferQueue.push(std::string(buff.begin(), buff.end()));
-			this->write();
-			this->read();
-		}
-
-		void shutdown()
-		{
-			// Handles and ignores
-			// `The I/O operation has been aborted because of either a thread exit or an application request` exception
-			// for a quick and dirty shutdown
-			try
-			{
-				// Shutdown read/write and the socket itself
-				this->socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both);
-				this->socket.close();
-				this->mSocketActive = false;
-			}
-			catch(std::exception _error)
-			{
-				std::cout << "Error: " << _error.what() << '\n';
-			}
-		}
-
-		void read()
-		{
-			// Read into readBuffer until we reach a null terminator '\0'
-			boost::asio::async_read_until(this->socket,
-										  this->readBuffer,
-										  '\0',
-										  boost::bind(&TCPConnection::handleRead,
-													  shared_from_this(),
-													  boost::asio::placeholders::error,
-													  boost::asio::placeholders::bytes_transferred));
-		}
-
-		void write()
-		{
-			// Async write
-			if(this->writeBufferQueue.size() > 0 && this->mSocketActive)
-			{
-				boost::asio::async_write(this->socket,
-										boost::asio::buffer(this->writeBufferQueue.front()),
-										boost::bind(&TCPConnection::handleWrite,
-													shared_from_this(),
-													boost::asio::placeholders::error,
-													boost::asio::placeholders::bytes_transferred));
-			}
-		}
-
-		/*****************
-		 * Getters & Setters
-		 ****************/
-		tcp::socket& getSocket() { return this->socket; }
-
-	private:
-		TCPConnection(boost::asio::io_context& _ioContext) : socket(_ioContext) 
-		{
-			this->mSocketActive = true;
-		}
-
-		void handleRead(const boost::system::error_code& _error, size_t _bytes_transferred)
-		{
-			// If theres an async error, close the connection
-			if (!_error)
-			{
-				// Construct a std::string from a boost::asio::streambuf
-				// We might read in extra data past the delimiter (According to Boost docs) so we don't read the whole buffer.
-				// Only read the number of bytes before the \0 
-				boost::asio::streambuf::const_buffers_type bufs = this->readBuffer.data();
-				std::string str(boost::asio::buffers_begin(bufs), boost::asio::buffers_begin(bufs) + _bytes_transferred);
-
-				// Process data
-				std::cout << "Bytes received: ";
-				for(int i = 0; i < _bytes_transferred; ++i)
-				{
-					std::cout << std::hex << (unsigned int)str[i] << ' ';
-				}
-				std::cout << "\n\n";
-
-				// Clear the read buffer
-				this->readBuffer.consume(_bytes_transferred);
-				this->read();
-
-				// Echo the message back to the client
-				this->writeBufferQueue.push(str);
-				this->write();
-			}
-			else
-			{
-				std::cout << "Error: " << _error.message() << '\n';
-				this->shutdown();
-			}
-		}
-
-		void handleWrite(const boost::system::error_code& _error, size_t _bytes_transferred)
-		{
-			// If theres an async error, close the connection
-			if (!_error)
-			{
-				// Pop the written packet from the write buffer
-				std::string str(this->writeBufferQueue.front());
-				this->writeBufferQueue.pop();
-				
-				// Keep this for testing/examples
-				std::cout << "Bytes written: ";
-				for(int i = 0; i < _bytes_transferred; ++i)
-				{
-					std::cout << std::hex << (unsigned int)str[i] << ' ';
-				}
-				std::cout << "\n\n";
-
-				if(this->writeBufferQueue.size() > 0)
-				{
-					this->write();
-				}
-			}
-			else
-			{
-				std::cout << "Error: " << _error.message() << '\n';
-				this->shutdown();
-			}
-		}
-
-		bool mSocketActive = false;
-		tcp::socket socket;
-		boost::asio::streambuf readBuffer;
-		std::queue<std::string> writeBufferQueue;
-};
+	while(SessionRead read = co_await _connection->readFrame())
+	{
+		_connection->send(read.message);
+	}
+}
 
-class TCPServer : public std::enable_shared_from_this<TCPServer>
+// Receiving the pong already counted as activity for the idle timeout, there's nothing left to do
+void handlePong(TCPConnection& _connection, MessageView _payload);
+void handlePong(TCPConnection& _connection, MessageView _payload)
 {
-	typedef std::shared_ptr<TCPConnection> Connection; 
-	typedef std::shared_ptr<std::vector<Connection>> Connections;
-	public:
-		/*****************
-		 * Constructors
-		 ****************/
-		// Default constructor
-		TCPServer() = delete;
-
-		// Parameterized constructors
-		TCPServer(boost::asio::io_context& _ioContext, size_t _port) : ioContext(_ioContext), acceptor(_ioContext, tcp::endpoint(tcp::v4(), _port)) 
-		{
-			this->connections = std::make_shared<std::vector<Connection>>();
-		}
-			
-		// Destructor
-		~TCPServer() 
-		{
-			this->shutdown();
-		}
-		
-		/****************
-		 * Server functions
-		 ***************/
-		void startAccept()
-		{
-			// Async accept connection
-			std::shared_ptr<TCPConnection> newConnection = TCPConnection::create(this->ioContext);
-			this->acceptor.async_accept(newConnection->getSocket(),
-										boost::bind(&TCPServer::handleAccept,
-										shared_from_this(),
-										newConnection,
-										boost::asio::placeholders::error));
-		}
-
-		void shutdown()
-		{
-			for(Connection c: *(this->connections))
-			{
-				c->shutdown();
-			}
-		}
-
-		void handleAccept(std::shared_ptr<TCPConnection> _newConnection, const boost::system::error_code& _error)
-		{
-			// If theres an async error, close the connection
-			if (!_error)
-			{
-				// Push new connection onto our list of connections and start communications
-				this->connections->push_back(_newConnection);
-				_newConnection->start();
-
-				// Async accept new client
-				this->startAccept();
-			}
-			else
-			{
-				std::cout << _error.message() << '\n';
-			}
-		}
+}
 
-	private:
-		boost::asio::io_context& ioContext;
-		tcp::acceptor acceptor;
-		Connections connections;
-};
+// Opcodes without a handler of their own are echoed back whole
+void handleUnknownOpcode(TCPConnection& _connection, uint16_t _opcode, MessageView _packet);
+void handleUnknownOpcode(TCPConnection& _connection, uint16_t _opcode, MessageView _packet)
+{
+	TCPConnection::echo(_connection, _packet);
+}
 
-boost::asio::io_context io_context;
+// Routes packets by opcode instead of echoing every one, register new handlers here
+typedef OpcodeDispatcher<TCPConnection, handleUnknownOpcode,
+						 OpcodeHandler<PONG_OPCODE, handlePong>> PacketDispatcher;
 
 void stopEverything(std::shared_ptr<TCPServer> _server);
 void stopEverything(std::shared_ptr<TCPServer> _server)
 {
+	_server->stop();
 	if(_server.use_count() == 1)
 	{
 		_server.reset();
 	}
-	io_context.stop();
 }
 
 int main(int argc, char* argv[])
 {
+	// Usage: asio_tcp_server [port] [threads] [cipher] [log level] [log sample rate] [coroutines] [idle timeout] [keepalive interval] [opcode dispatch]
+	// Threads defaults to one per hardware thread, a cipher of 1 encrypts connections after the handshake.
+	// Packets are traced to asio_tcp_server.pktlog, log level 0 is off, 1 headers only, 2 (default) full packets.
+	// Read the log with packet_log_dump. Coroutines of 1 runs every connection as an echoSession instead of callbacks.
+	// Timeouts are in seconds, 0 turns them off. Keepalives are off unless an interval is given.
+	// Opcode dispatch of 1 routes messages through PacketDispatcher instead of echoing them all
+	size_t port = argc > 1 ? std::stoul(argv[1]) : 1111;
+	size_t threadCount = argc > 2 ? std::stoul(argv[2]) : 0;
+	bool cipherEnabled = argc > 3 && std::stoul(argv[3]) != 0;
+	PacketLogLevel logLevel = static_cast<PacketLogLevel>(argc > 4 ? std::min<unsigned long>(std::stoul(argv[4]), 2) : 2);
+	uint32_t logSampleRate = argc > 5 ? static_cast<uint32_t>(std::stoul(argv[5])) : 1;
+	bool coroutinesEnabled = argc > 6 && std::stoul(argv[6]) != 0;
+	ConnectionTimeouts timeouts;
+	timeouts.idle = argc > 7 ? std::chrono::seconds(std::stoul(argv[7])) : ConnectionTimeouts::IDLE_TIMEOUT;
+	timeouts.keepAlive = argc > 8 ? std::chrono::seconds(std::stoul(argv[8])) : ConnectionTimeouts::KEEPALIVE_INTERVAL;
+	bool opcodeDispatchEnabled = argc > 9 && std::stoul(argv[9]) != 0;
+
+	if(logLevel != PacketLogLevel::Off && !PacketLogger::start("asio_tcp_server.pktlog", logLevel, logSampleRate))
+	{
+		std::cout << "Error: couldn't open asio_tcp_server.pktlog" << '\n';
+	}
+
 	// Initialize the TCPServer
-	std::shared_ptr<TCPServer> server = std::make_shared<TCPServer>(io_context, 1111);
+	std::shared_ptr<TCPServer> server = std::make_shared<TCPServer>(port, threadCount);
+	server->setCipherEnabled(cipherEnabled);
+	server->setTimeouts(timeouts);
+	if(opcodeDispatchEnabled)
+	{
+		server->setMessageHandler(PacketDispatcher::dispatch);
+	}
+	if(coroutinesEnabled)
+	{
+		server->setSessionHandler(echoSession);
+	}
+	std::cout << "Listening on port " << port << " with " << server->getThreadCount() << " IO threads on " << IOContextPool::getReactorName() << '\n';
 
 	// Create an input loop inside a lambda function
 	auto inputLoop = [&server]()
@@ -271,8 +112,16 @@ int main(int argc, char* argv[])
         while(!q)
         {
             std::cout << "Quit: (Q or q)" << '\n';
+            std::cout << "Broadcast: (B or b)" << '\n';
+            std::cout << "Stats: (S or s)" << '\n';
+            std::cout << "Export stats to asio_tcp_server_stats.txt: (E or e)" << '\n';
             std::cout << "Enter command: " << '\n' << "> ";
-            std::cin >> cmd;
+            // Treat a closed stdin as quit instead of replaying the last command forever
+            if(!(std::cin >> cmd))
+            {
+                cmd = 'q';
+            }
+			std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
             switch(cmd)
             {
                 case 'Q':
@@ -281,10 +130,32 @@ int main(int argc, char* argv[])
                     q = true;
 					stopEverything(server);
                     break;
+				case 'B': [[fallthrough]];
+				case 'b':
+				// Must brace this block for the initialization of str
+				{
+					std::string str;
+					std::cout << "Enter message to broadcast: ";
+					std::getline(std::cin, str);
+					size_t recipients = server->broadcast(std::as_bytes(std::span(str)));
+					std::cout << "Broadcast to " << std::dec << recipients << " connections" << '\n';
+					break;
+				}
+				case 'S': [[fallthrough]];
+				case 's':
+					server->writeStats(std::cout, STATS_CONNECTION_LIMIT);
+					break;
+				case 'E': [[fallthrough]];
+				case 'e':
+				{
+					std::ofstream file("asio_tcp_server_stats.txt");
+					server->writeStats(file);
+					std::cout << "Stats written to asio_tcp_server_stats.txt" << '\n';
+					break;
+				}
                 default:
                     break;
             }
-			std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
         }
     };
 	// Thread our input loop
@@ -292,9 +163,12 @@ int main(int argc, char* argv[])
 
 	// Start the server proper
 	server->startAccept();
+	server->startReaping();
+
+	// Runs the io_context pool, one thread per io_context
+	server->run();
 
-	// If the client can't connect to the server, this won't block
-	io_context.run();
+	PacketLogger::stop();
 	
 	return 0;
 }
\ No newline at end of file
@@ -1,7 +1,16 @@
 // C++
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
 #include <iostream>
 #include <memory>
-#include <queue>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 // Boost
@@ -9,18 +18,48 @@
 #include <boost/asio.hpp>
 #include <boost/bind/bind.hpp>
 
+// Templates
+#include "buffer_pool.hpp"
+#include "datagram_batch.hpp"
+#include "handler_allocator.hpp"
+#include "packet_logger.hpp"
+#include "reliable_channel.hpp"
+#include "submission_queue.hpp"
+
 // Namespaces
 using boost::asio::ip::udp;
 
 // Aliases
 using ByteBuffer = std::vector<unsigned char>;
+// A received datagram, only valid for the duration of the message handler
+using MessageView = std::span<const std::byte>;
 
 // Consts
 const int RECV_BUFFER_SIZE = 128;
+// Datagrams moved per recvmmsg/sendmmsg in batched mode
+const size_t DATAGRAM_BATCH_SIZE = 32;
+// Batches received per readiness wakeup before going back to the io_context, so one busy socket can't starve the rest
+const size_t MAX_RECEIVE_BATCHES = 4;
+// How often channel resends and standalone acks go out
+const std::chrono::milliseconds CHANNEL_UPDATE_INTERVAL = std::chrono::milliseconds(5);
+
+// Packet traces are keyed by the peer's IPv4 address and port
+inline uint64_t getEndpointId(const udp::endpoint& _endpoint)
+{
+	uint64_t address = _endpoint.address().is_v4() ? _endpoint.address().to_v4().to_uint() : 0;
+	return (address << 16) | _endpoint.port();
+}
 
 class UDPClient : public std::enable_shared_from_this<UDPClient>
 {
     public:
+		// Called once per received datagram, _message points into receiveBuffer
+		typedef std::function<void(UDPClient& _socket, MessageView _message)> MessageHandler;
+		// Called once per received batch instead of the MessageHandler when set, the datagrams are only valid during the call
+		typedef std::function<void(UDPClient& _socket, std::span<const Datagram> _datagrams)> BatchHandler;
+		// Called once per message delivered by the channel layer, instead of the other handlers while channels are on
+		typedef std::function<void(UDPClient& _socket, uint8_t _channel, MessageView _message)> ChannelHandler;
+
 		/*****************
 		 * Constructors
 		 ****************/
@@ -28,7 +67,7 @@ class UDPClient : public std::enable_shared_from_this<UDPClient>
         UDPClient() = delete;
 
 		// Parameterized constructor
-		UDPClient(boost::asio::io_context& _io_context, const std::string& _host, const std::string& _port) : socket(_io_context), resolver(_io_context)
+		UDPClient(boost::asio::io_context& _io_context, const std::string& _host, const std::string& _port) : ioContext(_io_context), socket(_io_context), resolver(_io_context), channelTimer(_io_context)
 		{
 			// Initialize the endpoint we're talking to
 			this->remoteEndpoint = *resolver.resolve(udp::v4(), _host, _port).begin();
@@ -52,6 +91,10 @@ class UDPClient : public std::enable_shared_from_this<UDPClient>
 		{
 			this->send();
 			this->receive();
+			if(this->connection)
+			{
+				this->startChannelUpdates();
+			}
 		}
 
 		void shutdown()
@@ -64,6 +107,7 @@ class UDPClient : public std::enable_shared_from_this<UDPClient>
 				// Shutdown send/receive and the socket itself
 				this->socket.shutdown(boost::asio::ip::udp::socket::shutdown_both);
 				this->socket.close();
+				this->channelTimer.cancel();
 				this->mSocketActive = false;
 			}
 			catch(std::exception _error)
@@ -74,33 +118,112 @@ class UDPClient : public std::enable_shared_from_this<UDPClient>
 
 		void receive()
 		{
+#if DATAGRAMBATCH_SUPPORTED
+			// Batched: wait for the socket to become readable, then pull datagrams with recvmmsg
+			if(this->batchingEnabled)
+			{
+				this->socket.async_wait(udp::socket::wait_read,
+										makeAllocHandler(this->receiveHandlerMemory,
+														 boost::bind(&UDPClient::handleReceiveReady,
+																	 shared_from_this(),
+																	 boost::asio::placeholders::error)));
+				return;
+			}
+#endif
+
 			// Async receive
 			this->socket.async_receive_from(boost::asio::buffer(this->receiveBuffer),
 											this->remoteEndpoint,
-											boost::bind(&UDPClient::handleReceive,
-														shared_from_this(),
-														boost::asio::placeholders::error,
-														boost::asio::placeholders::bytes_transferred));
+											makeAllocHandler(this->receiveHandlerMemory,
+															 boost::bind(&UDPClient::handleReceive,
+																		 shared_from_this(),
+																		 boost::asio::placeholders::error,
+																		 boost::asio::placeholders::bytes_transferred)));
 		}
 
+		// Starts flushing the send queue unless that's already under way, safe from any thread
 		void send()
 		{
-			// Async send
-			if(this->sendBufferQueue.size() > 0)
+			if(!this->ioContext.get_executor().running_in_this_thread())
+			{
+				boost::asio::post(this->ioContext, boost::bind(&UDPClient::send, shared_from_this()));
+				return;
+			}
+			this->startSend();
+		}
+
+		// Sends _message to the server on one of the channels given to setChannels. Returns false if the channel
+		// refused it (see ReliableConnection::send). Channel state lives on the IO thread, calls from other
+		// threads are posted there and return true
+		bool sendOnChannel(uint8_t _channel, MessageView _message)
+		{
+			if(!this->connection)
+			{
+				return false;
+			}
+
+			if(!this->ioContext.get_executor().running_in_this_thread())
+			{
+				PacketBuffer message = PacketBuffer::copyOf(_message.data(), _message.size());
+				boost::asio::post(this->ioContext, [self = shared_from_this(), _channel, message]()
+				{
+					self->sendOnChannel(_channel, message.view());
+				});
+				return true;
+			}
+
+			bool sent = this->connection->send(_channel, _message, std::chrono::steady_clock::now());
+			this->flushChannel();
+			return sent;
+		}
+
+		void pushOntoSendQueue(const std::string& _str)
+		{
+			// Copy straight into a pooled packet, null terminated
+			PacketBuffer packet = PacketBuffer::allocate(_str.size() + 1);
+			std::memcpy(packet.data(), _str.data(), _str.size());
+			packet.data()[_str.size()] = std::byte{0};
+			this->pushOntoSendQueue(std::move(packet));
+		}
+
+		// Safe from any thread, the packet goes out as soon as the IO thread gets to it.
+		// Other threads hand it over through the submission queue, only the first packet into an
+		// empty queue wakes the IO thread and it sends everything that piled up in one go
+		void pushOntoSendQueue(PacketBuffer _packet)
+		{
+			if(this->ioContext.get_executor().running_in_this_thread())
+			{
+				this->sendBufferQueue.push_back(std::move(_packet));
+				this->startSend();
+				return;
+			}
+
+			if(this->submissions.push(std::move(_packet)))
+			{
+				boost::asio::post(this->ioContext, boost::bind(&UDPClient::drainSubmissions, shared_from_this()));
+			}
+		}
+
+		// Default message handler, dumps the datagram
+		static void print(UDPClient& _socket, MessageView _message)
+		{
+			std::cout << "Received: ";
+			for(std::byte b : _message)
 			{
-				this->socket.async_send_to(boost::asio::buffer(this->sendBufferQueue.front(), this->sendBufferQueue.front().size()),
-										this->remoteEndpoint,
-										boost::bind(&UDPClient::handleSend,
-													shared_from_this(),
-													boost::asio::placeholders::error,
-													boost::asio::placeholders::bytes_transferred));
+				std::cout << std::hex << std::to_integer<unsigned int>(b) << ' ';
 			}
+			std::cout << "\n\n";
 		}
 
-		void pushOntoSendQueue(std::string _str)
+		// Default channel handler, dumps the message
+		static void printChannel(UDPClient& _socket, uint8_t _channel, MessageView _message)
 		{
-			std::lock_guard<std::mutex> lock(this->m);
-			this->sendBufferQueue.push(_str + '\0');
+			std::cout << "Channel " << std::dec << static_cast<unsigned int>(_channel) << " received: ";
+			for(std::byte b : _message)
+			{
+				std::cout << std::hex << std::to_integer<unsigned int>(b) << ' ';
+			}
+			std::cout << "\n\n";
 		}
 
 		/*****************
@@ -108,20 +231,27 @@ class UDPClient : public std::enable_shared_from_this<UDPClient>
 		 ****************/
 		udp::socket& getSocket() { return this->socket; }
 		bool isSocketActive() { return this->mSocketActive; }
+		void setMessageHandler(MessageHandler _messageHandler) { this->messageHandler = std::move(_messageHandler); }
+		void setBatchHandler(BatchHandler _batchHandler) { this->batchHandler = std::move(_batchHandler); }
+		void setChannelHandler(ChannelHandler _channelHandler) { this->channelHandler = std::move(_channelHandler); }
+		// Set before start(). Runs the channel layer to the server, channel i gets _modes[i]
+		void setChannels(const std::vector<ChannelMode>& _modes) { this->connection = std::make_unique<ReliableConnection>(_modes, RECV_BUFFER_SIZE); }
+		// Set before start(), batching is only available on Linux
+		void setBatchingEnabled(bool _enabled) { this->batchingEnabled = _enabled && DATAGRAMBATCH_SUPPORTED; }
+		bool isBatchingEnabled() { return this->batchingEnabled; }
+#if DATAGRAMBATCH_SUPPORTED
+		// UDP GSO for runs of equally sized packets, off by default
+		void setSegmentationOffloadEnabled(bool _enabled) { this->sendBatch.setSegmentationOffloadEnabled(_enabled); }
+#endif
 
     private:
 		void handleReceive(const boost::system::error_code& _error, size_t _bytes_transferred)
 		{
 			if (!_error)
 			{
-				std::string str(this->receiveBuffer.begin(), this->receiveBuffer.begin() + _bytes_transferred);
-
-				std::cout << "Received: ";
-				for(int i = 0; i < str.size(); ++i)
-				{
-					std::cout << std::hex << (unsigned int)str[i] << ' ';
-				}
-				std::cout << "\n\n";
+				// Hand the datagram over in place, receiveBuffer isn't reused until we receive again
+				Datagram datagram = { std::as_bytes(std::span(this->receiveBuffer.data(), _bytes_transferred)), this->remoteEndpoint };
+				this->dispatch(std::span<const Datagram>(&datagram, 1));
 
 				this->receive();
     		}
@@ -131,25 +261,151 @@ class UDPClient : public std::enable_shared_from_this<UDPClient>
 			}
 		}
 
-		void handleSend(const boost::system::error_code& _error, size_t _bytes_transferred)
+		// Traces a batch, then hands it to the channel layer, the batch handler or each datagram to the message handler
+		void dispatch(std::span<const Datagram> _datagrams)
 		{
-			if (!_error)
+			for(const Datagram& datagram : _datagrams)
 			{
-				std::string str = this->sendBufferQueue.front();
-				this->sendBufferQueue.pop();
+				PacketLogger::log(getEndpointId(datagram.sender), PacketDirection::Received, datagram.data);
+			}
 
-				std::cout << "Sending: ";
-				for(int i = 0; i < str.size(); ++i)
+			if(this->connection)
+			{
+				std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+				for(const Datagram& datagram : _datagrams)
 				{
-					std::cout << std::hex << (unsigned int)str[i] << ' ';
+					this->connection->receive(datagram.data, now, [this](uint8_t _channel, MessageView _message)
+					{
+						this->channelHandler(*this, _channel, _message);
+					});
 				}
-				std::cout << "\n\n";
+				// Acks go straight back rather than waiting for the next update
+				this->connection->update(now);
+				this->flushChannel();
+				return;
+			}
 
-				
-				if(this->sendBufferQueue.size() > 0)
+			if(this->batchHandler)
+			{
+				this->remoteEndpoint = _datagrams.back().sender;
+				this->batchHandler(*this, _datagrams);
+				return;
+			}
+			for(const Datagram& datagram : _datagrams)
+			{
+				this->remoteEndpoint = datagram.sender;
+				this->messageHandler(*this, datagram.data);
+			}
+		}
+
+#if DATAGRAMBATCH_SUPPORTED
+		void handleReceiveReady(const boost::system::error_code& _error)
+		{
+			boost::system::error_code error = _error;
+			for(size_t i = 0; i < MAX_RECEIVE_BATCHES && !error; ++i)
+			{
+				// Nothing left means the wakeup is used up, a short batch means the socket is drained
+				size_t count = this->receiveBatch.receive(this->socket.native_handle(), error);
+				if(count == 0)
+				{
+					break;
+				}
+				this->dispatch(this->receiveBatch.getDatagrams());
+				if(count < this->receiveBatch.getBatchSize())
 				{
-					this->send();
+					break;
 				}
+			}
+
+			if(!error)
+			{
+				this->receive();
+			}
+			else
+			{
+				std::cout << "Error: " << error.message() << '\n';
+			}
+		}
+
+		void waitToSend()
+		{
+			this->socket.async_wait(udp::socket::wait_write,
+									makeAllocHandler(this->sendHandlerMemory,
+													 boost::bind(&UDPClient::handleSendReady,
+																 shared_from_this(),
+																 boost::asio::placeholders::error)));
+		}
+
+		void handleSendReady(const boost::system::error_code& _error)
+		{
+			boost::system::error_code error = _error;
+			while(!error && this->sendBufferQueue.size() > 0)
+			{
+				size_t count = this->sendBatch.send(this->socket.native_handle(), this->sendBufferQueue, this->remoteEndpoint, error);
+				if(count == 0)
+				{
+					break;
+				}
+
+				for(size_t i = 0; i < count; ++i)
+				{
+					PacketLogger::log(getEndpointId(this->remoteEndpoint), PacketDirection::Sent, this->sendBufferQueue.front().view());
+					this->sendBufferQueue.pop_front();
+				}
+			}
+
+			if(error)
+			{
+				this->sendInFlight = false;
+				std::cout << "Error: " << error.message() << '\n';
+			}
+			// The socket buffer filled up, go again once it drains
+			else if(this->sendBufferQueue.size() > 0)
+			{
+				this->waitToSend();
+			}
+			else
+			{
+				this->sendInFlight = false;
+			}
+		}
+#endif
+
+		void startSend()
+		{
+			if(this->sendInFlight || this->sendBufferQueue.empty())
+			{
+				return;
+			}
+			this->sendInFlight = true;
+
+#if DATAGRAMBATCH_SUPPORTED
+			// Batched: wait for the socket to become writable, then flush the queue with sendmmsg
+			if(this->batchingEnabled)
+			{
+				this->waitToSend();
+				return;
+			}
+#endif
+
+			// Async send
+			this->socket.async_send_to(boost::asio::buffer(this->sendBufferQueue.front().data(), this->sendBufferQueue.front().size()),
+									   this->remoteEndpoint,
+									   makeAllocHandler(this->sendHandlerMemory,
+														boost::bind(&UDPClient::handleSend,
+																	shared_from_this(),
+																	boost::asio::placeholders::error,
+																	boost::asio::placeholders::bytes_transferred)));
+		}
+
+		void handleSend(const boost::system::error_code& _error, size_t _bytes_transferred)
+		{
+			this->sendInFlight = false;
+			if (!_error)
+			{
+				PacketLogger::log(getEndpointId(this->remoteEndpoint), PacketDirection::Sent, this->sendBufferQueue.front().view());
+				this->sendBufferQueue.pop_front();
+				this->startSend();
     		}
 			else
 			{
@@ -157,14 +413,79 @@ class UDPClient : public std::enable_shared_from_this<UDPClient>
 			}
 		}
 
-		std::mutex m;
+		// Moves the datagrams the channel layer produced onto the send queue
+		void flushChannel()
+		{
+			std::vector<PacketBuffer>& outgoing = this->connection->getOutgoing();
+			if(outgoing.empty())
+			{
+				return;
+			}
+
+			for(PacketBuffer& packet : outgoing)
+			{
+				this->sendBufferQueue.push_back(std::move(packet));
+			}
+			outgoing.clear();
+			this->startSend();
+		}
+
+		void drainSubmissions()
+		{
+			this->submissions.drain([this](PacketBuffer _packet)
+			{
+				this->sendBufferQueue.push_back(std::move(_packet));
+			});
+			this->startSend();
+		}
+
+		void startChannelUpdates()
+		{
+			this->channelTimer.expires_after(CHANNEL_UPDATE_INTERVAL);
+			this->channelTimer.async_wait(boost::bind(&UDPClient::handleChannelUpdate,
+													  shared_from_this(),
+													  boost::asio::placeholders::error));
+		}
+
+		// Resends and standalone acks
+		void handleChannelUpdate(const boost::system::error_code& _error)
+		{
+			if(_error)
+			{
+				return;
+			}
+
+			this->connection->update(std::chrono::steady_clock::now());
+			this->flushChannel();
+			this->startChannelUpdates();
+		}
+
 		bool mSocketActive = false;
+		boost::asio::io_context& ioContext;
         udp::socket socket;
         udp::resolver resolver;
 		udp::endpoint localEndpoint;
 		udp::endpoint remoteEndpoint;
 		boost::array<unsigned char, RECV_BUFFER_SIZE> receiveBuffer;
-		std::queue<std::string> sendBufferQueue;
+		// Only touched on the IO thread, other threads go through submissions
+		std::deque<PacketBuffer> sendBufferQueue;
+		SubmissionQueue<PacketBuffer> submissions;
+		// A send, a writable wait or a flush is pending
+		bool sendInFlight = false;
+		MessageHandler messageHandler = print;
+		BatchHandler batchHandler;
+		ChannelHandler channelHandler = printChannel;
+		// Only while the channel layer is on
+		std::unique_ptr<ReliableConnection> connection;
+		boost::asio::steady_timer channelTimer;
+		bool batchingEnabled = DATAGRAMBATCH_SUPPORTED;
+#if DATAGRAMBATCH_SUPPORTED
+		DatagramReceiveBatch receiveBatch = DatagramReceiveBatch(DATAGRAM_BATCH_SIZE, RECV_BUFFER_SIZE);
+		DatagramSendBatch sendBatch = DatagramSendBatch(DATAGRAM_BATCH_SIZE);
+#endif
+		// Completion handler memory, one receive and one send are in flight at most
+		HandlerMemory receiveHandlerMemory;
+		HandlerMemory sendHandlerMemory;
 };
 
 boost::asio::io_context io_context;
@@ -181,11 +502,29 @@ void stopEverything(std::shared_ptr<UDPClient> _client)
 
 int main(int argc, char* argv[])
 {
+	// Packets are traced to asio_udp_client.pktlog, read it with packet_log_dump
+	PacketLogger::start("asio_udp_client.pktlog");
+
+	// Usage: asio_udp_client [batching] [segmentation offload] [channels]
+	// Batching (recvmmsg/sendmmsg) is on by default where supported, segmentation offload is off.
+	// Channels runs the reliability layer, start the server with channels too
+	bool batchingEnabled = argc > 1 ? std::stoul(argv[1]) != 0 : true;
+	bool segmentationOffloadEnabled = argc > 2 && std::stoul(argv[2]) != 0;
+	bool channelsEnabled = argc > 3 && std::stoul(argv[3]) != 0;
+
 	// Initialize the UDPClient
 	std::shared_ptr<UDPClient> client = std::make_shared<UDPClient>(io_context, "127.0.0.1", "1111");
+	client->setBatchingEnabled(batchingEnabled);
+#if DATAGRAMBATCH_SUPPORTED
+	client->setSegmentationOffloadEnabled(segmentationOffloadEnabled);
+#endif
+	if(channelsEnabled)
+	{
+		client->setChannels({ ChannelMode::ReliableOrdered, ChannelMode::ReliableUnordered, ChannelMode::UnreliableSequenced });
+	}
 
 	// Create an input loop inside a lambda function
-	auto inputLoop = [&client]()
+	auto inputLoop = [&client, channelsEnabled]()
 	{
         bool q = false;
         char cmd;
@@ -214,7 +553,15 @@ int main(int argc, char* argv[])
 					std::string str;
 					std::cout << "Enter message to send: ";
 					std::getline(std::cin, str);
-					client->pushOntoSendQueue(str);
+					// Both go out as soon as the IO thread picks them up
+					if(channelsEnabled)
+					{
+						client->sendOnChannel(0, std::as_bytes(std::span(str.c_str(), str.size() + 1)));
+					}
+					else
+					{
+						client->pushOntoSendQueue(str);
+					}
 					break;
 				}
 				default:
@@ -230,6 +577,8 @@ int main(int argc, char* argv[])
 
 	// If the client can't connect to the server, this won't block
 	io_context.run();
+
+	PacketLogger::stop();
 	
 	return 0;
 }
\ No newline at end of file
@@ -1,7 +1,18 @@
 // C++
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <memory>
-#include <queue>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 // Boost
@@ -9,32 +20,97 @@
 #include <boost/asio.hpp>
 #include <boost/bind/bind.hpp>
 
+// Templates
+#include "buffer_pool.hpp"
+#include "datagram_batch.hpp"
+#include "handler_allocator.hpp"
+#include "io_context_pool.hpp"
+#include "metrics.hpp"
+#include "packet_logger.hpp"
+#include "reliable_channel.hpp"
+#include "submission_queue.hpp"
+#include "udp_session_table.hpp"
+
 // Namespaces
 using boost::asio::ip::udp;
 
 // Aliases
 using ByteBuffer = std::vector<unsigned char>;
+// A received datagram, only valid for the duration of the message handler
+using MessageView = std::span<const std::byte>;
 
 // Consts
 const int RECV_BUFFER_SIZE = 128;
+// Datagrams moved per recvmmsg/sendmmsg in batched mode
+const size_t DATAGRAM_BATCH_SIZE = 32;
+// Batches received per readiness wakeup before going back to the io_context, so one busy socket can't starve the rest
+const size_t MAX_RECEIVE_BATCHES = 4;
+// Sessions the table has room for before it first grows
+const size_t INITIAL_SESSION_CAPACITY = 1024;
+// Peers that stay quiet this long are forgotten
+const std::chrono::seconds SESSION_IDLE_TIMEOUT = std::chrono::seconds(60);
+const std::chrono::seconds SESSION_EVICTION_INTERVAL = std::chrono::seconds(1);
+// The stats command lists at most this many sessions
+const size_t STATS_SESSION_LIMIT = 20;
+// How often channel resends and standalone acks go out
+const std::chrono::milliseconds CHANNEL_UPDATE_INTERVAL = std::chrono::milliseconds(5);
 
-class UDPServer : public std::enable_shared_from_this<UDPServer>
+// SO_REUSEPORT lets several sockets bind the same port, the kernel spreads datagrams over them
+// by a hash of the sender's address, so every peer always lands on the same socket. Linux only
+#if defined(__linux__) && defined(SO_REUSEPORT)
+	#define UDPSERVER_SHARDING_SUPPORTED 1
+#else
+	#define UDPSERVER_SHARDING_SUPPORTED 0
+#endif
+
+// Packet traces are keyed by the peer's IPv4 address and port
+inline uint64_t getEndpointId(const udp::endpoint& _endpoint)
+{
+	uint64_t address = _endpoint.address().is_v4() ? _endpoint.address().to_v4().to_uint() : 0;
+	return (address << 16) | _endpoint.port();
+}
+
+// One socket of a UDPServer with its own sessions, send queues and timers, all served by one IO thread.
+// Shards share nothing, so receivers never contend for a lock
+class UDPShard : public std::enable_shared_from_this<UDPShard>
 {
 	public:
+		// Called once per received datagram, _message points into the receive buffer.
+		// _session is only valid for the duration of the call, reply through pushOntoSendQueue
+		typedef std::function<void(UDPShard& _socket, UDPSession& _session, MessageView _message)> MessageHandler;
+		// Called once per received batch instead of the MessageHandler when set, the datagrams are only valid during the call
+		typedef std::function<void(UDPShard& _socket, std::span<const Datagram> _datagrams)> BatchHandler;
+		// Called once per message delivered by the channel layer, instead of the other handlers while channels are on
+		typedef std::function<void(UDPShard& _socket, UDPSession& _session, uint8_t _channel, MessageView _message)> ChannelHandler;
+
 		/*****************
 		 * Constructors
 		 ****************/
 		// Default constructor
-		UDPServer() = delete;
+		UDPShard() = delete;
 
 		// Parameterized constructors
-		UDPServer(boost::asio::io_context& _ioContext, size_t _port) : ioContext(_ioContext), socket(_ioContext, udp::endpoint(udp::v4(), _port)), mSocketActive(true)
+		// With _reusePort the socket joins the port's SO_REUSEPORT group alongside the other shards
+		UDPShard(boost::asio::io_context& _ioContext, size_t _port, bool _reusePort) : mSocketActive(true), ioContext(_ioContext), socket(_ioContext), evictionTimer(_ioContext), channelTimer(_ioContext)
 		{
+			this->socket.open(udp::v4());
+#if UDPSERVER_SHARDING_SUPPORTED
+			if(_reusePort)
+			{
+				int enabled = 1;
+				if(::setsockopt(this->socket.native_handle(), SOL_SOCKET, SO_REUSEPORT, &enabled, sizeof(enabled)) != 0)
+				{
+					std::cout << "Error: couldn't set SO_REUSEPORT" << '\n';
+				}
+			}
+#endif
+			this->socket.bind(udp::endpoint(udp::v4(), _port));
 			this->receiveBuffer.assign(0);
+			this->sessions.reserve(INITIAL_SESSION_CAPACITY);
 		}
 			
 		// Destructor
-		~UDPServer() {}
+		~UDPShard() {}
 		
 		/****************
 		 * Server functions
@@ -42,6 +118,11 @@ class UDPServer : public std::enable_shared_from_this<UDPServer>
 		void start()
 		{
 			this->receive();
+			this->startEviction();
+			if(!this->channelModes.empty())
+			{
+				this->startChannelUpdates();
+			}
 		}
 
 		void shutdown()
@@ -54,6 +135,8 @@ class UDPServer : public std::enable_shared_from_this<UDPServer>
 				// Shutdown send/receive and the socket itself
 				this->socket.shutdown(boost::asio::ip::udp::socket::shutdown_both);
 				this->socket.close();
+				this->evictionTimer.cancel();
+				this->channelTimer.cancel();
 				this->mSocketActive = false;
 			}
 			catch(std::exception _error)
@@ -64,33 +147,184 @@ class UDPServer : public std::enable_shared_from_this<UDPServer>
 
 		void receive()
 		{
+#if DATAGRAMBATCH_SUPPORTED
+			// Batched: wait for the socket to become readable, then pull datagrams with recvmmsg
+			if(this->batchingEnabled)
+			{
+				this->socket.async_wait(udp::socket::wait_read,
+										makeAllocHandler(this->receiveHandlerMemory,
+														 boost::bind(&UDPShard::handleReceiveReady,
+																	 shared_from_this(),
+																	 boost::asio::placeholders::error)));
+				return;
+			}
+#endif
+
 			// Async receive
 			this->socket.async_receive_from(boost::asio::buffer(this->receiveBuffer),
-											this->remoteEndpoint,
-											boost::bind(&UDPServer::handleReceive,
-														shared_from_this(),
-														boost::asio::placeholders::error,
-														boost::asio::placeholders::bytes_transferred));
+											this->receiveEndpoint,
+											makeAllocHandler(this->receiveHandlerMemory,
+															 boost::bind(&UDPShard::handleReceive,
+																		 shared_from_this(),
+																		 boost::asio::placeholders::error,
+																		 boost::asio::placeholders::bytes_transferred)));
 		}
 
+		// Starts flushing the peers' send queues unless that's already under way, safe from any thread.
+		// pushOntoSendQueue calls this itself
 		void send()
 		{
-			// Async send
-			if(this->sendBufferQueue.size() > 0)
+			// The socket may only be touched from the IO thread
+			if(!this->ioContext.get_executor().running_in_this_thread())
+			{
+				boost::asio::post(this->ioContext, boost::bind(&UDPShard::send, shared_from_this()));
+				return;
+			}
+
+			std::lock_guard<std::mutex> lock(this->m);
+			this->startSend();
+		}
+
+		// Queues _packet for a peer we have a session with, safe from any thread.
+		// On the IO thread it returns false for unknown peers. Other threads hand the packet over through the
+		// submission queue and get true back, unknown peers are skipped when the IO thread drains it
+		bool pushOntoSendQueue(const udp::endpoint& _peer, PacketBuffer _packet)
+		{
+			if(!this->ioContext.get_executor().running_in_this_thread())
+			{
+				this->submit(Submission { _peer, std::move(_packet), false });
+				return true;
+			}
+
+			std::lock_guard<std::mutex> lock(this->m);
+			UDPSession* session = this->sessions.find(_peer);
+			if(session == nullptr)
+			{
+				return false;
+			}
+			this->queuePacket(*session, std::move(_packet));
+			this->startSend();
+			return true;
+		}
+
+		bool pushOntoSendQueue(const udp::endpoint& _peer, const std::string& _str)
+		{
+			// Copy straight into a pooled packet, null terminated
+			PacketBuffer packet = PacketBuffer::allocate(_str.size() + 1);
+			std::memcpy(packet.data(), _str.data(), _str.size());
+			packet.data()[_str.size()] = std::byte{0};
+			return this->pushOntoSendQueue(_peer, std::move(packet));
+		}
+
+		// Queues one shared, null terminated copy of _str for every peer, returns the number of recipients
+		size_t broadcast(const std::string& _str)
+		{
+			PacketBuffer packet = PacketBuffer::allocate(_str.size() + 1);
+			std::memcpy(packet.data(), _str.data(), _str.size());
+			packet.data()[_str.size()] = std::byte{0};
+
+			if(!this->ioContext.get_executor().running_in_this_thread())
+			{
+				this->submit(Submission { udp::endpoint(), std::move(packet), true });
+				return this->getSessionCount();
+			}
+
+			std::lock_guard<std::mutex> lock(this->m);
+			for(UDPSession& session : this->sessions.getSessions())
+			{
+				this->queuePacket(session, packet);
+			}
+			this->startSend();
+			return this->sessions.size();
+		}
+
+		// Sends _message to a peer on one of the channels given to setChannels. Returns false if the peer
+		// hasn't spoken to us over the channel layer yet or the channel refused it (see ReliableConnection::send).
+		// Channel state lives on the IO thread, calls from other threads are posted there and return true
+		bool sendOnChannel(const udp::endpoint& _peer, uint8_t _channel, MessageView _message)
+		{
+			if(!this->ioContext.get_executor().running_in_this_thread())
 			{
-				this->socket.async_send_to(boost::asio::buffer(this->sendBufferQueue.front(), this->sendBufferQueue.front().size()),
-										this->remoteEndpoint,
-										boost::bind(&UDPServer::handleSend,
-													shared_from_this(),
-													boost::asio::placeholders::error,
-													boost::asio::placeholders::bytes_transferred));
+				PacketBuffer message = PacketBuffer::copyOf(_message.data(), _message.size());
+				boost::asio::post(this->ioContext, [self = shared_from_this(), _peer, _channel, message]()
+				{
+					self->sendOnChannel(_peer, _channel, message.view());
+				});
+				return true;
 			}
+
+			UDPSession* session = this->sessions.find(_peer);
+			if(session == nullptr || !session->connection)
+			{
+				return false;
+			}
+			bool sent = session->connection->send(_channel, _message, std::chrono::steady_clock::now());
+			this->flushChannel(*session);
+			return sent;
+		}
+
+		// sendOnChannel to every peer, returns the number of peers
+		size_t broadcastOnChannel(uint8_t _channel, MessageView _message)
+		{
+			PacketBuffer message = PacketBuffer::copyOf(_message.data(), _message.size());
+			boost::asio::dispatch(this->ioContext, [self = shared_from_this(), _channel, message]()
+			{
+				for(UDPSession& session : self->sessions.getSessions())
+				{
+					if(session.connection)
+					{
+						session.connection->send(_channel, message.view(), std::chrono::steady_clock::now());
+						self->flushChannel(session);
+					}
+				}
+			});
+			return this->getSessionCount();
 		}
 
-		void pushOntoSendQueue(std::string _str)
+		// Up to _sessionLimit peers' own counters, returns how many were listed
+		size_t writeSessionStats(std::ostream& _out, size_t _sessionLimit = SIZE_MAX)
 		{
 			std::lock_guard<std::mutex> lock(this->m);
-			this->sendBufferQueue.push(_str + '\0');
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			size_t listed = 0;
+			for(const UDPSession& session : this->sessions.getSessions())
+			{
+				if(listed >= _sessionLimit)
+				{
+					break;
+				}
+				listed++;
+				_out << "session " << session.endpoint
+					 << " bytes_received " << session.bytesReceived
+					 << " bytes_sent " << session.bytesSent
+					 << " messages_received " << session.messagesReceived
+					 << " messages_sent " << session.messagesSent
+					 << " send_queue_depth " << session.getPending().size()
+					 << " idle_seconds " << std::chrono::duration_cast<std::chrono::seconds>(now - session.lastSeen).count() << '\n';
+			}
+			return listed;
+		}
+
+		// Default message handler, dumps the datagram
+		static void print(UDPShard& _socket, UDPSession& _session, MessageView _message)
+		{
+			std::cout << "Received: ";
+			for(std::byte b : _message)
+			{
+				std::cout << std::hex << std::to_integer<unsigned int>(b) << ' ';
+			}
+			std::cout << "\n\n";
+		}
+
+		// Default channel handler, dumps the message
+		static void printChannel(UDPShard& _socket, UDPSession& _session, uint8_t _channel, MessageView _message)
+		{
+			std::cout << "Channel " << std::dec << static_cast<unsigned int>(_channel) << " received: ";
+			for(std::byte b : _message)
+			{
+				std::cout << std::hex << std::to_integer<unsigned int>(b) << ' ';
+			}
+			std::cout << "\n\n";
 		}
 
 		/*****************
@@ -98,83 +332,675 @@ class UDPServer : public std::enable_shared_from_this<UDPServer>
 		 ****************/
 		udp::socket& getSocket() { return this->socket; }
 		bool isSocketActive() { return this->mSocketActive; }
+		void setMessageHandler(MessageHandler _messageHandler) { this->messageHandler = std::move(_messageHandler); }
+		void setBatchHandler(BatchHandler _batchHandler) { this->batchHandler = std::move(_batchHandler); }
+		void setChannelHandler(ChannelHandler _channelHandler) { this->channelHandler = std::move(_channelHandler); }
+		// Set before start(). Runs the channel layer over every peer, channel i gets _modes[i]
+		void setChannels(std::vector<ChannelMode> _modes) { this->channelModes = std::move(_modes); }
+		// Set before start(), batching is only available on Linux
+		void setBatchingEnabled(bool _enabled) { this->batchingEnabled = _enabled && DATAGRAMBATCH_SUPPORTED; }
+		bool isBatchingEnabled() { return this->batchingEnabled; }
+#if DATAGRAMBATCH_SUPPORTED
+		// UDP GSO for runs of equally sized packets, off by default
+		void setSegmentationOffloadEnabled(bool _enabled) { this->sendBatch.setSegmentationOffloadEnabled(_enabled); }
+#endif
+		// Peers quiet for this long are forgotten, SESSION_IDLE_TIMEOUT by default
+		void setSessionIdleTimeout(std::chrono::steady_clock::duration _timeout) { this->sessionIdleTimeout = _timeout; }
+		// Only call from a handler, the session is only valid for the duration of the call
+		UDPSession* getSession(const udp::endpoint& _peer) { return this->sessions.find(_peer); }
+
+		// Asks the kernel to steer this socket datagrams that arrive on _cpu, so they're handled
+		// where their interrupt ran. Pair it with pinning the shard's thread to the same CPU
+		bool setIncomingCPU(size_t _cpu)
+		{
+#if UDPSERVER_SHARDING_SUPPORTED && defined(SO_INCOMING_CPU)
+			int cpu = static_cast<int>(_cpu);
+			return ::setsockopt(this->socket.native_handle(), SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == 0;
+#else
+			return false;
+#endif
+		}
+
+		size_t getSessionCount()
+		{
+			std::lock_guard<std::mutex> lock(this->m);
+			return this->sessions.size();
+		}
 
 	private:
 		void handleReceive(const boost::system::error_code& _error, size_t _bytes_transferred)
 		{
 			if (!_error)
 			{
-				std::string str(this->receiveBuffer.begin(), this->receiveBuffer.begin() + _bytes_transferred);
-
-				std::cout << "Received: ";
-				for(int i = 0; i < str.size(); ++i)
-				{
-					std::cout << std::hex << (unsigned int)str[i] << ' ';
-				}
-				std::cout << "\n\n";
+				// Hand the datagram over in place, receiveBuffer isn't reused until we receive again
+				Datagram datagram = { std::as_bytes(std::span(this->receiveBuffer.data(), _bytes_transferred)), this->receiveEndpoint };
+				this->dispatch(std::span<const Datagram>(&datagram, 1));
 
 				this->receive();
     		}
+			// An ICMP port unreachable from a peer that went away, the socket is fine
+			else if(_error == boost::asio::error::connection_refused)
+			{
+				this->receive();
+			}
 			else
 			{
+				Metrics::add(MetricCounter::Errors);
 				std::cout << "Error: " << _error.message() << '\n';
 			}
 		}
 
-		void handleSend(const boost::system::error_code& _error, size_t _bytes_transferred)
+		// Finds or creates the senders' sessions, then hands the batch to the batch handler
+		// or each datagram to the message handler
+		void dispatch(std::span<const Datagram> _datagrams)
 		{
-			if (!_error)
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
 			{
-				std::string str = this->sendBufferQueue.front();
-				this->sendBufferQueue.pop();
+				std::lock_guard<std::mutex> lock(this->m);
+				for(const Datagram& datagram : _datagrams)
+				{
+					size_t sessionCount = this->sessions.size();
+					UDPSession& session = this->sessions.insert(datagram.sender, now);
+					if(this->sessions.size() != sessionCount)
+					{
+						Metrics::add(MetricCounter::Accepts);
+					}
+					session.lastSeen = now;
+					session.bytesReceived += datagram.data.size();
+					session.messagesReceived++;
+
+					PacketLogger::log(getEndpointId(datagram.sender), PacketDirection::Received, datagram.data);
+					Metrics::add(MetricCounter::BytesReceived, static_cast<int64_t>(datagram.data.size()));
+				}
+			}
+			Metrics::add(MetricCounter::MessagesReceived, static_cast<int64_t>(_datagrams.size()));
 
-				std::cout << "Sending: ";
-				for(int i = 0; i < str.size(); ++i)
+			// Sessions only come and go on this thread, so they stay put while the handlers run unlocked
+			std::chrono::steady_clock::time_point handlerStart = std::chrono::steady_clock::now();
+			if(!this->channelModes.empty())
+			{
+				for(const Datagram& datagram : _datagrams)
+				{
+					this->receiveOnChannel(*this->sessions.find(datagram.sender), datagram.data, now);
+				}
+			}
+			else if(this->batchHandler)
+			{
+				this->batchHandler(*this, _datagrams);
+			}
+			else
+			{
+				for(const Datagram& datagram : _datagrams)
 				{
-					std::cout << std::hex << (unsigned int)str[i] << ' ';
+					this->messageHandler(*this, *this->sessions.find(datagram.sender), datagram.data);
 				}
-				std::cout << "\n\n";
+			}
+			Metrics::record(MetricHistogram::HandlerTime, std::chrono::steady_clock::now() - handlerStart);
+		}
 
-				
-				if(this->sendBufferQueue.size() > 0)
+		void receiveOnChannel(UDPSession& _session, MessageView _datagram, std::chrono::steady_clock::time_point _now)
+		{
+			if(!_session.connection)
+			{
+				_session.connection = std::make_unique<ReliableConnection>(this->channelModes, RECV_BUFFER_SIZE);
+			}
+
+			_session.connection->receive(_datagram, _now, [this, &_session](uint8_t _channel, MessageView _message)
+			{
+				this->channelHandler(*this, _session, _channel, _message);
+			});
+			// Acks go straight back rather than waiting for the next update
+			_session.connection->update(_now);
+			this->flushChannel(_session);
+		}
+
+		// Moves the datagrams the channel layer produced onto the peer's send queue
+		void flushChannel(UDPSession& _session)
+		{
+			std::vector<PacketBuffer>& outgoing = _session.connection->getOutgoing();
+			if(outgoing.empty())
+			{
+				return;
+			}
+
+			std::lock_guard<std::mutex> lock(this->m);
+			for(PacketBuffer& packet : outgoing)
+			{
+				this->queuePacket(_session, std::move(packet));
+			}
+			outgoing.clear();
+			this->startSend();
+		}
+
+		void startChannelUpdates()
+		{
+			this->channelTimer.expires_after(CHANNEL_UPDATE_INTERVAL);
+			this->channelTimer.async_wait(boost::bind(&UDPShard::handleChannelUpdate,
+													  shared_from_this(),
+													  boost::asio::placeholders::error));
+		}
+
+		// Resends and standalone acks for every peer
+		void handleChannelUpdate(const boost::system::error_code& _error)
+		{
+			if(_error)
+			{
+				return;
+			}
+
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			for(UDPSession& session : this->sessions.getSessions())
+			{
+				if(session.connection)
 				{
-					this->send();
+					session.connection->update(now);
+					this->flushChannel(session);
 				}
-    		}
+			}
+			this->startChannelUpdates();
+		}
+
+		// A send handed over from another thread
+		struct Submission
+		{
+			udp::endpoint peer;
+			PacketBuffer packet;
+			// Goes to every peer, peer is unused
+			bool broadcast;
+		};
+
+		// Only the submission that finds the queue empty wakes the IO thread
+		void submit(Submission _submission)
+		{
+			if(this->submissions.push(std::move(_submission)))
+			{
+				boost::asio::post(this->ioContext, boost::bind(&UDPShard::drainSubmissions, shared_from_this()));
+			}
+		}
+
+		// Queues everything other threads submitted under one lock and starts sending it
+		void drainSubmissions()
+		{
+			std::lock_guard<std::mutex> lock(this->m);
+			this->submissions.drain([this](Submission _submission)
+			{
+				if(_submission.broadcast)
+				{
+					for(UDPSession& session : this->sessions.getSessions())
+					{
+						this->queuePacket(session, _submission.packet);
+					}
+				}
+				else if(UDPSession* session = this->sessions.find(_submission.peer))
+				{
+					this->queuePacket(*session, std::move(_submission.packet));
+				}
+			});
+			this->startSend();
+		}
+
+		// Must hold m
+		void queuePacket(UDPSession& _session, PacketBuffer _packet)
+		{
+			_session.push(std::move(_packet));
+			Metrics::add(MetricCounter::WriteQueueDepth);
+			if(!_session.sendPending)
+			{
+				_session.sendPending = true;
+				this->readyPeers.push_back(_session.endpoint);
+			}
+		}
+
+		// Must hold m. Peers take turns, each gets one send (or one batch) before going to the back of the line
+		void startSend()
+		{
+			if(this->sendInFlight || this->readyPeers.empty())
+			{
+				return;
+			}
+			this->sendInFlight = true;
+
+#if DATAGRAMBATCH_SUPPORTED
+			if(this->batchingEnabled)
+			{
+				this->waitToSend();
+				return;
+			}
+#endif
+
+			// Async send, the packet stays in the session's queue until it's out
+			this->sendEndpoint = this->readyPeers.front();
+			const PacketBuffer& packet = this->sessions.find(this->sendEndpoint)->getPending().front();
+			this->socket.async_send_to(boost::asio::buffer(packet.data(), packet.size()),
+									   this->sendEndpoint,
+									   makeAllocHandler(this->sendHandlerMemory,
+														boost::bind(&UDPShard::handleSend,
+																	shared_from_this(),
+																	boost::asio::placeholders::error,
+																	boost::asio::placeholders::bytes_transferred)));
+		}
+
+		// Must hold m. Takes _count packets off the front peer's queue and sends it to the back of the line
+		// if it has more, failed sends are dropped like any lost datagram
+		void finishSend(size_t _count, bool _sent)
+		{
+			UDPSession& session = *this->sessions.find(this->readyPeers.front());
+			std::span<const PacketBuffer> pending = session.getPending();
+			for(size_t i = 0; i < _count && _sent; ++i)
+			{
+				PacketLogger::log(getEndpointId(session.endpoint), PacketDirection::Sent, pending[i].view());
+				Metrics::add(MetricCounter::BytesSent, static_cast<int64_t>(pending[i].size()));
+				session.bytesSent += pending[i].size();
+			}
+			if(_sent)
+			{
+				session.messagesSent += _count;
+				Metrics::add(MetricCounter::MessagesSent, static_cast<int64_t>(_count));
+				Metrics::add(MetricCounter::Writes);
+			}
+			Metrics::add(MetricCounter::WriteQueueDepth, -static_cast<int64_t>(_count));
+			session.popPending(_count);
+
+			this->readyPeers.pop_front();
+			if(session.hasPending())
+			{
+				this->readyPeers.push_back(session.endpoint);
+			}
+			else
+			{
+				session.sendPending = false;
+			}
+		}
+
+		void handleSend(const boost::system::error_code& _error, size_t _bytes_transferred)
+		{
+			std::lock_guard<std::mutex> lock(this->m);
+			if (_error)
+			{
+				Metrics::add(MetricCounter::Errors);
+				std::cout << "Error: " << _error.message() << '\n';
+			}
+			this->finishSend(1, !_error);
+
+			this->sendInFlight = false;
+			this->startSend();
+		}
+
+#if DATAGRAMBATCH_SUPPORTED
+		void handleReceiveReady(const boost::system::error_code& _error)
+		{
+			boost::system::error_code error = _error;
+			for(size_t i = 0; i < MAX_RECEIVE_BATCHES && !error; ++i)
+			{
+				// Nothing left means the wakeup is used up, a short batch means the socket is drained
+				size_t count = this->receiveBatch.receive(this->socket.native_handle(), error);
+				if(count == 0)
+				{
+					break;
+				}
+				this->dispatch(this->receiveBatch.getDatagrams());
+				if(count < this->receiveBatch.getBatchSize())
+				{
+					break;
+				}
+			}
+
+			// An ICMP port unreachable from a peer that went away, the socket is fine
+			if(!error || error == boost::asio::error::connection_refused)
+			{
+				this->receive();
+			}
 			else
 			{
+				Metrics::add(MetricCounter::Errors);
+				std::cout << "Error: " << error.message() << '\n';
+			}
+		}
+
+		// Must hold m
+		void waitToSend()
+		{
+			this->socket.async_wait(udp::socket::wait_write,
+									makeAllocHandler(this->sendHandlerMemory,
+													 boost::bind(&UDPShard::handleSendReady,
+																 shared_from_this(),
+																 boost::asio::placeholders::error)));
+		}
+
+		void handleSendReady(const boost::system::error_code& _error)
+		{
+			std::lock_guard<std::mutex> lock(this->m);
+			if(_error)
+			{
+				this->sendInFlight = false;
+				Metrics::add(MetricCounter::Errors);
 				std::cout << "Error: " << _error.message() << '\n';
+				return;
+			}
+
+			while(!this->readyPeers.empty())
+			{
+				const udp::endpoint& peer = this->readyPeers.front();
+				boost::system::error_code error;
+				size_t count = this->sendBatch.send(this->socket.native_handle(), this->sessions.find(peer)->getPending(), peer, error);
+				if(error)
+				{
+					// Only this peer's packet is at fault, drop it and carry on
+					Metrics::add(MetricCounter::Errors);
+					std::cout << "Error: " << error.message() << '\n';
+					this->finishSend(1, false);
+				}
+				// The socket buffer filled up, go again once it drains
+				else if(count == 0)
+				{
+					this->waitToSend();
+					return;
+				}
+				else
+				{
+					this->finishSend(count, true);
+				}
+			}
+			this->sendInFlight = false;
+		}
+#endif
+
+		void startEviction()
+		{
+			this->evictionTimer.expires_after(SESSION_EVICTION_INTERVAL);
+			this->evictionTimer.async_wait(boost::bind(&UDPShard::handleEviction,
+													   shared_from_this(),
+													   boost::asio::placeholders::error));
+		}
+
+		// Peers never say goodbye over UDP, anyone quiet for sessionIdleTimeout is forgotten
+		void handleEviction(const boost::system::error_code& _error)
+		{
+			if(_error)
+			{
+				return;
+			}
+
+			size_t evicted = 0;
+			{
+				std::lock_guard<std::mutex> lock(this->m);
+				evicted = this->sessions.evictIdle(std::chrono::steady_clock::now(), this->sessionIdleTimeout);
 			}
+			Metrics::add(MetricCounter::Disconnects, static_cast<int64_t>(evicted));
+			Metrics::add(MetricCounter::Timeouts, static_cast<int64_t>(evicted));
+			this->startEviction();
 		}
 
+		// Guards sessions, readyPeers and sendInFlight
 		std::mutex m;
 		bool mSocketActive = false;
 		boost::asio::io_context& ioContext;
 		udp::socket socket;
-		udp::endpoint remoteEndpoint;
+		// Sender of the datagram being received in unbatched mode
+		udp::endpoint receiveEndpoint;
+		// Peer of the send in flight in unbatched mode
+		udp::endpoint sendEndpoint;
 		boost::array<unsigned char, RECV_BUFFER_SIZE> receiveBuffer;
-		std::queue<std::string> sendBufferQueue;
+		UDPSessionTable sessions;
+		// Peers with packets queued, in the order they get to send
+		std::deque<udp::endpoint> readyPeers;
+		// Sends from other threads on their way to the IO thread
+		SubmissionQueue<Submission> submissions;
+		// A send, a writable wait or a flush is pending
+		bool sendInFlight = false;
+		boost::asio::steady_timer evictionTimer;
+		boost::asio::steady_timer channelTimer;
+		std::chrono::steady_clock::duration sessionIdleTimeout = SESSION_IDLE_TIMEOUT;
+		MessageHandler messageHandler = print;
+		BatchHandler batchHandler;
+		ChannelHandler channelHandler = printChannel;
+		// Empty unless the channel layer is on
+		std::vector<ChannelMode> channelModes;
+		bool batchingEnabled = DATAGRAMBATCH_SUPPORTED;
+#if DATAGRAMBATCH_SUPPORTED
+		DatagramReceiveBatch receiveBatch = DatagramReceiveBatch(DATAGRAM_BATCH_SIZE, RECV_BUFFER_SIZE);
+		DatagramSendBatch sendBatch = DatagramSendBatch(DATAGRAM_BATCH_SIZE);
+#endif
+		// Completion handler memory, one receive and one send are in flight at most
+		HandlerMemory receiveHandlerMemory;
+		HandlerMemory sendHandlerMemory;
 };
 
-boost::asio::io_context io_context;
+// Opens one UDPShard per IO thread, every shard's socket bound to the same port through SO_REUSEPORT.
+// The kernel keeps each peer on one shard, so a peer's session, queue and channels all stay on one thread
+class UDPServer : public std::enable_shared_from_this<UDPServer>
+{
+	typedef std::shared_ptr<UDPShard> Shard;
+	public:
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		UDPServer() = delete;
+
+		// Parameterized constructors
+		// A shard count of 0 runs one shard per hardware thread, without SO_REUSEPORT there's always exactly one
+		UDPServer(size_t _port, size_t _shardCount = 0) : ioContextPool(UDPSERVER_SHARDING_SUPPORTED ? _shardCount : 1)
+		{
+			bool reusePort = this->ioContextPool.size() > 1;
+			for(size_t i = 0; i < this->ioContextPool.size(); ++i)
+			{
+				this->shards.push_back(std::make_shared<UDPShard>(this->ioContextPool.getIOContext(i), _port, reusePort));
+			}
+			// Shard i's thread stays on one CPU, so its socket buffers and sessions stay in that CPU's cache
+			this->ioContextPool.setCPUPinningEnabled(reusePort);
+		}
+
+		// Destructor
+		~UDPServer() {}
+
+		/****************
+		 * Server functions
+		 ***************/
+		void start()
+		{
+			for(Shard& shard : this->shards)
+			{
+				shard->start();
+			}
+		}
+
+		// Blocks until stop() is called
+		void run()
+		{
+			this->ioContextPool.run();
+		}
+
+		void stop()
+		{
+			this->ioContextPool.stop();
+		}
+
+		void shutdown()
+		{
+			for(Shard& shard : this->shards)
+			{
+				shard->shutdown();
+			}
+		}
+
+		// Returns how many peers, across every shard, it was queued for
+		size_t broadcast(const std::string& _str)
+		{
+			size_t recipients = 0;
+			for(Shard& shard : this->shards)
+			{
+				recipients += shard->broadcast(_str);
+			}
+			return recipients;
+		}
+
+		size_t broadcastOnChannel(uint8_t _channel, MessageView _message)
+		{
+			size_t recipients = 0;
+			for(Shard& shard : this->shards)
+			{
+				recipients += shard->broadcastOnChannel(_channel, _message);
+			}
+			return recipients;
+		}
+
+		// Process wide metrics, then each shard's sessions, up to _sessionLimit peers in all
+		void writeStats(std::ostream& _out, size_t _sessionLimit = SIZE_MAX)
+		{
+			Metrics::getSnapshot().writeText(_out);
+
+			_out << "sessions " << this->getSessionCount() << '\n';
+			_out << "shards " << this->shards.size() << '\n';
+			size_t listed = 0;
+			for(size_t i = 0; i < this->shards.size(); ++i)
+			{
+				_out << "shard " << i << " sessions " << this->shards[i]->getSessionCount() << '\n';
+				listed += this->shards[i]->writeSessionStats(_out, _sessionLimit - listed);
+			}
+		}
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		size_t getShardCount() const { return this->shards.size(); }
+		// Only for setup and for calls that belong on one shard's thread
+		UDPShard& getShard(size_t _index) { return *this->shards[_index]; }
+
+		size_t getSessionCount()
+		{
+			size_t count = 0;
+			for(Shard& shard : this->shards)
+			{
+				count += shard->getSessionCount();
+			}
+			return count;
+		}
+
+		// Every setter applies to all shards, set them before start()
+		void setMessageHandler(const UDPShard::MessageHandler& _messageHandler)
+		{
+			for(Shard& shard : this->shards)
+			{
+				shard->setMessageHandler(_messageHandler);
+			}
+		}
+
+		void setBatchHandler(const UDPShard::BatchHandler& _batchHandler)
+		{
+			for(Shard& shard : this->shards)
+			{
+				shard->setBatchHandler(_batchHandler);
+			}
+		}
+
+		void setChannelHandler(const UDPShard::ChannelHandler& _channelHandler)
+		{
+			for(Shard& shard : this->shards)
+			{
+				shard->setChannelHandler(_channelHandler);
+			}
+		}
+
+		void setChannels(const std::vector<ChannelMode>& _modes)
+		{
+			for(Shard& shard : this->shards)
+			{
+				shard->setChannels(_modes);
+			}
+		}
+
+		void setBatchingEnabled(bool _enabled)
+		{
+			for(Shard& shard : this->shards)
+			{
+				shard->setBatchingEnabled(_enabled);
+			}
+		}
+
+		void setSessionIdleTimeout(std::chrono::steady_clock::duration _timeout)
+		{
+			for(Shard& shard : this->shards)
+			{
+				shard->setSessionIdleTimeout(_timeout);
+			}
+		}
+
+#if DATAGRAMBATCH_SUPPORTED
+		void setSegmentationOffloadEnabled(bool _enabled)
+		{
+			for(Shard& shard : this->shards)
+			{
+				shard->setSegmentationOffloadEnabled(_enabled);
+			}
+		}
+#endif
+
+		// Steers each shard the datagrams whose interrupts land on its pinned CPU, on top of the SO_REUSEPORT hash.
+		// Only pays off when the NIC's receive queues are spread over the same CPUs. Returns false if the kernel refused
+		bool setIncomingCPUEnabled(bool _enabled)
+		{
+			if(!_enabled || this->shards.size() < 2)
+			{
+				return true;
+			}
+
+			bool applied = true;
+			for(size_t i = 0; i < this->shards.size(); ++i)
+			{
+				applied = this->shards[i]->setIncomingCPU(this->ioContextPool.getCPU(i)) && applied;
+			}
+			return applied;
+		}
+
+	private:
+		// Declared before the shards, every shard's socket lives on one of the pool's io_contexts
+		IOContextPool ioContextPool;
+		std::vector<Shard> shards;
+};
 
 void stopEverything(std::shared_ptr<UDPServer> _server);
 void stopEverything(std::shared_ptr<UDPServer> _server)
 {
+	_server->stop();
 	if(_server.use_count() == 1)
 	{
 		_server.reset();
 	}
-	io_context.stop();
 }
 
 int main(int argc, char* argv[])
 {
+	// Packets are traced to asio_udp_server.pktlog, read it with packet_log_dump
+	PacketLogger::start("asio_udp_server.pktlog");
+
+	// Usage: asio_udp_server [batching] [segmentation offload] [channels] [shards] [incoming cpu]
+	// Batching (recvmmsg/sendmmsg) is on by default where supported, segmentation offload is off.
+	// Channels runs the reliability layer, start the client with channels too.
+	// Shards defaults to one SO_REUSEPORT socket per hardware thread, incoming cpu adds SO_INCOMING_CPU steering
+	bool batchingEnabled = argc > 1 ? std::stoul(argv[1]) != 0 : true;
+	bool segmentationOffloadEnabled = argc > 2 && std::stoul(argv[2]) != 0;
+	bool channelsEnabled = argc > 3 && std::stoul(argv[3]) != 0;
+	size_t shardCount = argc > 4 ? std::stoul(argv[4]) : 0;
+	bool incomingCPUEnabled = argc > 5 && std::stoul(argv[5]) != 0;
+
 	// Initialize the UDPServer
-	std::shared_ptr<UDPServer> server = std::make_shared<UDPServer>(io_context, 1111);
+	std::shared_ptr<UDPServer> server = std::make_shared<UDPServer>(1111, shardCount);
+	if(!server->setIncomingCPUEnabled(incomingCPUEnabled))
+	{
+		std::cout << "Error: couldn't set SO_INCOMING_CPU" << '\n';
+	}
+	server->setBatchingEnabled(batchingEnabled);
+#if DATAGRAMBATCH_SUPPORTED
+	server->setSegmentationOffloadEnabled(segmentationOffloadEnabled);
+#endif
+	if(channelsEnabled)
+	{
+		server->setChannels({ ChannelMode::ReliableOrdered, ChannelMode::ReliableUnordered, ChannelMode::UnreliableSequenced });
+	}
 
 	// Create an input loop inside a lambda function
-	auto inputLoop = [&server]()
+	auto inputLoop = [&server, channelsEnabled]()
 	{
         bool q = false;
         char cmd;
@@ -182,8 +1008,16 @@ int main(int argc, char* argv[])
         while(!q)
         {
             std::cout << "Quit: (Q or q)" << '\n';
+            std::cout << "Broadcast: (B or b)" << '\n';
+            std::cout << "Stats: (S or s)" << '\n';
+            std::cout << "Export stats to asio_udp_server_stats.txt: (E or e)" << '\n';
             std::cout << "Enter command: " << '\n' << "> ";
-            std::cin >> cmd;
+            // Treat a closed stdin as quit instead of replaying the last command forever
+            if(!(std::cin >> cmd))
+            {
+                cmd = 'q';
+            }
+			std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
             switch(cmd)
             {
                 case 'Q':
@@ -192,10 +1026,33 @@ int main(int argc, char* argv[])
                     q = true;
 					stopEverything(server);
                     break;
+				case 'B': [[fallthrough]];
+				case 'b':
+				// Must brace this block for the initialization of str
+				{
+					std::string str;
+					std::cout << "Enter message to broadcast: ";
+					std::getline(std::cin, str);
+					// Null terminated, like every other message the templates send
+					size_t recipients = channelsEnabled ? server->broadcastOnChannel(0, std::as_bytes(std::span(str.c_str(), str.size() + 1))) : server->broadcast(str);
+					std::cout << "Broadcast to " << std::dec << recipients << " peers" << '\n';
+					break;
+				}
+				case 'S': [[fallthrough]];
+				case 's':
+					server->writeStats(std::cout, STATS_SESSION_LIMIT);
+					break;
+				case 'E': [[fallthrough]];
+				case 'e':
+				{
+					std::ofstream file("asio_udp_server_stats.txt");
+					server->writeStats(file);
+					std::cout << "Stats written to asio_udp_server_stats.txt" << '\n';
+					break;
+				}
                 default:
                     break;
             }
-			std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
         }
     };
 	// Thread our input loop
@@ -204,8 +1061,11 @@ int main(int argc, char* argv[])
 	// Start the server proper
 	server->start();
 
-	// If the client can't connect to the server, this won't block
-	io_context.run();
+	std::cout << "Listening on port 1111 with " << server->getShardCount() << " shards on " << IOContextPool::getReactorName() << '\n';
+	// Blocks until stopEverything
+	server->run();
+
+	PacketLogger::stop();
 	
 	return 0;
 }
\ No newline at end of file
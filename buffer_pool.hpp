@@ -0,0 +1,395 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+// C++
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <span>
+#include <utility>
+#include <vector>
+
+// Header in front of every pooled packet, the packet bytes follow it
+struct alignas(16) PacketBlock
+{
+	std::atomic<uint32_t> refCount;
+	uint32_t sizeClass;
+	size_t size;
+	size_t capacity;
+	PacketBlock* next;
+
+	std::byte* data() { return reinterpret_cast<std::byte*>(this + 1); }
+};
+
+// Snapshot of the allocator's counters summed over every thread
+struct BufferPoolStats
+{
+	size_t allocations = 0;
+	size_t releases = 0;
+	// Served from the calling thread's cache
+	size_t cacheHits = 0;
+	// Batches moved from the shared free lists into a thread cache
+	size_t refills = 0;
+	// Actual trips to malloc/free, these should stop growing once the pool has warmed up
+	size_t systemAllocations = 0;
+	size_t systemFrees = 0;
+	// Bigger than the largest size class, always malloc'd
+	size_t oversizeAllocations = 0;
+
+	size_t inUse() const { return this->allocations - this->releases; }
+};
+
+// Size-classed packet allocator.
+// Each thread keeps a small cache of free blocks per size class and only touches the shared,
+// mutex-guarded free lists to refill or spill a batch at a time. In steady state allocate and
+// release never reach malloc/free.
+class BufferPool
+{
+	public:
+		static constexpr std::array<size_t, 11> SIZE_CLASSES = { 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768, 65536 };
+		static constexpr uint32_t OVERSIZE_CLASS = SIZE_CLASSES.size();
+		// Blocks moved between a thread cache and the shared free lists at once
+		static constexpr size_t BATCH_SIZE = 32;
+		// Per size class limits on how many bytes sit idle in each thread cache / the shared free lists
+		static constexpr size_t MAX_THREAD_CACHE_BYTES = 256 * 1024;
+		static constexpr size_t MAX_SHARED_BYTES = 16 * 1024 * 1024;
+
+		static PacketBlock* allocate(size_t _size)
+		{
+			ThreadCache& cache = threadCache();
+			cache.count(cache.allocations);
+
+			uint32_t sizeClass = getSizeClass(_size);
+			PacketBlock* block = nullptr;
+			if(sizeClass == OVERSIZE_CLASS)
+			{
+				cache.count(cache.oversizeAllocations);
+				block = systemAllocate(_size, sizeClass);
+			}
+			else
+			{
+				if(cache.freeLists[sizeClass] == nullptr)
+				{
+					refill(cache, sizeClass);
+				}
+				else
+				{
+					cache.count(cache.cacheHits);
+				}
+
+				block = cache.freeLists[sizeClass];
+				if(block != nullptr)
+				{
+					cache.freeLists[sizeClass] = block->next;
+					cache.freeCounts[sizeClass]--;
+				}
+				else
+				{
+					block = systemAllocate(SIZE_CLASSES[sizeClass], sizeClass);
+				}
+			}
+
+			block->refCount.store(1, std::memory_order_relaxed);
+			block->size = _size;
+			block->next = nullptr;
+			return block;
+		}
+
+		static void release(PacketBlock* _block)
+		{
+			ThreadCache& cache = threadCache();
+			cache.count(cache.releases);
+
+			uint32_t sizeClass = _block->sizeClass;
+			if(sizeClass == OVERSIZE_CLASS)
+			{
+				systemFree(_block);
+				return;
+			}
+
+			_block->next = cache.freeLists[sizeClass];
+			cache.freeLists[sizeClass] = _block;
+			cache.freeCounts[sizeClass]++;
+
+			if(cache.freeCounts[sizeClass] * SIZE_CLASSES[sizeClass] > MAX_THREAD_CACHE_BYTES && cache.freeCounts[sizeClass] > BATCH_SIZE)
+			{
+				spill(cache, sizeClass, BATCH_SIZE);
+			}
+		}
+
+		static BufferPoolStats getStats()
+		{
+			SharedState& shared = sharedState();
+			std::lock_guard<std::mutex> lock(shared.cachesMutex);
+
+			BufferPoolStats stats = shared.retiredStats;
+			for(ThreadCache* cache : shared.caches)
+			{
+				cache->addTo(stats);
+			}
+			return stats;
+		}
+
+		static uint32_t getSizeClass(size_t _size)
+		{
+			for(uint32_t i = 0; i < SIZE_CLASSES.size(); ++i)
+			{
+				if(_size <= SIZE_CLASSES[i])
+				{
+					return i;
+				}
+			}
+			return OVERSIZE_CLASS;
+		}
+
+	private:
+		// Counters are only written by the owning thread, relaxed atomics let getStats() read them from anywhere
+		struct ThreadCache
+		{
+			ThreadCache()
+			{
+				this->freeLists.fill(nullptr);
+				this->freeCounts.fill(0);
+
+				SharedState& shared = sharedState();
+				std::lock_guard<std::mutex> lock(shared.cachesMutex);
+				shared.caches.push_back(this);
+			}
+
+			// Thread exit, hand every cached block and our counters back to the shared state
+			~ThreadCache()
+			{
+				for(uint32_t i = 0; i < SIZE_CLASSES.size(); ++i)
+				{
+					spill(*this, i, this->freeCounts[i]);
+				}
+
+				SharedState& shared = sharedState();
+				std::lock_guard<std::mutex> lock(shared.cachesMutex);
+				this->addTo(shared.retiredStats);
+				std::erase(shared.caches, this);
+			}
+
+			void count(std::atomic<size_t>& _counter, size_t _amount = 1)
+			{
+				_counter.store(_counter.load(std::memory_order_relaxed) + _amount, std::memory_order_relaxed);
+			}
+
+			void addTo(BufferPoolStats& _stats) const
+			{
+				_stats.allocations += this->allocations.load(std::memory_order_relaxed);
+				_stats.releases += this->releases.load(std::memory_order_relaxed);
+				_stats.cacheHits += this->cacheHits.load(std::memory_order_relaxed);
+				_stats.refills += this->refills.load(std::memory_order_relaxed);
+				_stats.systemAllocations += this->systemAllocations.load(std::memory_order_relaxed);
+				_stats.systemFrees += this->systemFrees.load(std::memory_order_relaxed);
+				_stats.oversizeAllocations += this->oversizeAllocations.load(std::memory_order_relaxed);
+			}
+
+			std::array<PacketBlock*, SIZE_CLASSES.size()> freeLists;
+			std::array<size_t, SIZE_CLASSES.size()> freeCounts;
+
+			std::atomic<size_t> allocations = 0;
+			std::atomic<size_t> releases = 0;
+			std::atomic<size_t> cacheHits = 0;
+			std::atomic<size_t> refills = 0;
+			std::atomic<size_t> systemAllocations = 0;
+			std::atomic<size_t> systemFrees = 0;
+			std::atomic<size_t> oversizeAllocations = 0;
+		};
+
+		struct SharedFreeList
+		{
+			std::mutex m;
+			PacketBlock* head = nullptr;
+			size_t count = 0;
+		};
+
+		struct SharedState
+		{
+			std::array<SharedFreeList, SIZE_CLASSES.size()> freeLists;
+			std::mutex cachesMutex;
+			std::vector<ThreadCache*> caches;
+			BufferPoolStats retiredStats;
+		};
+
+		// Never destroyed so thread caches can still flush into it during static destruction
+		static SharedState& sharedState()
+		{
+			static SharedState* state = new SharedState();
+			return *state;
+		}
+
+		static ThreadCache& threadCache()
+		{
+			thread_local ThreadCache cache;
+			return cache;
+		}
+
+		static void refill(ThreadCache& _cache, uint32_t _sizeClass)
+		{
+			SharedFreeList& shared = sharedState().freeLists[_sizeClass];
+			std::lock_guard<std::mutex> lock(shared.m);
+			if(shared.head == nullptr)
+			{
+				return;
+			}
+
+			_cache.count(_cache.refills);
+			for(size_t i = 0; i < BATCH_SIZE && shared.head != nullptr; ++i)
+			{
+				PacketBlock* block = shared.head;
+				shared.head = block->next;
+				shared.count--;
+
+				block->next = _cache.freeLists[_sizeClass];
+				_cache.freeLists[_sizeClass] = block;
+				_cache.freeCounts[_sizeClass]++;
+			}
+		}
+
+		static void spill(ThreadCache& _cache, uint32_t _sizeClass, size_t _count)
+		{
+			SharedFreeList& shared = sharedState().freeLists[_sizeClass];
+			std::lock_guard<std::mutex> lock(shared.m);
+			for(size_t i = 0; i < _count && _cache.freeLists[_sizeClass] != nullptr; ++i)
+			{
+				PacketBlock* block = _cache.freeLists[_sizeClass];
+				_cache.freeLists[_sizeClass] = block->next;
+				_cache.freeCounts[_sizeClass]--;
+
+				// The shared list is full, give the memory back
+				if(shared.count * SIZE_CLASSES[_sizeClass] >= MAX_SHARED_BYTES)
+				{
+					_cache.count(_cache.systemFrees);
+					std::free(block);
+					continue;
+				}
+
+				block->next = shared.head;
+				shared.head = block;
+				shared.count++;
+			}
+		}
+
+		static PacketBlock* systemAllocate(size_t _capacity, uint32_t _sizeClass)
+		{
+			ThreadCache& cache = threadCache();
+			cache.count(cache.systemAllocations);
+
+			void* memory = std::malloc(sizeof(PacketBlock) + _capacity);
+			if(memory == nullptr)
+			{
+				throw std::bad_alloc();
+			}
+
+			PacketBlock* block = new (memory) PacketBlock();
+			block->sizeClass = _sizeClass;
+			block->capacity = _capacity;
+			return block;
+		}
+
+		static void systemFree(PacketBlock* _block)
+		{
+			ThreadCache& cache = threadCache();
+			cache.count(cache.systemFrees);
+
+			_block->~PacketBlock();
+			std::free(_block);
+		}
+};
+
+// Refcounted handle to a pooled packet.
+// Copies share the same bytes, so one serialized packet can sit in any number of queues.
+// The last handle to go returns the block to the pool.
+class PacketBuffer
+{
+	public:
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		PacketBuffer() = default;
+
+		// Uninitialized packet of _size bytes
+		static PacketBuffer allocate(size_t _size) { return PacketBuffer(BufferPool::allocate(_size)); }
+
+		static PacketBuffer copyOf(const void* _data, size_t _size)
+		{
+			PacketBuffer packet = PacketBuffer::allocate(_size);
+			std::memcpy(packet.data(), _data, _size);
+			return packet;
+		}
+
+		// Copy Constructor
+		// Shares the bytes, doesn't copy them
+		PacketBuffer(const PacketBuffer& other) : block(other.block)
+		{
+			if(this->block != nullptr)
+			{
+				this->block->refCount.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+
+		// Move Constructor
+		PacketBuffer(PacketBuffer&& other) noexcept : block(std::exchange(other.block, nullptr)) {}
+
+		// Destructor
+		~PacketBuffer() { this->reset(); }
+
+		/*****************
+		 * Overloaded Operators
+		 ****************/
+		PacketBuffer& operator=(const PacketBuffer& other)
+		{
+			PacketBuffer copy(other);
+			std::swap(this->block, copy.block);
+			return *this;
+		}
+
+		PacketBuffer& operator=(PacketBuffer&& other) noexcept
+		{
+			PacketBuffer moved(std::move(other));
+			std::swap(this->block, moved.block);
+			return *this;
+		}
+
+		explicit operator bool() const { return this->block != nullptr; }
+
+		/*****************
+		 * Buffer Functions
+		 ****************/
+		void reset()
+		{
+			if(this->block != nullptr && this->block->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				BufferPool::release(this->block);
+			}
+			this->block = nullptr;
+		}
+
+		// Shrink or grow within the block's capacity
+		void resize(size_t _size) { this->block->size = _size <= this->block->capacity ? _size : this->block->capacity; }
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		std::byte* data() { return this->block->data(); }
+		const std::byte* data() const { return this->block->data(); }
+		size_t size() const { return this->block != nullptr ? this->block->size : 0; }
+		size_t capacity() const { return this->block != nullptr ? this->block->capacity : 0; }
+		std::span<const std::byte> view() const { return std::span<const std::byte>(this->data(), this->size()); }
+		uint32_t useCount() const { return this->block != nullptr ? this->block->refCount.load(std::memory_order_relaxed) : 0; }
+
+	private:
+		explicit PacketBuffer(PacketBlock* _block) : block(_block) {}
+
+		PacketBlock* block = nullptr;
+};
+
+#endif
@@ -0,0 +1,262 @@
+// C++
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <queue>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+// Templates
+#include "buffer_pool.hpp"
+#include "metrics.hpp"
+#include "reliable_channel.hpp"
+
+// Consts
+// Simulated time advances in steps this small, it's the resolution of every latency reported
+const std::chrono::microseconds TICK = std::chrono::microseconds(100);
+// Independent message streams, like movement, chat and inventory updates in a game
+const size_t STREAM_COUNT = 4;
+// Send time and stream, padded out to a typical small game message
+const size_t MESSAGE_SIZE = 32;
+// The same limit the UDP templates receive with
+const size_t MAX_DATAGRAM_SIZE = 128;
+// Time after the last send for resends to finish
+const std::chrono::seconds DRAIN_TIME = std::chrono::seconds(5);
+
+struct LinkConditions
+{
+	double loss = 0;
+	std::chrono::nanoseconds latency;
+	// Each datagram's latency varies by up to this much either way, which also reorders them
+	std::chrono::nanoseconds jitter;
+};
+
+// One direction of a simulated network path, drops and delays datagrams
+class LossyLink
+{
+	public:
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		LossyLink() = delete;
+
+		// Parameterized constructor
+		LossyLink(const LinkConditions& _conditions, uint64_t _seed) : conditions(_conditions), random(_seed) {}
+
+		/*****************
+		 * Link Functions
+		 ****************/
+		void send(PacketBuffer _datagram, std::chrono::steady_clock::time_point _now)
+		{
+			this->sent++;
+			if(this->chance(this->random) < this->conditions.loss)
+			{
+				this->dropped++;
+				return;
+			}
+
+			std::uniform_int_distribution<int64_t> jitter(-this->conditions.jitter.count(), this->conditions.jitter.count());
+			std::chrono::nanoseconds delay = std::max(this->conditions.latency + std::chrono::nanoseconds(jitter(this->random)), std::chrono::nanoseconds(0));
+			this->inFlight.push(InFlight { _now + delay, this->sent, std::move(_datagram) });
+		}
+
+		// Sends everything _connection has queued
+		void sendAll(ReliableConnection& _connection, std::chrono::steady_clock::time_point _now)
+		{
+			for(PacketBuffer& datagram : _connection.getOutgoing())
+			{
+				this->send(std::move(datagram), _now);
+			}
+			_connection.getOutgoing().clear();
+		}
+
+		// Hands every datagram due by _now to _receive, earliest first
+		template <typename Receive>
+		void deliverDue(std::chrono::steady_clock::time_point _now, Receive&& _receive)
+		{
+			while(!this->inFlight.empty() && this->inFlight.top().arrival <= _now)
+			{
+				PacketBuffer datagram = this->inFlight.top().datagram;
+				this->inFlight.pop();
+				_receive(datagram.view());
+			}
+		}
+
+		size_t getDropped() const { return this->dropped; }
+
+	private:
+		struct InFlight
+		{
+			std::chrono::steady_clock::time_point arrival;
+			// Keeps datagrams with the same arrival time in send order
+			size_t order;
+			PacketBuffer datagram;
+
+			bool operator>(const InFlight& other) const { return this->arrival != other.arrival ? this->arrival > other.arrival : this->order > other.order; }
+		};
+
+		LinkConditions conditions;
+		std::mt19937_64 random;
+		std::uniform_real_distribution<double> chance = std::uniform_real_distribution<double>(0.0, 1.0);
+		std::priority_queue<InFlight, std::vector<InFlight>, std::greater<InFlight>> inFlight;
+		size_t sent = 0;
+		size_t dropped = 0;
+};
+
+struct Scenario
+{
+	std::string name;
+	std::vector<ChannelMode> modes;
+	// Every stream shares channel 0 instead of getting its own
+	bool sharedChannel;
+};
+
+struct ScenarioResult
+{
+	HistogramSnapshot latency;
+	size_t sent = 0;
+	size_t delivered = 0;
+	// send() refused the message, the channel's window was full
+	size_t blocked = 0;
+	ReliableConnectionStats senderStats;
+	ReliableConnectionStats receiverStats;
+};
+
+void recordLatency(HistogramSnapshot& _histogram, uint64_t _nanoseconds);
+void recordLatency(HistogramSnapshot& _histogram, uint64_t _nanoseconds)
+{
+	_histogram.counts[HistogramBuckets::indexOf(std::min(_nanoseconds, HistogramBuckets::MAX_VALUE))]++;
+	_histogram.total++;
+	_histogram.sum += _nanoseconds;
+	_histogram.min = std::min(_histogram.min, _nanoseconds);
+	_histogram.max = std::max(_histogram.max, _nanoseconds);
+}
+
+// Streams messages one way over a lossy link in simulated time and times every delivery
+ScenarioResult runScenario(const Scenario& _scenario, const LinkConditions& _conditions, std::chrono::seconds _duration, double _rate);
+ScenarioResult runScenario(const Scenario& _scenario, const LinkConditions& _conditions, std::chrono::seconds _duration, double _rate)
+{
+	ScenarioResult result;
+	ReliableConnection sender(_scenario.modes, MAX_DATAGRAM_SIZE);
+	ReliableConnection receiver(_scenario.modes, MAX_DATAGRAM_SIZE);
+	// Same seeds for every scenario, so they all see the same losses
+	LossyLink forward(_conditions, 1);
+	LossyLink backward(_conditions, 2);
+
+	std::chrono::steady_clock::time_point start;
+	std::chrono::steady_clock::time_point end = start + _duration;
+	std::chrono::nanoseconds interval(static_cast<int64_t>(1e9 / _rate));
+	std::vector<std::chrono::steady_clock::time_point> nextSend(STREAM_COUNT);
+	for(size_t i = 0; i < STREAM_COUNT; ++i)
+	{
+		// Spread the streams out over one interval
+		nextSend[i] = start + interval * static_cast<int64_t>(i) / static_cast<int64_t>(STREAM_COUNT);
+	}
+
+	std::vector<std::byte> message(MESSAGE_SIZE, std::byte { 0 });
+	for(std::chrono::steady_clock::time_point now = start; now < end + DRAIN_TIME; now += TICK)
+	{
+		for(size_t stream = 0; stream < STREAM_COUNT && now < end; ++stream)
+		{
+			while(nextSend[stream] <= now)
+			{
+				int64_t sentAt = nextSend[stream].time_since_epoch().count();
+				std::memcpy(message.data(), &sentAt, sizeof(sentAt));
+				uint8_t channel = _scenario.sharedChannel ? 0 : static_cast<uint8_t>(stream);
+				if(sender.send(channel, message, now))
+				{
+					result.sent++;
+				}
+				else
+				{
+					result.blocked++;
+				}
+				nextSend[stream] += interval;
+			}
+		}
+		forward.sendAll(sender, now);
+
+		forward.deliverDue(now, [&](std::span<const std::byte> _datagram)
+		{
+			receiver.receive(_datagram, now, [&](uint8_t _channel, std::span<const std::byte> _message)
+			{
+				int64_t sentAt;
+				std::memcpy(&sentAt, _message.data(), sizeof(sentAt));
+				recordLatency(result.latency, static_cast<uint64_t>(now.time_since_epoch().count() - sentAt));
+				result.delivered++;
+			});
+		});
+		receiver.update(now);
+		backward.sendAll(receiver, now);
+
+		backward.deliverDue(now, [&](std::span<const std::byte> _datagram)
+		{
+			sender.receive(_datagram, now, [](uint8_t _channel, std::span<const std::byte> _message) {});
+		});
+		sender.update(now);
+		forward.sendAll(sender, now);
+	}
+
+	result.senderStats = sender.getStats();
+	result.receiverStats = receiver.getStats();
+	return result;
+}
+
+// Compares delivery latency of the channel modes over the same lossy link.
+// TCP is modelled as every stream sharing one reliable ordered channel: a single in order byte stream,
+// so one lost segment holds up every stream behind it until the resend arrives
+int main(int argc, char* argv[])
+{
+	// Usage: channel_simulator [loss percent] [latency ms] [jitter ms] [seconds] [messages/s per stream]
+	double lossPercent = argc > 1 ? std::stod(argv[1]) : 2.0;
+	double latencyMs = argc > 2 ? std::stod(argv[2]) : 30.0;
+	double jitterMs = argc > 3 ? std::stod(argv[3]) : 5.0;
+	std::chrono::seconds duration(argc > 4 ? std::stoul(argv[4]) : 30);
+	double rate = argc > 5 ? std::stod(argv[5]) : 60.0;
+
+	LinkConditions conditions;
+	conditions.loss = lossPercent / 100.0;
+	conditions.latency = std::chrono::nanoseconds(static_cast<int64_t>(latencyMs * 1e6));
+	conditions.jitter = std::chrono::nanoseconds(static_cast<int64_t>(jitterMs * 1e6));
+
+	std::vector<Scenario> scenarios = {
+		{ "TCP model (one ordered stream)", { ChannelMode::ReliableOrdered }, true },
+		{ "Reliable ordered, channel per stream", std::vector<ChannelMode>(STREAM_COUNT, ChannelMode::ReliableOrdered), false },
+		{ "Reliable unordered", { ChannelMode::ReliableUnordered }, true },
+		{ "Unreliable sequenced, channel per stream", std::vector<ChannelMode>(STREAM_COUNT, ChannelMode::UnreliableSequenced), false }
+	};
+
+	std::cout << "Link: " << lossPercent << "% loss each way, " << latencyMs << " ms +/- " << jitterMs << " ms one way" << '\n';
+	std::cout << "Traffic: " << STREAM_COUNT << " streams x " << rate << " messages/s for " << duration.count() << " s, " << MESSAGE_SIZE << " byte messages" << '\n';
+	std::cout << '\n';
+	std::cout << std::left << std::setw(44) << "Scenario" << std::right
+			  << std::setw(11) << "Delivered" << std::setw(10) << "p50 ms" << std::setw(10) << "p99 ms"
+			  << std::setw(11) << "p99.9 ms" << std::setw(10) << "max ms" << std::setw(13) << "Retransmits" << std::setw(7) << "Acks" << '\n';
+
+	std::cout << std::fixed;
+	for(const Scenario& scenario : scenarios)
+	{
+		ScenarioResult result = runScenario(scenario, conditions, duration, rate);
+		double delivered = result.sent > 0 ? 100.0 * static_cast<double>(result.delivered) / static_cast<double>(result.sent) : 0;
+		std::cout << std::left << std::setw(44) << scenario.name << std::right
+				  << std::setprecision(1) << std::setw(10) << delivered << '%'
+				  << std::setprecision(2)
+				  << std::setw(10) << static_cast<double>(result.latency.getPercentile(50)) / 1e6
+				  << std::setw(10) << static_cast<double>(result.latency.getPercentile(99)) / 1e6
+				  << std::setw(11) << static_cast<double>(result.latency.getPercentile(99.9)) / 1e6
+				  << std::setw(10) << static_cast<double>(result.latency.max) / 1e6
+				  << std::setw(13) << result.senderStats.retransmits
+				  << std::setw(7) << result.receiverStats.acksSent << '\n';
+		if(result.blocked > 0)
+		{
+			std::cout << "  " << result.blocked << " messages refused, the send window was full" << '\n';
+		}
+	}
+	return 0;
+}
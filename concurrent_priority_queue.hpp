@@ -0,0 +1,321 @@
+#ifndef CONCURRENTPRIORITYQUEUE_H
+#define CONCURRENTPRIORITYQUEUE_H
+
+// C++
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// How closely pops follow priority order
+enum class PriorityOrder
+{
+	// Pop the better of two random shards' tops. Scales with threads, but only approximately ordered
+	Relaxed,
+	// Pop the best top over every shard. Exact whenever no push races the pop, costs a scan of the shards
+	Strict
+};
+
+// Appends [_first, _last) to the heap in _heap and restores the heap property, whichever way is cheaper.
+// Sifting each one up costs about log2(size) compares apiece, rebuilding the heap about 2 * size in total
+template <typename T, typename Iterator, typename Compare = std::less<T>>
+void appendToHeap(std::vector<T>& _heap, Iterator _first, Iterator _last, Compare _compare = Compare())
+{
+	size_t added = static_cast<size_t>(std::distance(_first, _last));
+	_heap.insert(_heap.end(), _first, _last);
+
+	size_t size = _heap.size();
+	if(added * std::bit_width(size) < 2 * size)
+	{
+		for(size_t i = size - added + 1; i <= size; ++i)
+		{
+			std::push_heap(_heap.begin(), _heap.begin() + i, _compare);
+		}
+	}
+	else
+	{
+		std::make_heap(_heap.begin(), _heap.end(), _compare);
+	}
+}
+
+// Priority queue for many producers and consumers, a multiqueue.
+// Elements are spread over independently locked heaps. Pushes go to a random shard and only ever
+// try-lock, so producers step around each other instead of queueing up on one mutex.
+// Every shard publishes its top so pops can pick a shard without locking the ones they pass over.
+// Like std::priority_queue, the largest element under Compare comes out first
+template <typename T, typename Compare = std::less<T>>
+class ConcurrentPriorityQueue
+{
+	static_assert(std::is_trivially_copyable_v<T>, "Shard tops are read without a lock, queue a priority and an ID (or a pointer) for bigger jobs");
+	public:
+		// Shards per hardware thread by default, enough that two threads rarely pick the same one
+		static constexpr size_t SHARDS_PER_THREAD = 4;
+
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		ConcurrentPriorityQueue() : ConcurrentPriorityQueue(0) {}
+
+		// Parameterized constructors
+		// A shard count of 0 picks SHARDS_PER_THREAD per hardware thread
+		explicit ConcurrentPriorityQueue(size_t _shardCount, PriorityOrder _order = PriorityOrder::Relaxed, Compare _compare = Compare()) : order(_order), compare(_compare)
+		{
+			if(_shardCount == 0)
+			{
+				_shardCount = SHARDS_PER_THREAD * std::max(1u, std::thread::hardware_concurrency());
+			}
+			this->shards = std::vector<Shard>(_shardCount);
+		}
+
+		// Shards hold mutexes, don't copy the queue
+		ConcurrentPriorityQueue(const ConcurrentPriorityQueue& other) = delete;
+		ConcurrentPriorityQueue& operator=(const ConcurrentPriorityQueue& other) = delete;
+
+		/*****************
+		 * Queue Functions
+		 ****************/
+		void push(const T& _value)
+		{
+			// Counted before it's visible, so a pop can never take it before it's counted
+			this->count.fetch_add(1, std::memory_order_relaxed);
+
+			Shard& shard = this->lockAnyShard();
+			shard.heap.push_back(_value);
+			std::push_heap(shard.heap.begin(), shard.heap.end(), this->compare);
+			shard.publish();
+			shard.m.unlock();
+		}
+
+		// Merges [_first, _last) into one shard under a single lock
+		template <typename Iterator>
+		void pushBulk(Iterator _first, Iterator _last)
+		{
+			size_t added = static_cast<size_t>(std::distance(_first, _last));
+			if(added == 0)
+			{
+				return;
+			}
+			this->count.fetch_add(added, std::memory_order_relaxed);
+
+			Shard& shard = this->lockAnyShard();
+			appendToHeap(shard.heap, _first, _last, this->compare);
+			shard.publish();
+			shard.m.unlock();
+		}
+
+		// Takes the top element (see PriorityOrder), returns false if the queue is empty
+		bool tryPop(T& _value)
+		{
+			while(this->count.load(std::memory_order_acquire) > 0)
+			{
+				Shard* shard = this->order == PriorityOrder::Strict ? this->findBest() : this->pickBetterOfTwo();
+				if(shard == nullptr)
+				{
+					// A push has been counted but hasn't landed in its shard yet
+					std::this_thread::yield();
+					continue;
+				}
+
+				std::unique_lock<std::mutex> lock(shard->m, std::defer_lock);
+				if(this->order == PriorityOrder::Strict)
+				{
+					lock.lock();
+				}
+				else if(!lock.try_lock())
+				{
+					continue;
+				}
+
+				// Someone else got there first
+				if(shard->heap.empty())
+				{
+					continue;
+				}
+
+				std::pop_heap(shard->heap.begin(), shard->heap.end(), this->compare);
+				_value = shard->heap.back();
+				shard->heap.pop_back();
+				shard->publish();
+				lock.unlock();
+
+				this->count.fetch_sub(1, std::memory_order_relaxed);
+				return true;
+			}
+			return false;
+		}
+
+		// Collects one thread's pushes and merges them into the queue in batches, one shard lock per batch
+		// instead of one per element. Batched elements aren't in the queue, or its size(), until they're flushed.
+		// Flushes when the batch fills, on flush() and when it goes out of scope
+		class Producer
+		{
+			public:
+				static constexpr size_t DEFAULT_BATCH_SIZE = 64;
+
+				/*****************
+				 * Constructors
+				 ****************/
+				// Default constructor
+				Producer() = delete;
+
+				// Parameterized constructors
+				explicit Producer(ConcurrentPriorityQueue& _queue, size_t _batchSize = DEFAULT_BATCH_SIZE) : queue(_queue), batchSize(std::max<size_t>(1, _batchSize))
+				{
+					this->batch.reserve(this->batchSize);
+				}
+
+				// Belongs to one thread, don't copy it
+				Producer(const Producer& other) = delete;
+				Producer& operator=(const Producer& other) = delete;
+
+				// Destructor
+				~Producer()
+				{
+					this->flush();
+				}
+
+				/*****************
+				 * Queue Functions
+				 ****************/
+				void push(const T& _value)
+				{
+					this->batch.push_back(_value);
+					if(this->batch.size() >= this->batchSize)
+					{
+						this->flush();
+					}
+				}
+
+				void flush()
+				{
+					if(this->batch.empty())
+					{
+						return;
+					}
+					this->queue.pushBulk(this->batch.begin(), this->batch.end());
+					this->batch.clear();
+				}
+
+				/*****************
+				 * Getters & Setters
+				 ****************/
+				size_t getPendingCount() const { return this->batch.size(); }
+				size_t getBatchSize() const { return this->batchSize; }
+
+			private:
+				ConcurrentPriorityQueue& queue;
+				std::vector<T> batch;
+				size_t batchSize;
+		};
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		// A snapshot, other threads can change it straight away
+		size_t size() const { return this->count.load(std::memory_order_relaxed); }
+		bool empty() const { return this->size() == 0; }
+		size_t getShardCount() const { return this->shards.size(); }
+		PriorityOrder getOrder() const { return this->order; }
+
+	private:
+		struct alignas(64) Shard
+		{
+			std::mutex m;
+			std::vector<T> heap;
+			// Copies of heap.front() and heap.size(), written under m and read by pops without it
+			std::atomic<T> top = T();
+			std::atomic<size_t> size = 0;
+
+			// Call with m held
+			void publish()
+			{
+				if(!this->heap.empty())
+				{
+					this->top.store(this->heap.front(), std::memory_order_relaxed);
+				}
+				this->size.store(this->heap.size(), std::memory_order_release);
+			}
+		};
+
+		// A random shard that wasn't busy, or after a full round of busy ones, whichever we land on last
+		Shard& lockAnyShard()
+		{
+			for(size_t attempt = 0; ; ++attempt)
+			{
+				Shard& shard = this->shards[nextRandom() % this->shards.size()];
+				if(attempt >= this->shards.size())
+				{
+					shard.m.lock();
+					return shard;
+				}
+				if(shard.m.try_lock())
+				{
+					return shard;
+				}
+			}
+		}
+
+		// True when _a's top should come out before _b's
+		bool isBetter(const Shard& _a, const Shard& _b) const
+		{
+			return this->compare(_b.top.load(std::memory_order_relaxed), _a.top.load(std::memory_order_relaxed));
+		}
+
+		Shard* pickBetterOfTwo()
+		{
+			Shard& a = this->shards[nextRandom() % this->shards.size()];
+			Shard& b = this->shards[nextRandom() % this->shards.size()];
+			bool aReady = a.size.load(std::memory_order_acquire) > 0;
+			bool bReady = b.size.load(std::memory_order_acquire) > 0;
+			if(aReady && bReady)
+			{
+				return this->isBetter(b, a) ? &b : &a;
+			}
+			if(aReady || bReady)
+			{
+				return aReady ? &a : &b;
+			}
+
+			// Mostly empty queue, random picks would keep missing
+			return this->findBest();
+		}
+
+		Shard* findBest()
+		{
+			Shard* best = nullptr;
+			for(Shard& shard : this->shards)
+			{
+				if(shard.size.load(std::memory_order_acquire) > 0 && (best == nullptr || this->isBetter(shard, *best)))
+				{
+					best = &shard;
+				}
+			}
+			return best;
+		}
+
+		// xorshift, per thread so picking a shard never touches shared state
+		static uint64_t nextRandom()
+		{
+			static std::atomic<uint64_t> seeds = 0x9E3779B97F4A7C15ULL;
+			thread_local uint64_t state = seeds.fetch_add(0x9E3779B97F4A7C15ULL, std::memory_order_relaxed) | 1;
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			return state;
+		}
+
+		std::vector<Shard> shards;
+		std::atomic<size_t> count = 0;
+		PriorityOrder order;
+		Compare compare;
+};
+
+#endif
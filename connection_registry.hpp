@@ -0,0 +1,161 @@
+#ifndef CONNECTIONREGISTRY_H
+#define CONNECTIONREGISTRY_H
+
+// C++
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Live connections keyed by session ID.
+// Sessions are spread over independently locked shards, so IO threads adding, removing and looking up
+// different sessions rarely contend, and walking every connection only ever holds one shard at a time.
+template <typename T>
+class ConnectionRegistry
+{
+	typedef std::shared_ptr<T> Entry;
+	public:
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		ConnectionRegistry() : ConnectionRegistry(64) {}
+
+		// Parameterized constructors
+		// The shard count is rounded up to a power of two
+		explicit ConnectionRegistry(size_t _shardCount)
+		{
+			size_t shardCount = 1;
+			while(shardCount < _shardCount)
+			{
+				shardCount <<= 1;
+			}
+			this->shards = std::vector<Shard>(shardCount);
+			this->shardMask = shardCount - 1;
+		}
+
+		/*****************
+		 * Registry Functions
+		 ****************/
+		// Session IDs are never reused for the lifetime of the registry
+		uint64_t nextSessionId() { return this->sessionCounter.fetch_add(1, std::memory_order_relaxed) + 1; }
+
+		void insert(uint64_t _sessionId, Entry _entry)
+		{
+			Shard& shard = this->getShard(_sessionId);
+			std::lock_guard<std::mutex> lock(shard.m);
+			if(shard.entries.emplace(_sessionId, std::move(_entry)).second)
+			{
+				this->count.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+
+		bool remove(uint64_t _sessionId)
+		{
+			Shard& shard = this->getShard(_sessionId);
+			Entry removed;
+			{
+				std::lock_guard<std::mutex> lock(shard.m);
+				typename std::unordered_map<uint64_t, Entry>::iterator it = shard.entries.find(_sessionId);
+				if(it == shard.entries.end())
+				{
+					return false;
+				}
+				// Let the last reference go outside the lock, the connection's destructor could be expensive
+				removed = std::move(it->second);
+				shard.entries.erase(it);
+			}
+			this->count.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		Entry find(uint64_t _sessionId)
+		{
+			Shard& shard = this->getShard(_sessionId);
+			std::lock_guard<std::mutex> lock(shard.m);
+			typename std::unordered_map<uint64_t, Entry>::iterator it = shard.entries.find(_sessionId);
+			return it != shard.entries.end() ? it->second : nullptr;
+		}
+
+		// Calls _function on every connection. Each shard is copied under its lock and visited
+		// after the lock is released, so _function can take its time (or touch the registry)
+		template <typename Function>
+		void forEach(Function&& _function)
+		{
+			std::vector<Entry> snapshot;
+			for(Shard& shard : this->shards)
+			{
+				{
+					std::lock_guard<std::mutex> lock(shard.m);
+					snapshot.reserve(shard.entries.size());
+					for(const std::pair<const uint64_t, Entry>& entry : shard.entries)
+					{
+						snapshot.push_back(entry.second);
+					}
+				}
+
+				for(Entry& entry : snapshot)
+				{
+					_function(entry);
+				}
+				snapshot.clear();
+			}
+		}
+
+		// Drops every connection _predicate returns true for, returns how many were dropped
+		template <typename Predicate>
+		size_t removeIf(Predicate&& _predicate)
+		{
+			size_t removed = 0;
+			std::vector<Entry> graveyard;
+			for(Shard& shard : this->shards)
+			{
+				{
+					std::lock_guard<std::mutex> lock(shard.m);
+					for(typename std::unordered_map<uint64_t, Entry>::iterator it = shard.entries.begin(); it != shard.entries.end();)
+					{
+						if(_predicate(it->second))
+						{
+							graveyard.push_back(std::move(it->second));
+							it = shard.entries.erase(it);
+						}
+						else
+						{
+							++it;
+						}
+					}
+				}
+
+				removed += graveyard.size();
+				graveyard.clear();
+			}
+			this->count.fetch_sub(removed, std::memory_order_relaxed);
+			return removed;
+		}
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		size_t size() const { return this->count.load(std::memory_order_relaxed); }
+		uint64_t getSessionsCreated() const { return this->sessionCounter.load(std::memory_order_relaxed); }
+
+	private:
+		// Padded so neighbouring shard locks don't share a cache line
+		struct alignas(64) Shard
+		{
+			std::mutex m;
+			std::unordered_map<uint64_t, Entry> entries;
+		};
+
+		// Session IDs are sequential, so the low bits spread them evenly
+		Shard& getShard(uint64_t _sessionId) { return this->shards[_sessionId & this->shardMask]; }
+
+		std::vector<Shard> shards;
+		size_t shardMask = 0;
+		std::atomic<uint64_t> sessionCounter = 0;
+		std::atomic<size_t> count = 0;
+};
+
+#endif
@@ -0,0 +1,291 @@
+#ifndef DATAGRAMBATCH_H
+#define DATAGRAMBATCH_H
+
+// C++
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+
+// Boost
+#include <boost/asio.hpp>
+
+// Templates
+#include "buffer_pool.hpp"
+
+// recvmmsg/sendmmsg move a whole batch of datagrams per system call, Linux only
+#if defined(__linux__)
+	#define DATAGRAMBATCH_SUPPORTED 1
+	#include <netinet/in.h>
+	#include <netinet/udp.h>
+	#include <sys/socket.h>
+#else
+	#define DATAGRAMBATCH_SUPPORTED 0
+#endif
+
+// A received datagram, data is only valid for the duration of the batch handler it's passed to
+struct Datagram
+{
+	std::span<const std::byte> data;
+	boost::asio::ip::udp::endpoint sender;
+};
+
+#if DATAGRAMBATCH_SUPPORTED
+
+// Receives up to batchSize datagrams with a single recvmmsg.
+// Every datagram gets its own fixed size slot, anything longer is truncated like a plain receive would
+class DatagramReceiveBatch
+{
+	public:
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		DatagramReceiveBatch() = delete;
+
+		// Parameterized constructors
+		DatagramReceiveBatch(size_t _batchSize, size_t _datagramSize) : datagramSize(_datagramSize),
+																		storage(_batchSize * _datagramSize),
+																		messages(_batchSize),
+																		iovecs(_batchSize),
+																		addresses(_batchSize),
+																		received(_batchSize)
+		{
+			for(size_t i = 0; i < _batchSize; ++i)
+			{
+				this->iovecs[i].iov_base = this->storage.data() + i * _datagramSize;
+				this->iovecs[i].iov_len = _datagramSize;
+				this->messages[i].msg_hdr.msg_iov = &this->iovecs[i];
+				this->messages[i].msg_hdr.msg_iovlen = 1;
+				this->messages[i].msg_hdr.msg_name = &this->addresses[i];
+			}
+		}
+
+		// The message headers point into the batch's own storage, don't copy it
+		DatagramReceiveBatch(const DatagramReceiveBatch& other) = delete;
+		DatagramReceiveBatch& operator=(const DatagramReceiveBatch& other) = delete;
+
+		/*****************
+		 * Batch Functions
+		 ****************/
+		// Never blocks. Returns how many datagrams were received, 0 when the socket has nothing or on error
+		size_t receive(int _socket, boost::system::error_code& _error)
+		{
+			for(mmsghdr& message : this->messages)
+			{
+				message.msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+				message.msg_hdr.msg_flags = 0;
+				message.msg_len = 0;
+			}
+
+			int count = ::recvmmsg(_socket, this->messages.data(), static_cast<unsigned int>(this->messages.size()), MSG_DONTWAIT, nullptr);
+			if(count < 0)
+			{
+				if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				{
+					_error = boost::system::error_code(errno, boost::system::system_category());
+				}
+				this->count = 0;
+				return 0;
+			}
+
+			this->count = static_cast<size_t>(count);
+			for(size_t i = 0; i < this->count; ++i)
+			{
+				Datagram& datagram = this->received[i];
+				datagram.data = std::span<const std::byte>(this->storage.data() + i * this->datagramSize, this->messages[i].msg_len);
+				std::memcpy(datagram.sender.data(), &this->addresses[i], this->messages[i].msg_hdr.msg_namelen);
+				datagram.sender.resize(this->messages[i].msg_hdr.msg_namelen);
+			}
+			return this->count;
+		}
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		// The datagrams from the last receive()
+		std::span<const Datagram> getDatagrams() const { return std::span<const Datagram>(this->received.data(), this->count); }
+		size_t getBatchSize() const { return this->messages.size(); }
+
+	private:
+		size_t datagramSize;
+		std::vector<std::byte> storage;
+		std::vector<mmsghdr> messages;
+		std::vector<iovec> iovecs;
+		std::vector<sockaddr_storage> addresses;
+		std::vector<Datagram> received;
+		size_t count = 0;
+};
+
+// Sends the front of a packet queue to one peer with a single sendmmsg.
+// With segmentation offload on, a run of equally sized packets goes out as one UDP GSO send instead,
+// the kernel splits it back into datagrams as late as possible
+class DatagramSendBatch
+{
+	public:
+		// The kernel refuses more segments than this in one GSO send
+		static constexpr size_t MAX_SEGMENTS = 64;
+		static constexpr size_t MAX_GSO_BYTES = 65000;
+
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		DatagramSendBatch() = delete;
+
+		// Parameterized constructors
+		explicit DatagramSendBatch(size_t _batchSize) : messages(_batchSize), iovecs(std::max(_batchSize, MAX_SEGMENTS)) {}
+
+		DatagramSendBatch(const DatagramSendBatch& other) = delete;
+		DatagramSendBatch& operator=(const DatagramSendBatch& other) = delete;
+
+		/*****************
+		 * Batch Functions
+		 ****************/
+		// Never blocks. Returns how many packets from the front of _queue went out, 0 when the socket is full or on error.
+		// _queue is anything indexable holding PacketBuffers, a std::deque or a std::span of pending packets
+		template <typename PacketQueue>
+		size_t send(int _socket, const PacketQueue& _queue, const boost::asio::ip::udp::endpoint& _to, boost::system::error_code& _error)
+		{
+#ifdef UDP_SEGMENT
+			if(this->segmentationOffload)
+			{
+				size_t segments = this->countSegments(_queue);
+				if(segments > 1)
+				{
+					return this->sendSegmented(_socket, _queue, segments, _to, _error);
+				}
+			}
+#endif
+
+			size_t count = std::min(_queue.size(), this->messages.size());
+			for(size_t i = 0; i < count; ++i)
+			{
+				const PacketBuffer& packet = _queue[i];
+				this->iovecs[i].iov_base = const_cast<std::byte*>(packet.data());
+				this->iovecs[i].iov_len = packet.size();
+
+				msghdr& header = this->messages[i].msg_hdr;
+				header = {};
+				header.msg_name = const_cast<void*>(static_cast<const void*>(_to.data()));
+				header.msg_namelen = static_cast<socklen_t>(_to.size());
+				header.msg_iov = &this->iovecs[i];
+				header.msg_iovlen = 1;
+			}
+
+			int sent = ::sendmmsg(_socket, this->messages.data(), static_cast<unsigned int>(count), MSG_DONTWAIT);
+			if(sent < 0)
+			{
+				if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				{
+					_error = boost::system::error_code(errno, boost::system::system_category());
+				}
+				return 0;
+			}
+			return static_cast<size_t>(sent);
+		}
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		static bool isSegmentationOffloadSupported()
+		{
+#ifdef UDP_SEGMENT
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		// Falls back to sendmmsg by itself if the kernel or device turns GSO down
+		void setSegmentationOffloadEnabled(bool _enabled) { this->segmentationOffload = _enabled && isSegmentationOffloadSupported(); }
+		bool isSegmentationOffloadEnabled() const { return this->segmentationOffload; }
+
+	private:
+#ifdef UDP_SEGMENT
+		// GSO splits the payload into segments of the first packet's size, only the last one may be shorter
+		template <typename PacketQueue>
+		size_t countSegments(const PacketQueue& _queue) const
+		{
+			if(_queue.empty())
+			{
+				return 0;
+			}
+
+			size_t segmentSize = _queue.front().size();
+			size_t bytes = 0;
+			size_t segments = 0;
+			while(segments < _queue.size() && segments < MAX_SEGMENTS)
+			{
+				size_t size = _queue[segments].size();
+				if(size > segmentSize || bytes + size > MAX_GSO_BYTES)
+				{
+					break;
+				}
+				bytes += size;
+				segments++;
+				if(size < segmentSize)
+				{
+					break;
+				}
+			}
+			return segments;
+		}
+
+		template <typename PacketQueue>
+		size_t sendSegmented(int _socket, const PacketQueue& _queue, size_t _segments, const boost::asio::ip::udp::endpoint& _to, boost::system::error_code& _error)
+		{
+			for(size_t i = 0; i < _segments; ++i)
+			{
+				this->iovecs[i].iov_base = const_cast<std::byte*>(_queue[i].data());
+				this->iovecs[i].iov_len = _queue[i].size();
+			}
+
+			alignas(cmsghdr) char control[CMSG_SPACE(sizeof(uint16_t))] = {};
+			msghdr header = {};
+			header.msg_name = const_cast<void*>(static_cast<const void*>(_to.data()));
+			header.msg_namelen = static_cast<socklen_t>(_to.size());
+			header.msg_iov = this->iovecs.data();
+			header.msg_iovlen = _segments;
+			header.msg_control = control;
+			header.msg_controllen = sizeof(control);
+
+			cmsghdr* message = CMSG_FIRSTHDR(&header);
+			message->cmsg_level = SOL_UDP;
+			message->cmsg_type = UDP_SEGMENT;
+			message->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			uint16_t segmentSize = static_cast<uint16_t>(_queue.front().size());
+			std::memcpy(CMSG_DATA(message), &segmentSize, sizeof(segmentSize));
+
+			if(::sendmsg(_socket, &header, MSG_DONTWAIT) < 0)
+			{
+				if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				{
+					return 0;
+				}
+
+				// No GSO here (old kernel, no checksum offload), stick to sendmmsg from now on
+				if(errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP)
+				{
+					this->segmentationOffload = false;
+					return this->send(_socket, _queue, _to, _error);
+				}
+
+				_error = boost::system::error_code(errno, boost::system::system_category());
+				return 0;
+			}
+			return _segments;
+		}
+#endif
+
+		std::vector<mmsghdr> messages;
+		std::vector<iovec> iovecs;
+		bool segmentationOffload = false;
+};
+
+#endif
+
+#endif
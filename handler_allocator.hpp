@@ -0,0 +1,154 @@
+#ifndef HANDLERALLOCATOR_H
+#define HANDLERALLOCATOR_H
+
+// C++
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Scratch memory for the completion handlers of one chain of async operations.
+// A connection only ever has one read and one write in flight, so each of those chains can keep
+// reusing the same few slots instead of asking the heap for a new handler every operation.
+// Based on the allocation example that ships with asio.
+class HandlerMemory
+{
+	public:
+		static constexpr size_t SLOT_SIZE = 512;
+		// A completed operation can still hold its slot while the strand allocates for the upcall
+		static constexpr size_t SLOT_COUNT = 2;
+
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		HandlerMemory() = default;
+
+		// Handlers point into the slots, don't copy them
+		HandlerMemory(const HandlerMemory& other) = delete;
+		HandlerMemory& operator=(const HandlerMemory& other) = delete;
+
+		/*****************
+		 * Memory Functions
+		 ****************/
+		void* allocate(size_t _size)
+		{
+			if(_size <= SLOT_SIZE)
+			{
+				for(size_t i = 0; i < SLOT_COUNT; ++i)
+				{
+					if(!this->inUse[i])
+					{
+						this->inUse[i] = true;
+						return this->slots[i].storage;
+					}
+				}
+			}
+
+			// Too big or every slot is taken, fall back to the heap and remember it happened
+			heapAllocations.fetch_add(1, std::memory_order_relaxed);
+			return ::operator new(_size);
+		}
+
+		void deallocate(void* _pointer)
+		{
+			for(size_t i = 0; i < SLOT_COUNT; ++i)
+			{
+				if(_pointer == this->slots[i].storage)
+				{
+					this->inUse[i] = false;
+					return;
+				}
+			}
+			::operator delete(_pointer);
+		}
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		// How many handler allocations, over every HandlerMemory, missed the slots and hit the heap.
+		// Should stay flat once connections are up and running
+		static size_t getHeapAllocations() { return heapAllocations.load(std::memory_order_relaxed); }
+
+	private:
+		struct Slot
+		{
+			alignas(std::max_align_t) unsigned char storage[SLOT_SIZE];
+		};
+
+		Slot slots[SLOT_COUNT];
+		bool inUse[SLOT_COUNT] = {};
+
+		static inline std::atomic<size_t> heapAllocations = 0;
+};
+
+// Minimal allocator that hands out memory from a HandlerMemory
+template <typename T>
+class HandlerAllocator
+{
+	public:
+		typedef T value_type;
+
+		/*****************
+		 * Constructors
+		 ****************/
+		explicit HandlerAllocator(HandlerMemory& _memory) : memory(_memory) {}
+
+		// Rebinding copy constructor
+		template <typename U>
+		HandlerAllocator(const HandlerAllocator<U>& other) noexcept : memory(other.memory) {}
+
+		/*****************
+		 * Overloaded Operators
+		 ****************/
+		bool operator==(const HandlerAllocator& other) const noexcept { return &this->memory == &other.memory; }
+		bool operator!=(const HandlerAllocator& other) const noexcept { return &this->memory != &other.memory; }
+
+		/*****************
+		 * Allocator Functions
+		 ****************/
+		T* allocate(size_t _count) const { return static_cast<T*>(this->memory.allocate(sizeof(T) * _count)); }
+		void deallocate(T* _pointer, size_t _count) const { this->memory.deallocate(_pointer); }
+
+	private:
+		template <typename> friend class HandlerAllocator;
+
+		HandlerMemory& memory;
+};
+
+// Wraps a completion handler so asio picks up HandlerAllocator through its associated allocator hook
+template <typename Handler>
+class AllocHandler
+{
+	public:
+		typedef HandlerAllocator<Handler> allocator_type;
+
+		/*****************
+		 * Constructors
+		 ****************/
+		AllocHandler(HandlerMemory& _memory, Handler _handler) : memory(_memory), handler(std::move(_handler)) {}
+
+		/*****************
+		 * Overloaded Operators
+		 ****************/
+		template <typename... Args>
+		void operator()(Args&&... _args) { this->handler(std::forward<Args>(_args)...); }
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		allocator_type get_allocator() const noexcept { return allocator_type(this->memory); }
+
+	private:
+		HandlerMemory& memory;
+		Handler handler;
+};
+
+template <typename Handler>
+inline AllocHandler<std::decay_t<Handler>> makeAllocHandler(HandlerMemory& _memory, Handler&& _handler)
+{
+	return AllocHandler<std::decay_t<Handler>>(_memory, std::forward<Handler>(_handler));
+}
+
+#endif
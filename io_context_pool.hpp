@@ -0,0 +1,207 @@
+#ifndef IOCONTEXTPOOL_H
+#define IOCONTEXTPOOL_H
+
+// C++
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Boost
+#include <boost/asio.hpp>
+
+// Thread pinning uses the Linux affinity calls
+#if defined(__linux__)
+	#include <pthread.h>
+	#include <sched.h>
+#endif
+
+// A pool of io_contexts with one thread per io_context.
+// Each io_context only ever runs on its own thread, so anything bound to one of them
+// (a socket, a strand, a timer) never has its handlers run concurrently with itself.
+class IOContextPool
+{
+	typedef std::shared_ptr<boost::asio::io_context> IOContext;
+	typedef boost::asio::executor_work_guard<boost::asio::io_context::executor_type> WorkGuard;
+	public:
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		IOContextPool() = delete;
+
+		// Parameterized constructors
+		// A pool size of 0 means one io_context per hardware thread
+		explicit IOContextPool(size_t _poolSize)
+		{
+			if(_poolSize == 0)
+			{
+				_poolSize = std::max(1u, std::thread::hardware_concurrency());
+			}
+
+			for(size_t i = 0; i < _poolSize; ++i)
+			{
+				// Each io_context is only run by a single thread, let asio skip its internal locking
+				IOContext ioContext = std::make_shared<boost::asio::io_context>(1);
+				this->workGuards.push_back(boost::asio::make_work_guard(*ioContext));
+				this->ioContexts.push_back(ioContext);
+			}
+
+			// Thread i is pinned to the i-th CPU we're allowed to run on, wrapping around
+#if defined(__linux__)
+			cpu_set_t allowed;
+			CPU_ZERO(&allowed);
+			if(sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+			{
+				for(size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+				{
+					if(CPU_ISSET(cpu, &allowed))
+					{
+						this->cpus.push_back(cpu);
+					}
+				}
+			}
+#endif
+			if(this->cpus.empty())
+			{
+				this->cpus.push_back(0);
+			}
+		}
+
+		// The pool owns threads, don't copy it
+		IOContextPool(const IOContextPool& other) = delete;
+		IOContextPool& operator=(const IOContextPool& other) = delete;
+
+		// Destructor
+		~IOContextPool()
+		{
+			this->stop();
+			this->join();
+		}
+
+		/*****************
+		 * Pool Functions
+		 ****************/
+		// Run every io_context on its own thread and block until they've all stopped
+		void run()
+		{
+			for(size_t i = 1; i < this->ioContexts.size(); ++i)
+			{
+				this->threads.emplace_back([this, i, ioContext = this->ioContexts[i]]()
+				{
+					if(this->cpuPinningEnabled)
+					{
+						pinCurrentThread(this->getCPU(i));
+					}
+					ioContext->run();
+				});
+			}
+
+			// The calling thread drives the first io_context
+			if(this->cpuPinningEnabled)
+			{
+				pinCurrentThread(this->getCPU(0));
+			}
+			this->ioContexts[0]->run();
+			this->join();
+		}
+
+		void stop()
+		{
+			for(WorkGuard& workGuard : this->workGuards)
+			{
+				workGuard.reset();
+			}
+			for(IOContext& ioContext : this->ioContexts)
+			{
+				ioContext->stop();
+			}
+		}
+
+		// Round-robin over the pool
+		boost::asio::io_context& getIOContext()
+		{
+			return *this->ioContexts[this->nextIndex()];
+		}
+
+		// The index getIOContext() would have used, for callers that keep per io_context state alongside the pool
+		size_t nextIndex()
+		{
+			return this->nextIOContext.fetch_add(1, std::memory_order_relaxed) % this->ioContexts.size();
+		}
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		boost::asio::io_context& getIOContext(size_t _index) { return *this->ioContexts[_index % this->ioContexts.size()]; }
+		size_t size() const { return this->ioContexts.size(); }
+		// Set before run(). Keeps each io_context's thread on one CPU so its caches, and the socket
+		// buffers it touches, stay warm. Linux only, a no-op elsewhere
+		void setCPUPinningEnabled(bool _enabled) { this->cpuPinningEnabled = _enabled; }
+		bool isCPUPinningEnabled() const { return this->cpuPinningEnabled; }
+		// The CPU io_context _index's thread runs on when pinning is enabled
+		size_t getCPU(size_t _index) const { return this->cpus[_index % this->cpus.size()]; }
+
+		// The backend asio was built to wait on, so benchmark output says which one it measured
+		static const char* getReactorName()
+		{
+#if defined(BOOST_ASIO_HAS_IO_URING) && defined(BOOST_ASIO_DISABLE_EPOLL)
+			return "io_uring";
+#elif defined(BOOST_ASIO_HAS_EPOLL)
+			return "epoll";
+#elif defined(BOOST_ASIO_HAS_KQUEUE)
+			return "kqueue";
+#elif defined(BOOST_ASIO_HAS_IOCP)
+			return "iocp";
+#else
+			return "select";
+#endif
+		}
+
+		static bool pinCurrentThread(size_t _cpu)
+		{
+#if defined(__linux__)
+			cpu_set_t cpuSet;
+			CPU_ZERO(&cpuSet);
+			CPU_SET(_cpu, &cpuSet);
+			return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+#else
+			return false;
+#endif
+		}
+
+	private:
+		void join()
+		{
+			for(std::thread& thread : this->threads)
+			{
+				if(!thread.joinable())
+				{
+					continue;
+				}
+
+				// Can't join ourselves if the pool gets torn down from one of its own handlers
+				if(thread.get_id() == std::this_thread::get_id())
+				{
+					thread.detach();
+				}
+				else
+				{
+					thread.join();
+				}
+			}
+			this->threads.clear();
+		}
+
+		std::vector<IOContext> ioContexts;
+		std::vector<WorkGuard> workGuards;
+		std::vector<std::thread> threads;
+		std::atomic<size_t> nextIOContext = 0;
+		// CPUs this process may run on
+		std::vector<size_t> cpus;
+		bool cpuPinningEnabled = false;
+};
+
+#endif
@@ -0,0 +1,548 @@
+#ifndef MAPLECIPHER_H
+#define MAPLECIPHER_H
+
+// C++
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Templates
+#include "packet_framer.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	#define MAPLECIPHER_X86 1
+	#include <emmintrin.h>
+	#include <wmmintrin.h>
+	#if defined(_MSC_VER) && !defined(__clang__)
+		#include <intrin.h>
+		// MSVC lets any function use the AES-NI intrinsics
+		#define MAPLECIPHER_AESNI_TARGET
+	#else
+		// Only these functions are compiled for AES-NI, the rest of the program still runs on any x86 CPU
+		#define MAPLECIPHER_AESNI_TARGET __attribute__((target("aes,sse2")))
+	#endif
+#else
+	#define MAPLECIPHER_X86 0
+#endif
+
+// The AES S-box is generated rather than typed out: multiplicative inverse in GF(2^8) followed by the affine transform
+constexpr uint8_t rotateByteLeft(uint8_t _value, int _shift) { return static_cast<uint8_t>((_value << _shift) | (_value >> (8 - _shift))); }
+
+constexpr std::array<uint8_t, 256> makeAESSBox()
+{
+	std::array<uint8_t, 256> sbox = {};
+	uint8_t p = 1;
+	uint8_t q = 1;
+	do
+	{
+		// Multiply p by 3
+		p = static_cast<uint8_t>(p ^ (p << 1) ^ ((p & 0x80) ? 0x1B : 0));
+		// Divide q by 3
+		q ^= static_cast<uint8_t>(q << 1);
+		q ^= static_cast<uint8_t>(q << 2);
+		q ^= static_cast<uint8_t>(q << 4);
+		if(q & 0x80)
+		{
+			q ^= 0x09;
+		}
+		uint8_t x = static_cast<uint8_t>(q ^ rotateByteLeft(q, 1) ^ rotateByteLeft(q, 2) ^ rotateByteLeft(q, 3) ^ rotateByteLeft(q, 4));
+		sbox[p] = static_cast<uint8_t>(x ^ 0x63);
+	}
+	while(p != 1);
+	sbox[0] = 0x63;
+	return sbox;
+}
+
+// AES-256, encryption only, which is all OFB mode needs.
+// Uses AES-NI when the CPU has it and a portable table-free implementation otherwise.
+class MapleAES
+{
+	public:
+		static constexpr size_t BLOCK_SIZE = 16;
+		static constexpr size_t ROUNDS = 14;
+
+		// Fills _blocks blocks of OFB keystream starting from _iv: k[0] = E(iv), k[n] = E(k[n - 1])
+		typedef void (*KeystreamKernel)(const MapleAES& _aes, const uint8_t* _iv, uint8_t* _out, size_t _blocks);
+
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		MapleAES() = delete;
+
+		// Parameterized constructors
+		explicit MapleAES(const uint8_t* _key) { this->expandKey(_key); }
+
+		/*****************
+		 * AES Functions
+		 ****************/
+		void keystream(const uint8_t* _iv, uint8_t* _out, size_t _blocks) const { kernel(*this, _iv, _out, _blocks); }
+
+		static bool hasAESNI()
+		{
+#if MAPLECIPHER_X86
+	#if defined(_MSC_VER) && !defined(__clang__)
+			int info[4];
+			__cpuid(info, 1);
+			return (info[2] & (1 << 25)) != 0;
+	#else
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("aes");
+	#endif
+#else
+			return false;
+#endif
+		}
+
+		// The kernel is picked once at startup, this lets benchmarks compare them.
+		// Asking for AES-NI on a CPU without it keeps the scalar kernel
+		static void setAESNIEnabled(bool _enabled)
+		{
+#if MAPLECIPHER_X86
+			kernel = _enabled && hasAESNI() ? keystreamAESNI : keystreamScalar;
+#endif
+		}
+		static bool isAESNIEnabled()
+		{
+#if MAPLECIPHER_X86
+			return kernel == keystreamAESNI;
+#else
+			return false;
+#endif
+		}
+
+		static void keystreamScalar(const MapleAES& _aes, const uint8_t* _iv, uint8_t* _out, size_t _blocks)
+		{
+			uint8_t state[BLOCK_SIZE];
+			std::memcpy(state, _iv, BLOCK_SIZE);
+			for(size_t i = 0; i < _blocks; ++i)
+			{
+				_aes.encryptBlockScalar(state);
+				std::memcpy(_out + i * BLOCK_SIZE, state, BLOCK_SIZE);
+			}
+		}
+
+#if MAPLECIPHER_X86
+		MAPLECIPHER_AESNI_TARGET static void keystreamAESNI(const MapleAES& _aes, const uint8_t* _iv, uint8_t* _out, size_t _blocks)
+		{
+			// Keep every round key in a register for the whole run
+			__m128i keys[ROUNDS + 1];
+			for(size_t i = 0; i <= ROUNDS; ++i)
+			{
+				keys[i] = _mm_load_si128(reinterpret_cast<const __m128i*>(_aes.roundKeys[i]));
+			}
+
+			__m128i state = _mm_loadu_si128(reinterpret_cast<const __m128i*>(_iv));
+			for(size_t i = 0; i < _blocks; ++i)
+			{
+				state = _mm_xor_si128(state, keys[0]);
+				for(size_t round = 1; round < ROUNDS; ++round)
+				{
+					state = _mm_aesenc_si128(state, keys[round]);
+				}
+				state = _mm_aesenclast_si128(state, keys[ROUNDS]);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(_out + i * BLOCK_SIZE), state);
+			}
+		}
+#endif
+
+	private:
+		/*****************
+		 * Tables
+		 ****************/
+		static constexpr std::array<uint8_t, 256> SBOX = makeAESSBox();
+
+		static constexpr uint8_t xtime(uint8_t _value) { return static_cast<uint8_t>((_value << 1) ^ ((_value & 0x80) ? 0x1B : 0)); }
+
+		/*****************
+		 * Scalar AES
+		 ****************/
+		void expandKey(const uint8_t* _key)
+		{
+			uint8_t* words = &this->roundKeys[0][0];
+			std::memcpy(words, _key, 32);
+
+			uint8_t rcon = 1;
+			for(size_t i = 8; i < 4 * (ROUNDS + 1); ++i)
+			{
+				uint8_t temp[4];
+				std::memcpy(temp, words + (i - 1) * 4, 4);
+				if(i % 8 == 0)
+				{
+					// RotWord, SubWord, Rcon
+					uint8_t first = temp[0];
+					temp[0] = static_cast<uint8_t>(SBOX[temp[1]] ^ rcon);
+					temp[1] = SBOX[temp[2]];
+					temp[2] = SBOX[temp[3]];
+					temp[3] = SBOX[first];
+					rcon = xtime(rcon);
+				}
+				else if(i % 8 == 4)
+				{
+					for(uint8_t& b : temp)
+					{
+						b = SBOX[b];
+					}
+				}
+
+				for(size_t j = 0; j < 4; ++j)
+				{
+					words[i * 4 + j] = static_cast<uint8_t>(words[(i - 8) * 4 + j] ^ temp[j]);
+				}
+			}
+		}
+
+		void encryptBlockScalar(uint8_t* _state) const
+		{
+			addRoundKey(_state, this->roundKeys[0]);
+			for(size_t round = 1; round < ROUNDS; ++round)
+			{
+				subBytesShiftRows(_state);
+				mixColumns(_state);
+				addRoundKey(_state, this->roundKeys[round]);
+			}
+			subBytesShiftRows(_state);
+			addRoundKey(_state, this->roundKeys[ROUNDS]);
+		}
+
+		static void addRoundKey(uint8_t* _state, const uint8_t* _roundKey)
+		{
+			for(size_t i = 0; i < BLOCK_SIZE; ++i)
+			{
+				_state[i] ^= _roundKey[i];
+			}
+		}
+
+		// The state is column major, row r of column c is _state[c * 4 + r]
+		static void subBytesShiftRows(uint8_t* _state)
+		{
+			uint8_t shifted[BLOCK_SIZE];
+			for(size_t c = 0; c < 4; ++c)
+			{
+				for(size_t r = 0; r < 4; ++r)
+				{
+					shifted[c * 4 + r] = SBOX[_state[((c + r) % 4) * 4 + r]];
+				}
+			}
+			std::memcpy(_state, shifted, BLOCK_SIZE);
+		}
+
+		static void mixColumns(uint8_t* _state)
+		{
+			for(size_t c = 0; c < 4; ++c)
+			{
+				uint8_t* column = _state + c * 4;
+				uint8_t a0 = column[0], a1 = column[1], a2 = column[2], a3 = column[3];
+				uint8_t all = static_cast<uint8_t>(a0 ^ a1 ^ a2 ^ a3);
+				column[0] = static_cast<uint8_t>(a0 ^ all ^ xtime(static_cast<uint8_t>(a0 ^ a1)));
+				column[1] = static_cast<uint8_t>(a1 ^ all ^ xtime(static_cast<uint8_t>(a1 ^ a2)));
+				column[2] = static_cast<uint8_t>(a2 ^ all ^ xtime(static_cast<uint8_t>(a2 ^ a3)));
+				column[3] = static_cast<uint8_t>(a3 ^ all ^ xtime(static_cast<uint8_t>(a3 ^ a0)));
+			}
+		}
+
+#if MAPLECIPHER_X86
+		static inline KeystreamKernel kernel = hasAESNI() ? keystreamAESNI : keystreamScalar;
+#else
+		static inline KeystreamKernel kernel = keystreamScalar;
+#endif
+
+		alignas(16) uint8_t roundKeys[ROUNDS + 1][BLOCK_SIZE];
+};
+
+// The MapleStory packet cipher, one instance per direction per connection.
+//
+// Every packet is:   [4 byte header][body]
+// The header carries the body length XOR'd with the IV and version. The body is run through the
+// Shanda transform and then AES-256-OFB, with the OFB keystream restarting from the IV every 1460 bytes
+// (1456 for the first chunk). The 4 byte IV is shuffled after every packet.
+//
+// Encryption and decryption both work in place.
+class MapleCipher
+{
+	public:
+		static constexpr size_t HEADER_SIZE = 4;
+		static constexpr size_t FIRST_CHUNK_SIZE = 1456;
+		static constexpr size_t CHUNK_SIZE = 1460;
+
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		MapleCipher() = default;
+
+		// Parameterized constructors
+		// Outgoing ciphers use 0xFFFF - version, incoming ones the version itself
+		MapleCipher(const uint8_t* _iv, uint16_t _version) : version(_version) { std::memcpy(this->iv, _iv, 4); }
+
+		/*****************
+		 * Cipher Functions
+		 ****************/
+		// Writes the header for a _size byte body and encrypts the body, then moves on to the next IV
+		void encrypt(std::byte* _header, std::byte* _body, size_t _size)
+		{
+			this->writeHeader(reinterpret_cast<unsigned char*>(_header), _size);
+			shandaEncrypt(reinterpret_cast<uint8_t*>(_body), _size);
+			this->transform(reinterpret_cast<uint8_t*>(_body), _size);
+		}
+
+		// Decrypts a body whose header already passed checkHeader(), then moves on to the next IV
+		void decrypt(std::byte* _body, size_t _size)
+		{
+			this->transform(reinterpret_cast<uint8_t*>(_body), _size);
+			shandaDecrypt(reinterpret_cast<uint8_t*>(_body), _size);
+		}
+
+		// Does the header belong to the packet we expect next
+		bool checkHeader(const unsigned char* _header) const
+		{
+			return (_header[0] ^ this->iv[2]) == ((this->version >> 8) & 0xFF) && (_header[1] ^ this->iv[3]) == (this->version & 0xFF);
+		}
+
+		static size_t getBodySize(const unsigned char* _header)
+		{
+			return static_cast<size_t>((_header[0] ^ _header[2]) | ((_header[1] ^ _header[3]) << 8));
+		}
+
+		// Header mode framer for an encrypted stream. Incoming headers are checked against _receiveCipher.
+		// Outgoing headers depend on the IV at the time the packet is encrypted, so the framer only
+		// reserves room for them and encrypt() fills them in
+		static PacketFramer makeFramer(const MapleCipher& _receiveCipher)
+		{
+			return PacketFramer::withHeader(HEADER_SIZE,
+											[&_receiveCipher](const unsigned char* _header, size_t) -> size_t
+											{
+												return _receiveCipher.checkHeader(_header) ? getBodySize(_header) : PacketFramer::INVALID_BODY_SIZE;
+											},
+											[](unsigned char* _header, size_t _headerSize, size_t)
+											{
+												std::memset(_header, 0, _headerSize);
+											});
+		}
+
+		/*****************
+		 * Shanda
+		 ****************/
+		static void shandaEncrypt(uint8_t* _data, size_t _size)
+		{
+			for(int pass = 0; pass < 6; ++pass)
+			{
+				uint8_t remember = 0;
+				uint8_t length = static_cast<uint8_t>(_size);
+				if(pass % 2 == 0)
+				{
+					for(size_t i = 0; i < _size; ++i)
+					{
+						uint8_t current = rotateLeft(_data[i], 3);
+						current = static_cast<uint8_t>(current + length);
+						current ^= remember;
+						remember = current;
+						current = rotateRight(current, length);
+						current = static_cast<uint8_t>(~current);
+						current = static_cast<uint8_t>(current + 0x48);
+						length--;
+						_data[i] = current;
+					}
+				}
+				else
+				{
+					for(size_t i = _size; i-- > 0;)
+					{
+						uint8_t current = rotateLeft(_data[i], 4);
+						current = static_cast<uint8_t>(current + length);
+						current ^= remember;
+						remember = current;
+						current ^= 0x13;
+						current = rotateRight(current, 3);
+						length--;
+						_data[i] = current;
+					}
+				}
+			}
+		}
+
+		static void shandaDecrypt(uint8_t* _data, size_t _size)
+		{
+			for(int pass = 1; pass <= 6; ++pass)
+			{
+				uint8_t remember = 0;
+				uint8_t length = static_cast<uint8_t>(_size);
+				if(pass % 2 == 0)
+				{
+					for(size_t i = 0; i < _size; ++i)
+					{
+						uint8_t current = static_cast<uint8_t>(_data[i] - 0x48);
+						current = static_cast<uint8_t>(~current);
+						current = rotateLeft(current, length);
+						uint8_t nextRemember = current;
+						current ^= remember;
+						remember = nextRemember;
+						current = static_cast<uint8_t>(current - length);
+						current = rotateRight(current, 3);
+						_data[i] = current;
+						length--;
+					}
+				}
+				else
+				{
+					for(size_t i = _size; i-- > 0;)
+					{
+						uint8_t current = rotateLeft(_data[i], 3);
+						current ^= 0x13;
+						uint8_t nextRemember = current;
+						current ^= remember;
+						remember = nextRemember;
+						current = static_cast<uint8_t>(current - length);
+						current = rotateRight(current, 4);
+						_data[i] = current;
+						length--;
+					}
+				}
+			}
+		}
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		const uint8_t* getIV() const { return this->iv; }
+		uint16_t getVersion() const { return this->version; }
+
+	private:
+		// AES-OFB over the whole body. Every chunk restarts the keystream from the same IV, so the
+		// keystream is generated once per packet and XOR'd into each chunk
+		void transform(uint8_t* _data, size_t _size)
+		{
+			alignas(16) uint8_t keystream[(CHUNK_SIZE + MapleAES::BLOCK_SIZE - 1) / MapleAES::BLOCK_SIZE * MapleAES::BLOCK_SIZE];
+			alignas(16) uint8_t aesIV[MapleAES::BLOCK_SIZE];
+			for(size_t i = 0; i < MapleAES::BLOCK_SIZE; ++i)
+			{
+				aesIV[i] = this->iv[i % 4];
+			}
+
+			size_t keystreamSize = _size < CHUNK_SIZE ? _size : CHUNK_SIZE;
+			getAES().keystream(aesIV, keystream, (keystreamSize + MapleAES::BLOCK_SIZE - 1) / MapleAES::BLOCK_SIZE);
+
+			size_t offset = 0;
+			size_t chunkSize = FIRST_CHUNK_SIZE;
+			while(offset < _size)
+			{
+				size_t size = _size - offset < chunkSize ? _size - offset : chunkSize;
+				xorBytes(_data + offset, keystream, size);
+				offset += size;
+				chunkSize = CHUNK_SIZE;
+			}
+
+			this->shuffleIV();
+		}
+
+		static void xorBytes(uint8_t* _data, const uint8_t* _keystream, size_t _size)
+		{
+			size_t i = 0;
+#if MAPLECIPHER_X86
+			// SSE2 is always there on x86-64, 16 bytes at a time
+			for(; i + 16 <= _size; i += 16)
+			{
+				__m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(_data + i));
+				__m128i key = _mm_load_si128(reinterpret_cast<const __m128i*>(_keystream + i));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(_data + i), _mm_xor_si128(data, key));
+			}
+#endif
+			for(; i + 8 <= _size; i += 8)
+			{
+				uint64_t data;
+				uint64_t key;
+				std::memcpy(&data, _data + i, 8);
+				std::memcpy(&key, _keystream + i, 8);
+				data ^= key;
+				std::memcpy(_data + i, &data, 8);
+			}
+			for(; i < _size; ++i)
+			{
+				_data[i] ^= _keystream[i];
+			}
+		}
+
+		void writeHeader(unsigned char* _header, size_t _size) const
+		{
+			unsigned int iiv = ((this->iv[3]) | (this->iv[2] << 8)) ^ this->version;
+			unsigned int length = ((_size << 8) & 0xFF00) | ((_size >> 8) & 0xFF);
+			unsigned int xoredIV = iiv ^ length;
+
+			_header[0] = static_cast<unsigned char>((iiv >> 8) & 0xFF);
+			_header[1] = static_cast<unsigned char>(iiv & 0xFF);
+			_header[2] = static_cast<unsigned char>((xoredIV >> 8) & 0xFF);
+			_header[3] = static_cast<unsigned char>(xoredIV & 0xFF);
+		}
+
+		void shuffleIV()
+		{
+			uint8_t shuffled[4] = { 0xF2, 0x53, 0x50, 0xC6 };
+			for(int i = 0; i < 4; ++i)
+			{
+				uint8_t input = this->iv[i];
+				uint8_t tableInput = SHUFFLE_TABLE[input];
+
+				shuffled[0] = static_cast<uint8_t>(shuffled[0] + (SHUFFLE_TABLE[shuffled[1]] - input));
+				shuffled[1] = static_cast<uint8_t>(shuffled[1] - (shuffled[2] ^ tableInput));
+				shuffled[2] = static_cast<uint8_t>(shuffled[2] ^ (SHUFFLE_TABLE[shuffled[3]] + input));
+				shuffled[3] = static_cast<uint8_t>(shuffled[3] - shuffled[0] + tableInput);
+
+				uint32_t merged = static_cast<uint32_t>(shuffled[0]) | (static_cast<uint32_t>(shuffled[1]) << 8) |
+								  (static_cast<uint32_t>(shuffled[2]) << 16) | (static_cast<uint32_t>(shuffled[3]) << 24);
+				merged = (merged >> 29) | (merged << 3);
+
+				shuffled[0] = static_cast<uint8_t>(merged);
+				shuffled[1] = static_cast<uint8_t>(merged >> 8);
+				shuffled[2] = static_cast<uint8_t>(merged >> 16);
+				shuffled[3] = static_cast<uint8_t>(merged >> 24);
+			}
+			std::memcpy(this->iv, shuffled, 4);
+		}
+
+		static uint8_t rotateLeft(uint8_t _value, unsigned int _shift)
+		{
+			_shift %= 8;
+			return _shift == 0 ? _value : static_cast<uint8_t>((_value << _shift) | (_value >> (8 - _shift)));
+		}
+
+		static uint8_t rotateRight(uint8_t _value, unsigned int _shift)
+		{
+			_shift %= 8;
+			return _shift == 0 ? _value : static_cast<uint8_t>((_value >> _shift) | (_value << (8 - _shift)));
+		}
+
+		// Every client uses the same AES key
+		static const MapleAES& getAES()
+		{
+			static const uint8_t key[32] = { 0x13, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x06, 0x00, 0x00, 0x00, 0xB4, 0x00, 0x00, 0x00,
+											 0x1B, 0x00, 0x00, 0x00, 0x0F, 0x00, 0x00, 0x00, 0x33, 0x00, 0x00, 0x00, 0x52, 0x00, 0x00, 0x00 };
+			static const MapleAES aes(key);
+			return aes;
+		}
+
+		static constexpr uint8_t SHUFFLE_TABLE[256] =
+		{
+			0xEC, 0x3F, 0x77, 0xA4, 0x45, 0xD0, 0x71, 0xBF, 0xB7, 0x98, 0x20, 0xFC, 0x4B, 0xE9, 0xB3, 0xE1,
+			0x5C, 0x22, 0xF7, 0x0C, 0x44, 0x1B, 0x81, 0xBD, 0x63, 0x8D, 0xD4, 0xC3, 0xF2, 0x10, 0x19, 0xE0,
+			0xFB, 0xA1, 0x6E, 0x66, 0xEA, 0xAE, 0xD6, 0xCE, 0x06, 0x18, 0x4E, 0xEB, 0x78, 0x95, 0xDB, 0xBA,
+			0xB6, 0x42, 0x7A, 0x2A, 0x83, 0x0B, 0x54, 0x67, 0x6D, 0xE8, 0x65, 0xE7, 0x2F, 0x07, 0xF3, 0xAA,
+			0x27, 0x7B, 0x85, 0xB0, 0x26, 0xFD, 0x8B, 0xA9, 0xFA, 0xBE, 0xA8, 0xD7, 0xCB, 0xCC, 0x92, 0xDA,
+			0xF9, 0x93, 0x60, 0x2D, 0xDD, 0xD2, 0xA2, 0x9B, 0x39, 0x5F, 0x82, 0x21, 0x4C, 0x69, 0xF8, 0x31,
+			0x87, 0xEE, 0x8E, 0xAD, 0x8C, 0x6A, 0xBC, 0xB5, 0x6B, 0x59, 0x13, 0xF1, 0x04, 0x00, 0xF6, 0x5A,
+			0x35, 0x79, 0x48, 0x8F, 0x15, 0xCD, 0x97, 0x57, 0x12, 0x3E, 0x37, 0xFF, 0x9D, 0x4F, 0x51, 0xF5,
+			0xA3, 0x70, 0xBB, 0x14, 0x75, 0xC2, 0xB8, 0x72, 0xC0, 0xED, 0x7D, 0x68, 0xC9, 0x2E, 0x0D, 0x62,
+			0x46, 0x17, 0x11, 0x4D, 0x6C, 0xC4, 0x7E, 0x53, 0xC1, 0x25, 0xC7, 0x9A, 0x1C, 0x88, 0x58, 0x2C,
+			0x89, 0xDC, 0x02, 0x64, 0x40, 0x01, 0x5D, 0x38, 0xA5, 0xE2, 0xAF, 0x55, 0xD5, 0xEF, 0x1A, 0x7C,
+			0xA7, 0x5B, 0xA6, 0x6F, 0x86, 0x9F, 0x73, 0xE6, 0x0A, 0xDE, 0x2B, 0x99, 0x4A, 0x47, 0x9C, 0xDF,
+			0x09, 0x76, 0x9E, 0x30, 0x0E, 0xE4, 0xB2, 0x94, 0xA0, 0x3B, 0x34, 0x1D, 0x28, 0x0F, 0x36, 0xE3,
+			0x23, 0xB4, 0x03, 0xD8, 0x90, 0xC8, 0x3C, 0xFE, 0x5E, 0x32, 0x24, 0x50, 0x1F, 0x3A, 0x43, 0x8A,
+			0x96, 0x41, 0x74, 0xAC, 0x52, 0x33, 0xF0, 0xD9, 0x29, 0x80, 0xB1, 0x16, 0xD3, 0xAB, 0x91, 0xB9,
+			0x84, 0x7F, 0x61, 0x1E, 0xCF, 0xC5, 0xD1, 0x56, 0x3D, 0xCA, 0xF4, 0x05, 0xC6, 0xE5, 0x08, 0x49
+		};
+
+		uint8_t iv[4] = {};
+		uint16_t version = 0;
+};
+
+#endif
@@ -0,0 +1,111 @@
+// C++
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Templates
+#include "maple_cipher.hpp"
+
+// Keeps the compiler from optimizing the work away
+volatile uint8_t sink = 0;
+
+// Encrypts and decrypts packets of _packetSize bytes on one thread for _seconds, returns MB/s per direction
+void runBenchmark(size_t _packetSize, double _seconds, double& _encryptMBs, double& _decryptMBs)
+{
+	const uint8_t iv[4] = { 70, 114, 122, 1 };
+	MapleCipher sender(iv, 0xFFFF - 83);
+	MapleCipher receiver(iv, 0xFFFF - 83);
+
+	std::vector<std::byte> packet(MapleCipher::HEADER_SIZE + _packetSize);
+	for(size_t i = 0; i < packet.size(); ++i)
+	{
+		packet[i] = static_cast<std::byte>(i);
+	}
+
+	std::chrono::duration<double> encryptTime(0);
+	std::chrono::duration<double> decryptTime(0);
+	size_t packets = 0;
+	while(encryptTime + decryptTime < std::chrono::duration<double>(_seconds))
+	{
+		// Time batches, the clock is too slow to read around every small packet
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		for(int i = 0; i < 256; ++i)
+		{
+			sender.encrypt(packet.data(), packet.data() + MapleCipher::HEADER_SIZE, _packetSize);
+		}
+		std::chrono::steady_clock::time_point middle = std::chrono::steady_clock::now();
+		for(int i = 0; i < 256; ++i)
+		{
+			receiver.decrypt(packet.data() + MapleCipher::HEADER_SIZE, _packetSize);
+		}
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+		encryptTime += middle - begin;
+		decryptTime += end - middle;
+		packets += 256;
+		sink = sink + static_cast<uint8_t>(packet.back());
+	}
+
+	double megabytes = static_cast<double>(packets * _packetSize) / (1024.0 * 1024.0);
+	_encryptMBs = megabytes / encryptTime.count();
+	_decryptMBs = megabytes / decryptTime.count();
+}
+
+// Both kernels have to produce the same bytes before their speeds mean anything
+bool kernelsAgree()
+{
+	const uint8_t iv[4] = { 82, 48, 120, 7 };
+	std::vector<std::byte> scalar(4096, std::byte { 0x5A });
+	std::vector<std::byte> accelerated(scalar);
+	std::byte header[MapleCipher::HEADER_SIZE];
+
+	MapleAES::setAESNIEnabled(false);
+	MapleCipher(iv, 83).encrypt(header, scalar.data(), scalar.size());
+	MapleAES::setAESNIEnabled(true);
+	MapleCipher(iv, 83).encrypt(header, accelerated.data(), accelerated.size());
+	return scalar == accelerated;
+}
+
+int main(int argc, char* argv[])
+{
+	// Usage: maple_cipher_benchmark [seconds per run]
+	// Everything runs on one thread, so the numbers are per core
+	double seconds = argc > 1 ? std::stod(argv[1]) : 1.0;
+
+	std::cout << "AES-NI: " << (MapleAES::hasAESNI() ? "available" : "not available") << '\n';
+	if(MapleAES::hasAESNI() && !kernelsAgree())
+	{
+		std::cout << "Error: AES-NI and scalar kernels disagree" << '\n';
+		return 1;
+	}
+
+	const size_t packetSizes[] = { 16, 64, 256, 1024, 1460, 4096, 16384 };
+	std::vector<bool> kernels = { false };
+	if(MapleAES::hasAESNI())
+	{
+		kernels.push_back(true);
+	}
+
+	for(bool aesni : kernels)
+	{
+		MapleAES::setAESNIEnabled(aesni);
+		std::cout << '\n' << (aesni ? "AES-NI" : "Scalar") << " kernel, MB/s per core" << '\n';
+		std::cout << std::setw(12) << "Packet size" << std::setw(12) << "Encrypt" << std::setw(12) << "Decrypt" << '\n';
+		for(size_t packetSize : packetSizes)
+		{
+			double encryptMBs = 0;
+			double decryptMBs = 0;
+			runBenchmark(packetSize, seconds, encryptMBs, decryptMBs);
+			std::cout << std::setw(12) << packetSize
+					  << std::setw(12) << std::fixed << std::setprecision(1) << encryptMBs
+					  << std::setw(12) << decryptMBs << '\n';
+		}
+	}
+
+	return 0;
+}
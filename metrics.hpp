@@ -0,0 +1,347 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+// C++
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// Templates
+#include "buffer_pool.hpp"
+#include "handler_allocator.hpp"
+
+enum class MetricCounter : size_t
+{
+	Accepts,
+	Disconnects,
+	// Read/write/receive/send failures other than the peer closing the connection
+	Errors,
+	BytesReceived,
+	BytesSent,
+	MessagesReceived,
+	MessagesSent,
+	// Socket writes, one write can carry many messages
+	Writes,
+	// Packets queued but not yet on the wire, over every connection
+	WriteQueueDepth,
+	// Connections dropped for going idle or stalling a write
+	Timeouts,
+	// Low priority packets a backed up connection didn't queue
+	PacketsDropped,
+	// Connections dropped for letting their write queue back up
+	SlowConsumers,
+	Count
+};
+
+enum class MetricHistogram : size_t
+{
+	// How long message handlers run
+	HandlerTime,
+	// From a packet being queued to its write completing
+	QueueToWire,
+	// Client side, from sending a message to its echo arriving
+	RoundTrip,
+	Count
+};
+
+constexpr const char* METRIC_COUNTER_NAMES[] = { "accepts", "disconnects", "errors", "bytes_received", "bytes_sent",
+												 "messages_received", "messages_sent", "writes", "write_queue_depth", "timeouts",
+												 "packets_dropped", "slow_consumers" };
+constexpr const char* METRIC_HISTOGRAM_NAMES[] = { "handler_time_ns", "queue_to_wire_ns", "round_trip_ns" };
+static_assert(std::size(METRIC_COUNTER_NAMES) == static_cast<size_t>(MetricCounter::Count));
+static_assert(std::size(METRIC_HISTOGRAM_NAMES) == static_cast<size_t>(MetricHistogram::Count));
+
+// HDR style log-linear buckets: every power of two is split into SUB_BUCKETS linear buckets,
+// so any recorded value is off by at most 1 / SUB_BUCKETS (~1.6%) no matter its magnitude
+struct HistogramBuckets
+{
+	static constexpr size_t SUB_BUCKET_BITS = 6;
+	static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BUCKET_BITS;
+	// Values are nanoseconds, anything past ~18 minutes lands in the last bucket
+	static constexpr uint64_t MAX_VALUE = (uint64_t(1) << 40) - 1;
+	static constexpr size_t COUNT = (40 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+	static size_t indexOf(uint64_t _value)
+	{
+		_value = std::min(_value, MAX_VALUE);
+		if(_value < SUB_BUCKETS)
+		{
+			return static_cast<size_t>(_value);
+		}
+		size_t shift = static_cast<size_t>(std::bit_width(_value)) - 1 - SUB_BUCKET_BITS;
+		return (shift + 1) * SUB_BUCKETS + static_cast<size_t>((_value >> shift) - SUB_BUCKETS);
+	}
+
+	// The largest value that lands in bucket _index
+	static uint64_t highestValueOf(size_t _index)
+	{
+		if(_index < SUB_BUCKETS)
+		{
+			return _index;
+		}
+		size_t shift = _index / SUB_BUCKETS - 1;
+		uint64_t lowest = static_cast<uint64_t>(SUB_BUCKETS + _index % SUB_BUCKETS) << shift;
+		return lowest + (uint64_t(1) << shift) - 1;
+	}
+};
+
+// A histogram summed over every thread
+struct HistogramSnapshot
+{
+	std::vector<uint64_t> counts = std::vector<uint64_t>(HistogramBuckets::COUNT, 0);
+	uint64_t total = 0;
+	uint64_t sum = 0;
+	uint64_t min = UINT64_MAX;
+	uint64_t max = 0;
+
+	// _percentile in [0, 100], accurate to the bucket width
+	uint64_t getPercentile(double _percentile) const
+	{
+		if(this->total == 0)
+		{
+			return 0;
+		}
+
+		uint64_t rank = static_cast<uint64_t>(_percentile / 100.0 * static_cast<double>(this->total));
+		rank = std::clamp<uint64_t>(rank, 1, this->total);
+		uint64_t seen = 0;
+		for(size_t i = 0; i < this->counts.size(); ++i)
+		{
+			seen += this->counts[i];
+			if(seen >= rank)
+			{
+				return std::clamp(HistogramBuckets::highestValueOf(i), this->min, this->max);
+			}
+		}
+		return this->max;
+	}
+
+	uint64_t getMean() const { return this->total > 0 ? this->sum / this->total : 0; }
+};
+
+struct MetricsSnapshot
+{
+	std::array<int64_t, static_cast<size_t>(MetricCounter::Count)> counters = {};
+	std::array<HistogramSnapshot, static_cast<size_t>(MetricHistogram::Count)> histograms;
+	BufferPoolStats bufferPool;
+	size_t handlerHeapAllocations = 0;
+	// Since the first metric was recorded, rates are averaged over it
+	double uptimeSeconds = 0;
+
+	int64_t get(MetricCounter _counter) const { return this->counters[static_cast<size_t>(_counter)]; }
+	const HistogramSnapshot& get(MetricHistogram _histogram) const { return this->histograms[static_cast<size_t>(_histogram)]; }
+
+	// One "name value" pair per line, easy to diff or feed to a script
+	void writeText(std::ostream& _out) const
+	{
+		std::ios::fmtflags flags = _out.flags();
+		_out << std::dec << std::fixed << std::setprecision(1);
+		_out << "uptime_seconds " << this->uptimeSeconds << '\n';
+		for(size_t i = 0; i < this->counters.size(); ++i)
+		{
+			_out << METRIC_COUNTER_NAMES[i] << ' ' << this->counters[i];
+			if(this->uptimeSeconds > 0 && static_cast<MetricCounter>(i) != MetricCounter::WriteQueueDepth)
+			{
+				_out << " (" << static_cast<double>(this->counters[i]) / this->uptimeSeconds << "/s)";
+			}
+			_out << '\n';
+		}
+		for(size_t i = 0; i < this->histograms.size(); ++i)
+		{
+			const HistogramSnapshot& histogram = this->histograms[i];
+			_out << METRIC_HISTOGRAM_NAMES[i] << " count " << histogram.total
+				 << " min " << (histogram.total > 0 ? histogram.min : 0)
+				 << " mean " << histogram.getMean()
+				 << " p50 " << histogram.getPercentile(50)
+				 << " p99 " << histogram.getPercentile(99)
+				 << " p99.9 " << histogram.getPercentile(99.9)
+				 << " max " << histogram.max << '\n';
+		}
+		_out << "buffer_pool_in_use " << this->bufferPool.inUse() << '\n';
+		_out << "buffer_pool_allocations " << this->bufferPool.allocations << '\n';
+		_out << "buffer_pool_cache_hits " << this->bufferPool.cacheHits << '\n';
+		_out << "buffer_pool_system_allocations " << this->bufferPool.systemAllocations << '\n';
+		_out << "buffer_pool_oversize_allocations " << this->bufferPool.oversizeAllocations << '\n';
+		_out << "handler_heap_allocations " << this->handlerHeapAllocations << '\n';
+		_out.flags(flags);
+	}
+};
+
+// Per-connection numbers, written by the connection's strand and readable from anywhere
+struct ConnectionStats
+{
+	std::atomic<uint64_t> bytesReceived = 0;
+	std::atomic<uint64_t> bytesSent = 0;
+	std::atomic<uint64_t> messagesReceived = 0;
+	std::atomic<uint64_t> messagesSent = 0;
+	std::atomic<uint64_t> writeQueueDepth = 0;
+	std::atomic<uint64_t> writeQueueBytes = 0;
+
+	// Single writer, so a relaxed load and store is enough and avoids a locked instruction
+	static void add(std::atomic<uint64_t>& _counter, uint64_t _amount = 1) { _counter.store(_counter.load(std::memory_order_relaxed) + _amount, std::memory_order_relaxed); }
+	static void subtract(std::atomic<uint64_t>& _counter, uint64_t _amount) { _counter.store(_counter.load(std::memory_order_relaxed) - _amount, std::memory_order_relaxed); }
+	static uint64_t get(const std::atomic<uint64_t>& _counter) { return _counter.load(std::memory_order_relaxed); }
+};
+
+// Process wide counters and latency histograms.
+// Every thread updates its own copy without contention, getSnapshot() adds them all up on demand
+class Metrics
+{
+	public:
+		static void add(MetricCounter _counter, int64_t _amount = 1)
+		{
+			std::atomic<int64_t>& counter = threadMetrics().counters[static_cast<size_t>(_counter)];
+			counter.store(counter.load(std::memory_order_relaxed) + _amount, std::memory_order_relaxed);
+		}
+
+		static void record(MetricHistogram _histogram, std::chrono::nanoseconds _duration)
+		{
+			threadMetrics().histograms[static_cast<size_t>(_histogram)].record(static_cast<uint64_t>(std::max<int64_t>(_duration.count(), 0)));
+		}
+
+		static MetricsSnapshot getSnapshot()
+		{
+			MetricsSnapshot snapshot;
+			SharedState& shared = sharedState();
+			{
+				std::lock_guard<std::mutex> lock(shared.m);
+				addTo(shared.retired, snapshot);
+				for(ThreadMetrics* metrics : shared.threads)
+				{
+					addTo(*metrics, snapshot);
+				}
+			}
+			snapshot.bufferPool = BufferPool::getStats();
+			snapshot.handlerHeapAllocations = HandlerMemory::getHeapAllocations();
+			snapshot.uptimeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - shared.startTime).count();
+			return snapshot;
+		}
+
+	private:
+		// Written by one thread only, read by getSnapshot()
+		struct Histogram
+		{
+			void record(uint64_t _value)
+			{
+				increment(this->counts[HistogramBuckets::indexOf(_value)], 1);
+				increment(this->total, 1);
+				increment(this->sum, _value);
+				if(_value < this->min.load(std::memory_order_relaxed))
+				{
+					this->min.store(_value, std::memory_order_relaxed);
+				}
+				if(_value > this->max.load(std::memory_order_relaxed))
+				{
+					this->max.store(_value, std::memory_order_relaxed);
+				}
+			}
+
+			static void increment(std::atomic<uint64_t>& _counter, uint64_t _amount)
+			{
+				_counter.store(_counter.load(std::memory_order_relaxed) + _amount, std::memory_order_relaxed);
+			}
+
+			std::array<std::atomic<uint64_t>, HistogramBuckets::COUNT> counts = {};
+			std::atomic<uint64_t> total = 0;
+			std::atomic<uint64_t> sum = 0;
+			std::atomic<uint64_t> min = UINT64_MAX;
+			std::atomic<uint64_t> max = 0;
+		};
+
+		struct ThreadMetrics
+		{
+			std::array<std::atomic<int64_t>, static_cast<size_t>(MetricCounter::Count)> counters = {};
+			std::array<Histogram, static_cast<size_t>(MetricHistogram::Count)> histograms;
+		};
+
+		struct SharedState
+		{
+			std::mutex m;
+			std::vector<ThreadMetrics*> threads;
+			// Totals of threads that have exited
+			ThreadMetrics retired;
+			std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+		};
+
+		// Registers the thread's metrics on first use and folds them into retired on thread exit
+		struct ThreadHandle
+		{
+			ThreadHandle()
+			{
+				SharedState& shared = sharedState();
+				std::lock_guard<std::mutex> lock(shared.m);
+				shared.threads.push_back(&this->metrics);
+			}
+
+			~ThreadHandle()
+			{
+				SharedState& shared = sharedState();
+				std::lock_guard<std::mutex> lock(shared.m);
+				for(size_t i = 0; i < this->metrics.counters.size(); ++i)
+				{
+					std::atomic<int64_t>& counter = shared.retired.counters[i];
+					counter.store(counter.load(std::memory_order_relaxed) + this->metrics.counters[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+				}
+				for(size_t i = 0; i < this->metrics.histograms.size(); ++i)
+				{
+					Histogram& from = this->metrics.histograms[i];
+					Histogram& to = shared.retired.histograms[i];
+					for(size_t j = 0; j < HistogramBuckets::COUNT; ++j)
+					{
+						Histogram::increment(to.counts[j], from.counts[j].load(std::memory_order_relaxed));
+					}
+					Histogram::increment(to.total, from.total.load(std::memory_order_relaxed));
+					Histogram::increment(to.sum, from.sum.load(std::memory_order_relaxed));
+					to.min.store(std::min(to.min.load(std::memory_order_relaxed), from.min.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+					to.max.store(std::max(to.max.load(std::memory_order_relaxed), from.max.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+				}
+				std::erase(shared.threads, &this->metrics);
+			}
+
+			ThreadMetrics metrics;
+		};
+
+		// Never destroyed so threads can still retire their metrics during static destruction
+		static SharedState& sharedState()
+		{
+			static SharedState* state = new SharedState();
+			return *state;
+		}
+
+		static ThreadMetrics& threadMetrics()
+		{
+			thread_local ThreadHandle handle;
+			return handle.metrics;
+		}
+
+		static void addTo(const ThreadMetrics& _metrics, MetricsSnapshot& _snapshot)
+		{
+			for(size_t i = 0; i < _metrics.counters.size(); ++i)
+			{
+				_snapshot.counters[i] += _metrics.counters[i].load(std::memory_order_relaxed);
+			}
+			for(size_t i = 0; i < _metrics.histograms.size(); ++i)
+			{
+				const Histogram& from = _metrics.histograms[i];
+				HistogramSnapshot& to = _snapshot.histograms[i];
+				for(size_t j = 0; j < HistogramBuckets::COUNT; ++j)
+				{
+					to.counts[j] += from.counts[j].load(std::memory_order_relaxed);
+				}
+				to.total += from.total.load(std::memory_order_relaxed);
+				to.sum += from.sum.load(std::memory_order_relaxed);
+				to.min = std::min(to.min, from.min.load(std::memory_order_relaxed));
+				to.max = std::max(to.max, from.max.load(std::memory_order_relaxed));
+			}
+		}
+};
+
+#endif
@@ -0,0 +1,193 @@
+// C++
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Templates
+#include "opcode_dispatcher.hpp"
+
+// Consts
+// Registered opcodes are spread out the way a real protocol's are, 0, 7, 14, ...
+const size_t HANDLER_COUNT = 64;
+const uint16_t OPCODE_STRIDE = 7;
+const size_t PACKET_COUNT = 4096;
+// Share of packets with an opcode nothing handles
+const double UNKNOWN_SHARE = 0.1;
+
+// What the handlers work on, they do just enough that the call can't be optimized away
+struct Context
+{
+	uint64_t sum = 0;
+};
+
+template <uint16_t Opcode>
+void countPacket(Context& _context, MessageView _payload)
+{
+	_context.sum += Opcode + _payload.size();
+}
+
+void countUnknown(Context& _context, uint16_t _opcode, MessageView _packet)
+{
+	_context.sum += 1;
+}
+
+template <size_t... Indices>
+auto makeDispatcher(std::index_sequence<Indices...>)
+{
+	return OpcodeDispatcher<Context, countUnknown, OpcodeHandler<Indices * OPCODE_STRIDE, countPacket<Indices * OPCODE_STRIDE>>...>();
+}
+
+typedef decltype(makeDispatcher(std::make_index_sequence<HANDLER_COUNT>())) Dispatcher;
+
+// The usual runtime registries to compare against
+typedef std::unordered_map<uint16_t, std::function<void(Context&, MessageView)>> FunctionMap;
+
+class VirtualHandler
+{
+	public:
+		virtual ~VirtualHandler() = default;
+		virtual void handle(Context& _context, MessageView _payload) = 0;
+};
+
+template <uint16_t Opcode>
+class CountingHandler : public VirtualHandler
+{
+	public:
+		void handle(Context& _context, MessageView _payload) override { countPacket<Opcode>(_context, _payload); }
+};
+
+typedef std::map<uint16_t, std::unique_ptr<VirtualHandler>> VirtualMap;
+
+template <size_t... Indices>
+void registerHandlers(FunctionMap& _functions, VirtualMap& _virtuals, std::index_sequence<Indices...>)
+{
+	((_functions[Indices * OPCODE_STRIDE] = countPacket<Indices * OPCODE_STRIDE>), ...);
+	((_virtuals[Indices * OPCODE_STRIDE] = std::make_unique<CountingHandler<Indices * OPCODE_STRIDE>>()), ...);
+}
+
+uint16_t readOpcode(MessageView _packet)
+{
+	return static_cast<uint16_t>(std::to_integer<uint16_t>(_packet[0]) | (std::to_integer<uint16_t>(_packet[1]) << 8));
+}
+
+// Dispatches the whole packet set until _seconds have passed, returns ns per packet and the handlers' sum for one pass
+template <typename Dispatch>
+double runBenchmark(const std::vector<std::vector<std::byte>>& _packets, double _seconds, uint64_t& _checksum, Dispatch&& _dispatch)
+{
+	Context context;
+	for(const std::vector<std::byte>& packet : _packets)
+	{
+		_dispatch(context, MessageView(packet));
+	}
+	_checksum = context.sum;
+
+	size_t dispatched = 0;
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	std::chrono::duration<double> elapsed(0);
+	while(elapsed < std::chrono::duration<double>(_seconds))
+	{
+		for(const std::vector<std::byte>& packet : _packets)
+		{
+			_dispatch(context, MessageView(packet));
+		}
+		dispatched += _packets.size();
+		elapsed = std::chrono::steady_clock::now() - begin;
+	}
+
+	// Keeps the loop from being thrown away
+	if(context.sum == 0)
+	{
+		std::cout << "";
+	}
+	return elapsed.count() * 1e9 / static_cast<double>(dispatched);
+}
+
+int main(int argc, char* argv[])
+{
+	// Usage: opcode_dispatch_benchmark [seconds per run]
+	double seconds = argc > 1 ? std::stod(argv[1]) : 1.0;
+
+	// Small packets with opcodes picked at random, so the branch predictor can't learn the order
+	std::mt19937 random(83);
+	std::uniform_int_distribution<size_t> handlerIndex(0, HANDLER_COUNT - 1);
+	std::uniform_int_distribution<uint32_t> anyOpcode(0, 0xFFFF);
+	std::uniform_int_distribution<size_t> payloadSize(0, 32);
+	std::bernoulli_distribution unknown(UNKNOWN_SHARE);
+	std::vector<std::vector<std::byte>> packets;
+	for(size_t i = 0; i < PACKET_COUNT; ++i)
+	{
+		uint16_t opcode = static_cast<uint16_t>(handlerIndex(random) * OPCODE_STRIDE);
+		if(unknown(random))
+		{
+			do
+			{
+				opcode = static_cast<uint16_t>(anyOpcode(random));
+			}
+			while(Dispatcher::isRegistered(opcode));
+		}
+
+		std::vector<std::byte> packet(OPCODE_SIZE + payloadSize(random), std::byte { 0 });
+		packet[0] = static_cast<std::byte>(opcode & 0xFF);
+		packet[1] = static_cast<std::byte>(opcode >> 8);
+		packets.push_back(std::move(packet));
+	}
+
+	FunctionMap functions;
+	VirtualMap virtuals;
+	registerHandlers(functions, virtuals, std::make_index_sequence<HANDLER_COUNT>());
+
+	uint64_t tableChecksum = 0;
+	uint64_t functionChecksum = 0;
+	uint64_t virtualChecksum = 0;
+	double tableNs = runBenchmark(packets, seconds, tableChecksum, [](Context& _context, MessageView _packet)
+	{
+		Dispatcher::dispatch(_context, _packet);
+	});
+	double functionNs = runBenchmark(packets, seconds, functionChecksum, [&functions](Context& _context, MessageView _packet)
+	{
+		uint16_t opcode = readOpcode(_packet);
+		FunctionMap::iterator found = functions.find(opcode);
+		if(found == functions.end())
+		{
+			countUnknown(_context, opcode, _packet);
+			return;
+		}
+		found->second(_context, _packet.subspan(OPCODE_SIZE));
+	});
+	double virtualNs = runBenchmark(packets, seconds, virtualChecksum, [&virtuals](Context& _context, MessageView _packet)
+	{
+		uint16_t opcode = readOpcode(_packet);
+		VirtualMap::iterator found = virtuals.find(opcode);
+		if(found == virtuals.end())
+		{
+			countUnknown(_context, opcode, _packet);
+			return;
+		}
+		found->second->handle(_context, _packet.subspan(OPCODE_SIZE));
+	});
+
+	if(tableChecksum != functionChecksum || tableChecksum != virtualChecksum)
+	{
+		std::cout << "Error: dispatchers disagree" << '\n';
+		return 1;
+	}
+
+	std::cout << "Handlers: " << HANDLER_COUNT << ", table size: " << Dispatcher::TABLE_SIZE << ", packets: " << PACKET_COUNT
+			  << ", unknown opcodes: " << UNKNOWN_SHARE * 100.0 << "%" << '\n';
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "OpcodeDispatcher table        " << std::setw(8) << tableNs << " ns/packet" << '\n';
+	std::cout << "unordered_map + std::function " << std::setw(8) << functionNs << " ns/packet" << '\n';
+	std::cout << "std::map + virtual handler    " << std::setw(8) << virtualNs << " ns/packet" << '\n';
+
+	return 0;
+}
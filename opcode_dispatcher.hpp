@@ -0,0 +1,82 @@
+#ifndef OPCODEDISPATCHER_H
+#define OPCODEDISPATCHER_H
+
+// C++
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// Templates
+#include "receive_ring.hpp"
+
+// MapleStory packets start with a little endian 16 bit opcode
+constexpr size_t OPCODE_SIZE = 2;
+
+// Binds Handler to packets with opcode Opcode. The handler is called as Handler(context, payload),
+// the payload being everything after the opcode
+template <uint16_t Opcode, auto Handler>
+struct OpcodeHandler
+{
+	static constexpr uint16_t OPCODE = Opcode;
+
+	template <typename Context>
+	static void call(Context& _context, uint16_t _opcode, MessageView _packet) { Handler(_context, _packet.subspan(OPCODE_SIZE)); }
+};
+
+// Routes packets to handlers by opcode through a flat table built at compile time.
+// Dispatching is a bounds check and one indirect call, no virtual calls and no hashing.
+// The table only reaches the highest registered opcode, anything past it or not registered goes to
+// DefaultHandler(context, opcode, packet) with the whole packet. So do packets too short to hold an opcode, as opcode 0
+template <typename Context, auto DefaultHandler, typename... Handlers>
+class OpcodeDispatcher
+{
+	typedef void (*Function)(Context& _context, uint16_t _opcode, MessageView _packet);
+	public:
+		static constexpr size_t TABLE_SIZE = std::max({ size_t(0), static_cast<size_t>(Handlers::OPCODE) + 1 ... });
+
+		/*****************
+		 * Dispatch Functions
+		 ****************/
+		static void dispatch(Context& _context, MessageView _packet)
+		{
+			if(_packet.size() < OPCODE_SIZE)
+			{
+				DefaultHandler(_context, 0, _packet);
+				return;
+			}
+
+			uint16_t opcode = static_cast<uint16_t>(std::to_integer<uint16_t>(_packet[0]) | (std::to_integer<uint16_t>(_packet[1]) << 8));
+			Function function = opcode < TABLE_SIZE ? TABLE[opcode] : &callDefault;
+			function(_context, opcode, _packet);
+		}
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		static constexpr bool isRegistered(uint16_t _opcode) { return _opcode < TABLE_SIZE && TABLE[_opcode] != &callDefault; }
+
+	private:
+		static void callDefault(Context& _context, uint16_t _opcode, MessageView _packet) { DefaultHandler(_context, _opcode, _packet); }
+
+		static constexpr bool hasDuplicates()
+		{
+			std::array<uint16_t, sizeof...(Handlers)> opcodes = { Handlers::OPCODE... };
+			std::sort(opcodes.begin(), opcodes.end());
+			return std::adjacent_find(opcodes.begin(), opcodes.end()) != opcodes.end();
+		}
+
+		static constexpr std::array<Function, TABLE_SIZE> buildTable()
+		{
+			static_assert(!hasDuplicates(), "An opcode is registered to more than one handler");
+			std::array<Function, TABLE_SIZE> table {};
+			table.fill(&callDefault);
+			((table[Handlers::OPCODE] = &Handlers::template call<Context>), ...);
+			return table;
+		}
+
+		static constexpr std::array<Function, TABLE_SIZE> TABLE = buildTable();
+};
+
+#endif
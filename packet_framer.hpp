@@ -0,0 +1,218 @@
+#ifndef PACKETFRAMER_H
+#define PACKETFRAMER_H
+
+// C++
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <span>
+#include <string>
+
+// Splits a TCP byte stream into messages and frames outgoing messages the same way.
+// Shared by the TCP client and server so both ends always agree on the wire format.
+//
+// Header mode:    [header (body length)][body]
+// Delimiter mode: [body][delimiter]
+//
+// The framer never reads from the socket itself. Callers read as much as the socket has into
+// one buffer and then pull every complete frame out of it, so a burst of small packets costs one read.
+class PacketFramer
+{
+	public:
+		/*****************
+		 * Typedefs
+		 ****************/
+		enum class Mode { Header, Delimiter };
+		enum class Status { Complete, Incomplete, Invalid };
+
+		// Turns a received header into the length of the body that follows it.
+		// Returning INVALID_BODY_SIZE rejects the header as a protocol error
+		typedef std::function<size_t(const unsigned char* _header, size_t _headerSize)> HeaderDecoder;
+		// Writes the header for a body of _bodySize bytes
+		typedef std::function<void(unsigned char* _header, size_t _headerSize, size_t _bodySize)> HeaderEncoder;
+
+		static constexpr size_t INVALID_BODY_SIZE = static_cast<size_t>(-1);
+
+		// Where a complete frame sits in the receive buffer
+		struct Frame
+		{
+			size_t bodyOffset = 0;
+			size_t bodySize = 0;
+			size_t frameSize = 0;
+		};
+
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		// 2 byte little endian length header, the MapleStory handshake format
+		PacketFramer() : PacketFramer(PacketFramer::withHeader()) {}
+
+		// Length-prefixed frames. By default the header is a little endian body length
+		static PacketFramer withHeader(size_t _headerSize = 2,
+									   HeaderDecoder _decoder = decodeLittleEndian,
+									   HeaderEncoder _encoder = encodeLittleEndian)
+		{
+			PacketFramer framer(Mode::Header);
+			framer.headerSize = _headerSize;
+			framer.decoder = std::move(_decoder);
+			framer.encoder = std::move(_encoder);
+			return framer;
+		}
+
+		// Frames terminated by a delimiter, the body can't contain the delimiter
+		static PacketFramer withDelimiter(char _delimiter = '\0')
+		{
+			PacketFramer framer(Mode::Delimiter);
+			framer.delimiter = _delimiter;
+			return framer;
+		}
+
+		/*****************
+		 * Framer Functions
+		 ****************/
+		// Looks for a complete frame at the start of _data.
+		// Call it again after consuming _frame.frameSize bytes to get the next one.
+		Status nextFrame(const unsigned char* _data, size_t _size, Frame& _frame)
+		{
+			if(this->mode == Mode::Header)
+			{
+				if(_size < this->headerSize)
+				{
+					this->bytesNeeded = this->headerSize - _size;
+					return Status::Incomplete;
+				}
+
+				size_t bodySize = this->decoder(_data, this->headerSize);
+				if(bodySize > this->maxBodySize)
+				{
+					return Status::Invalid;
+				}
+
+				if(_size < this->headerSize + bodySize)
+				{
+					this->bytesNeeded = this->headerSize + bodySize - _size;
+					return Status::Incomplete;
+				}
+
+				_frame.bodyOffset = this->headerSize;
+				_frame.bodySize = bodySize;
+				_frame.frameSize = this->headerSize + bodySize;
+			}
+			else
+			{
+				// Don't rescan bytes we've already searched on a previous read
+				const void* delimiterPosition = nullptr;
+				if(this->scanOffset < _size)
+				{
+					delimiterPosition = std::memchr(_data + this->scanOffset, this->delimiter, _size - this->scanOffset);
+				}
+
+				if(delimiterPosition == nullptr)
+				{
+					this->scanOffset = _size;
+					this->bytesNeeded = 1;
+					return _size > this->maxBodySize ? Status::Invalid : Status::Incomplete;
+				}
+
+				size_t bodySize = static_cast<const unsigned char*>(delimiterPosition) - _data;
+				_frame.bodyOffset = 0;
+				_frame.bodySize = bodySize;
+				_frame.frameSize = bodySize + 1;
+				this->scanOffset = 0;
+			}
+
+			this->bytesNeeded = 0;
+			return Status::Complete;
+		}
+
+		Status nextFrame(std::span<const std::byte> _data, Frame& _frame)
+		{
+			return this->nextFrame(reinterpret_cast<const unsigned char*>(_data.data()), _data.size(), _frame);
+		}
+
+		// Writes _body as a single frame to _out, which needs room for _size + getFrameOverhead() bytes.
+		// Returns the frame size
+		size_t encode(void* _out, const void* _body, size_t _size) const
+		{
+			unsigned char* out = static_cast<unsigned char*>(_out);
+			if(this->mode == Mode::Header)
+			{
+				this->encoder(out, this->headerSize, _size);
+				std::memcpy(out + this->headerSize, _body, _size);
+			}
+			else
+			{
+				std::memcpy(out, _body, _size);
+				out[_size] = static_cast<unsigned char>(this->delimiter);
+			}
+			return _size + this->getFrameOverhead();
+		}
+
+		// Appends _body to _out as a single frame
+		void encode(std::string& _out, const void* _body, size_t _size) const
+		{
+			size_t offset = _out.size();
+			_out.resize(offset + _size + this->getFrameOverhead());
+			this->encode(_out.data() + offset, _body, _size);
+		}
+
+		std::string encode(const std::string& _body) const
+		{
+			std::string out;
+			out.reserve(_body.size() + this->getFrameOverhead());
+			this->encode(out, _body.data(), _body.size());
+			return out;
+		}
+
+		// How many bytes the next socket read should ask for.
+		// Lets a large body land with a single read instead of many small ones
+		size_t getReadSize(size_t _readChunkSize = 4096) const { return std::max(_readChunkSize, this->bytesNeeded); }
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		Mode getMode() const { return this->mode; }
+		size_t getFrameOverhead() const { return this->mode == Mode::Header ? this->headerSize : 1; }
+		size_t getMaxBodySize() const { return this->maxBodySize; }
+		void setMaxBodySize(size_t _maxBodySize) { this->maxBodySize = _maxBodySize; }
+
+		/*****************
+		 * Default header format
+		 ****************/
+		static size_t decodeLittleEndian(const unsigned char* _header, size_t _headerSize)
+		{
+			size_t bodySize = 0;
+			for(size_t i = 0; i < _headerSize; ++i)
+			{
+				bodySize |= static_cast<size_t>(_header[i]) << (8 * i);
+			}
+			return bodySize;
+		}
+
+		static void encodeLittleEndian(unsigned char* _header, size_t _headerSize, size_t _bodySize)
+		{
+			for(size_t i = 0; i < _headerSize; ++i)
+			{
+				_header[i] = static_cast<unsigned char>(_bodySize >> (8 * i));
+			}
+		}
+
+	private:
+		explicit PacketFramer(Mode _mode) : mode(_mode) {}
+
+		Mode mode;
+		size_t headerSize = 0;
+		HeaderDecoder decoder;
+		HeaderEncoder encoder;
+		char delimiter = '\0';
+
+		// Frames bigger than this are treated as a protocol error instead of being buffered forever
+		size_t maxBodySize = 0xFFFF;
+		// Parse state carried between reads
+		size_t scanOffset = 0;
+		size_t bytesNeeded = 0;
+};
+
+#endif
@@ -0,0 +1,79 @@
+// C++
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Templates
+#include "packet_logger.hpp"
+
+// Turns a PacketLogger file back into the hex dumps the servers used to print
+int main(int argc, char* argv[])
+{
+	// Usage: packet_log_dump <log file> [connection id]
+	if(argc < 2)
+	{
+		std::cout << "Usage: packet_log_dump <log file> [connection id]" << '\n';
+		return 1;
+	}
+	bool filtered = argc > 2;
+	uint64_t connectionFilter = filtered ? std::stoull(argv[2]) : 0;
+
+	std::ifstream file(argv[1], std::ios::binary);
+	char magic[sizeof(PACKET_LOG_MAGIC)];
+	if(!file.read(magic, sizeof(magic)) || std::memcmp(magic, PACKET_LOG_MAGIC, sizeof(magic)) != 0)
+	{
+		std::cout << "Error: " << argv[1] << " is not a packet log" << '\n';
+		return 1;
+	}
+
+	PacketLogRecord record;
+	std::vector<unsigned char> bytes;
+	size_t records = 0;
+	while(file.read(reinterpret_cast<char*>(&record), sizeof(record)))
+	{
+		bytes.resize(record.capturedSize);
+		if(!file.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size())))
+		{
+			std::cout << "Error: log ends in the middle of a record" << '\n';
+			return 1;
+		}
+
+		if(filtered && record.connectionId != connectionFilter)
+		{
+			continue;
+		}
+		records++;
+
+		// Local wall clock time with microseconds
+		std::time_t seconds = static_cast<std::time_t>(record.timestamp / 1000000000);
+		std::cout << std::put_time(std::localtime(&seconds), "%H:%M:%S") << '.'
+				  << std::setw(6) << std::setfill('0') << std::dec << (record.timestamp % 1000000000) / 1000 << std::setfill(' ')
+				  << " connection " << record.connectionId
+				  << (record.direction == PacketDirection::Received ? " received " : " sent ")
+				  << record.size << " bytes";
+
+		if(!bytes.empty())
+		{
+			std::cout << ": ";
+			for(unsigned char b : bytes)
+			{
+				std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<unsigned int>(b) << ' ';
+			}
+			std::cout << std::setfill(' ') << std::dec;
+			if(record.capturedSize < record.size)
+			{
+				std::cout << "...";
+			}
+		}
+		std::cout << '\n';
+	}
+
+	std::cout << std::dec << records << " records" << '\n';
+	return 0;
+}
@@ -0,0 +1,351 @@
+#ifndef PACKETLOGGER_H
+#define PACKETLOGGER_H
+
+// C++
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class PacketLogLevel : uint8_t
+{
+	// Nothing is recorded, logging costs one relaxed load
+	Off,
+	// Connection, direction, time and size only
+	Headers,
+	// Headers plus the packet bytes
+	Full
+};
+
+enum class PacketDirection : uint8_t { Received, Sent };
+
+// On disk every record is followed by capturedSize packet bytes.
+// Records are written in host byte order, read the log back on the same kind of machine
+struct PacketLogRecord
+{
+	// Nanoseconds since the Unix epoch
+	uint64_t timestamp;
+	uint64_t connectionId;
+	uint32_t size;
+	uint32_t capturedSize;
+	PacketDirection direction;
+	uint8_t reserved[7];
+};
+static_assert(sizeof(PacketLogRecord) == 32, "PacketLogRecord is part of the file format");
+
+// Every log file starts with these 8 bytes
+constexpr char PACKET_LOG_MAGIC[8] = { 'P', 'K', 'T', 'L', 'O', 'G', '1', '\0' };
+
+struct PacketLoggerStats
+{
+	size_t recorded = 0;
+	// The thread's ring was full, the IO thread never waits for the disk
+	size_t dropped = 0;
+	// Skipped by sampling
+	size_t sampledOut = 0;
+	size_t bytesWritten = 0;
+};
+
+// Binary packet trace for debugging, replaces dumping every byte to std::cout on the IO threads.
+// Each thread that logs gets its own single producer/single consumer ring, so logging is a memcpy
+// and never takes a lock. A background thread drains every ring into the log file,
+// packet_log_dump turns the file back into hex dumps.
+class PacketLogger
+{
+	public:
+		// Per thread, a full ring drops records instead of blocking
+		static constexpr size_t RING_SIZE = 1 << 20;
+		// Longer packets are cut short in Full mode, the record still has the real size
+		static constexpr size_t MAX_CAPTURED_BYTES = 4096;
+		static constexpr std::chrono::milliseconds DRAIN_INTERVAL = std::chrono::milliseconds(10);
+
+		// Opens _path and starts the drain thread. Every _sampleRate'th packet per thread is recorded
+		static bool start(const std::string& _path, PacketLogLevel _level = PacketLogLevel::Full, uint32_t _sampleRate = 1)
+		{
+			SharedState& shared = sharedState();
+			std::lock_guard<std::mutex> lock(shared.controlMutex);
+			if(shared.drainThread.joinable())
+			{
+				return false;
+			}
+
+			shared.file.open(_path, std::ios::binary | std::ios::trunc);
+			if(!shared.file)
+			{
+				return false;
+			}
+			shared.file.write(PACKET_LOG_MAGIC, sizeof(PACKET_LOG_MAGIC));
+
+			shared.running = true;
+			shared.drainThread = std::thread(drainLoop);
+
+			setSampleRate(_sampleRate);
+			setLevel(_level);
+			return true;
+		}
+
+		// Stops logging, writes out whatever is still buffered and closes the file
+		static void stop()
+		{
+			SharedState& shared = sharedState();
+			std::lock_guard<std::mutex> lock(shared.controlMutex);
+			if(!shared.drainThread.joinable())
+			{
+				return;
+			}
+
+			setLevel(PacketLogLevel::Off);
+			{
+				std::lock_guard<std::mutex> drainLock(shared.drainMutex);
+				shared.running = false;
+			}
+			shared.drainCondition.notify_one();
+			shared.drainThread.join();
+
+			drainAll();
+			shared.file.close();
+		}
+
+		static void log(uint64_t _connectionId, PacketDirection _direction, std::span<const std::byte> _packet)
+		{
+			PacketLogLevel level = getLevel();
+			if(level == PacketLogLevel::Off)
+			{
+				return;
+			}
+
+			Ring& ring = threadRing();
+			if(++ring.sampleCounter < sharedState().sampleRate.load(std::memory_order_relaxed))
+			{
+				ring.count(ring.sampledOut);
+				return;
+			}
+			ring.sampleCounter = 0;
+
+			PacketLogRecord record = {};
+			record.timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+			record.connectionId = _connectionId;
+			record.size = static_cast<uint32_t>(_packet.size());
+			record.capturedSize = level == PacketLogLevel::Full ? static_cast<uint32_t>(std::min(_packet.size(), MAX_CAPTURED_BYTES)) : 0;
+			record.direction = _direction;
+
+			if(!ring.push(record, _packet.data()))
+			{
+				ring.count(ring.dropped);
+				return;
+			}
+			ring.count(ring.recorded);
+		}
+
+		static PacketLoggerStats getStats()
+		{
+			SharedState& shared = sharedState();
+			std::lock_guard<std::mutex> lock(shared.ringsMutex);
+
+			PacketLoggerStats stats = shared.retiredStats;
+			for(const std::shared_ptr<Ring>& ring : shared.rings)
+			{
+				ring->addTo(stats);
+			}
+			stats.bytesWritten = shared.bytesWritten.load(std::memory_order_relaxed);
+			return stats;
+		}
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		static PacketLogLevel getLevel() { return sharedState().level.load(std::memory_order_relaxed); }
+		static void setLevel(PacketLogLevel _level) { sharedState().level.store(_level, std::memory_order_relaxed); }
+		static void setSampleRate(uint32_t _sampleRate) { sharedState().sampleRate.store(std::max<uint32_t>(_sampleRate, 1), std::memory_order_relaxed); }
+
+	private:
+		// Single producer (the owning thread), single consumer (the drain thread).
+		// Positions only ever grow, the index into data is position & (RING_SIZE - 1)
+		struct Ring
+		{
+			Ring() : data(new std::byte[RING_SIZE]) {}
+
+			bool push(const PacketLogRecord& _record, const std::byte* _packet)
+			{
+				size_t size = sizeof(PacketLogRecord) + _record.capturedSize;
+				size_t writePosition = this->head.load(std::memory_order_relaxed);
+				if(RING_SIZE - (writePosition - this->tail.load(std::memory_order_acquire)) < size)
+				{
+					return false;
+				}
+
+				this->copyIn(writePosition, &_record, sizeof(PacketLogRecord));
+				this->copyIn(writePosition + sizeof(PacketLogRecord), _packet, _record.capturedSize);
+				// Publishes the whole record at once, the drain thread never sees half of one
+				this->head.store(writePosition + size, std::memory_order_release);
+				return true;
+			}
+
+			void copyIn(size_t _position, const void* _source, size_t _size)
+			{
+				if(_size == 0)
+				{
+					return;
+				}
+
+				size_t offset = _position & (RING_SIZE - 1);
+				size_t first = std::min(_size, RING_SIZE - offset);
+				std::memcpy(this->data.get() + offset, _source, first);
+				std::memcpy(this->data.get(), static_cast<const std::byte*>(_source) + first, _size - first);
+			}
+
+			// Writes every published record to _file, returns the bytes written
+			size_t drainTo(std::ofstream& _file)
+			{
+				size_t readPosition = this->tail.load(std::memory_order_relaxed);
+				size_t writePosition = this->head.load(std::memory_order_acquire);
+				size_t size = writePosition - readPosition;
+				if(size == 0)
+				{
+					return 0;
+				}
+
+				size_t offset = readPosition & (RING_SIZE - 1);
+				size_t first = std::min(size, RING_SIZE - offset);
+				_file.write(reinterpret_cast<const char*>(this->data.get() + offset), static_cast<std::streamsize>(first));
+				_file.write(reinterpret_cast<const char*>(this->data.get()), static_cast<std::streamsize>(size - first));
+
+				this->tail.store(writePosition, std::memory_order_release);
+				return size;
+			}
+
+			void count(std::atomic<size_t>& _counter)
+			{
+				_counter.store(_counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			}
+
+			void addTo(PacketLoggerStats& _stats) const
+			{
+				_stats.recorded += this->recorded.load(std::memory_order_relaxed);
+				_stats.dropped += this->dropped.load(std::memory_order_relaxed);
+				_stats.sampledOut += this->sampledOut.load(std::memory_order_relaxed);
+			}
+
+			std::unique_ptr<std::byte[]> data;
+			// Kept on separate cache lines, they're written by different threads
+			alignas(64) std::atomic<size_t> head = 0;
+			alignas(64) std::atomic<size_t> tail = 0;
+			// Only touched by the owning thread
+			alignas(64) uint32_t sampleCounter = 0;
+			std::atomic<size_t> recorded = 0;
+			std::atomic<size_t> dropped = 0;
+			std::atomic<size_t> sampledOut = 0;
+			// The owning thread has exited, the ring goes once it's drained
+			std::atomic<bool> retired = false;
+		};
+
+		// Registers the thread's ring on first use and retires it on thread exit
+		struct RingHandle
+		{
+			RingHandle() : ring(std::make_shared<Ring>())
+			{
+				SharedState& shared = sharedState();
+				std::lock_guard<std::mutex> lock(shared.ringsMutex);
+				shared.rings.push_back(this->ring);
+			}
+
+			~RingHandle() { this->ring->retired.store(true, std::memory_order_release); }
+
+			std::shared_ptr<Ring> ring;
+		};
+
+		struct SharedState
+		{
+			std::atomic<PacketLogLevel> level = PacketLogLevel::Off;
+			std::atomic<uint32_t> sampleRate = 1;
+			std::atomic<size_t> bytesWritten = 0;
+
+			// Guards start/stop
+			std::mutex controlMutex;
+			std::thread drainThread;
+			std::ofstream file;
+
+			std::mutex drainMutex;
+			std::condition_variable drainCondition;
+			bool running = false;
+
+			std::mutex ringsMutex;
+			std::vector<std::shared_ptr<Ring>> rings;
+			PacketLoggerStats retiredStats;
+		};
+
+		// Never destroyed so threads can still retire their rings during static destruction
+		static SharedState& sharedState()
+		{
+			static SharedState* state = new SharedState();
+			return *state;
+		}
+
+		static Ring& threadRing()
+		{
+			thread_local RingHandle handle;
+			return *handle.ring;
+		}
+
+		static void drainLoop()
+		{
+			SharedState& shared = sharedState();
+			std::unique_lock<std::mutex> lock(shared.drainMutex);
+			while(shared.running)
+			{
+				shared.drainCondition.wait_for(lock, DRAIN_INTERVAL);
+				lock.unlock();
+				drainAll();
+				lock.lock();
+			}
+		}
+
+		// Only ever called by one thread at a time: the drain thread, or stop() once it has joined
+		static void drainAll()
+		{
+			SharedState& shared = sharedState();
+
+			// Snapshot the rings so threads registering new ones don't wait for the disk
+			std::vector<std::shared_ptr<Ring>> rings;
+			{
+				std::lock_guard<std::mutex> lock(shared.ringsMutex);
+				rings = shared.rings;
+			}
+
+			size_t bytes = 0;
+			for(const std::shared_ptr<Ring>& ring : rings)
+			{
+				bytes += ring->drainTo(shared.file);
+			}
+
+			// Rings of exited threads have nothing more coming, drain what's left and let them go
+			{
+				std::lock_guard<std::mutex> lock(shared.ringsMutex);
+				std::erase_if(shared.rings, [&shared, &bytes](const std::shared_ptr<Ring>& _ring)
+				{
+					if(!_ring->retired.load(std::memory_order_acquire))
+					{
+						return false;
+					}
+					bytes += _ring->drainTo(shared.file);
+					_ring->addTo(shared.retiredStats);
+					return true;
+				});
+			}
+
+			shared.file.flush();
+			shared.bytesWritten.fetch_add(bytes, std::memory_order_relaxed);
+		}
+};
+
+#endif
@@ -0,0 +1,147 @@
+// C++
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Templates
+#include "concurrent_priority_queue.hpp"
+
+// Consts
+// Every run starts this full, so consumers have something to take from the first moment
+const size_t PREFILL = 4096;
+// Producers back off above this, so a run measures the queue and not a heap that only ever grows
+const size_t MAX_QUEUED = 1 << 16;
+
+// What threaded_input_loop used before ConcurrentPriorityQueue, one mutex around a std::priority_queue
+class MutexPriorityQueue
+{
+	public:
+		void push(int _value)
+		{
+			std::lock_guard<std::mutex> lock(this->m);
+			this->q.push(_value);
+		}
+
+		bool tryPop(int& _value)
+		{
+			std::lock_guard<std::mutex> lock(this->m);
+			if(this->q.empty())
+			{
+				return false;
+			}
+			_value = this->q.top();
+			this->q.pop();
+			return true;
+		}
+
+		size_t size()
+		{
+			std::lock_guard<std::mutex> lock(this->m);
+			return this->q.size();
+		}
+
+	private:
+		std::mutex m;
+		std::priority_queue<int> q;
+};
+
+// Runs _threads producers and _threads consumers against _queue for _seconds, returns pushes + pops per second
+template <typename Queue>
+double runBenchmark(Queue& _queue, size_t _threads, double _seconds)
+{
+	uint32_t seed = 12345;
+	for(size_t i = 0; i < PREFILL; ++i)
+	{
+		seed = seed * 1664525 + 1013904223;
+		_queue.push(static_cast<int>(seed >> 16));
+	}
+
+	std::atomic<bool> running = true;
+	std::atomic<size_t> operations = 0;
+	std::vector<std::thread> threads;
+	for(size_t i = 0; i < _threads; ++i)
+	{
+		threads.emplace_back([&_queue, &running, &operations, i]()
+		{
+			uint32_t seed = static_cast<uint32_t>(i) * 2654435761u + 1;
+			size_t pushes = 0;
+			while(running.load(std::memory_order_relaxed))
+			{
+				// Checking the size every push would make the baseline take its lock twice
+				if(pushes % 64 == 0 && _queue.size() > MAX_QUEUED)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+				seed = seed * 1664525 + 1013904223;
+				_queue.push(static_cast<int>(seed >> 16));
+				pushes++;
+			}
+			operations.fetch_add(pushes, std::memory_order_relaxed);
+		});
+		threads.emplace_back([&_queue, &running, &operations]()
+		{
+			size_t pops = 0;
+			int value;
+			while(running.load(std::memory_order_relaxed))
+			{
+				if(_queue.tryPop(value))
+				{
+					pops++;
+				}
+			}
+			operations.fetch_add(pops, std::memory_order_relaxed);
+		});
+	}
+
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	std::this_thread::sleep_for(std::chrono::duration<double>(_seconds));
+	running = false;
+	for(std::thread& thread : threads)
+	{
+		thread.join();
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+	return static_cast<double>(operations.load()) / elapsed.count();
+}
+
+int main(int argc, char* argv[])
+{
+	// Usage: priority_queue_benchmark [seconds per run] [max threads]
+	// Each run uses that many producers and as many consumers, so it wants twice as many cores to mean anything
+	double seconds = argc > 1 ? std::stod(argv[1]) : 1.0;
+	size_t maxThreads = argc > 2 ? std::stoul(argv[2]) : 8;
+
+	std::cout << "Hardware threads: " << std::thread::hardware_concurrency() << '\n';
+	std::cout << std::left << std::setw(20) << "producers/consumers"
+		<< std::right << std::setw(16) << "mutex ops/s"
+		<< std::setw(16) << "relaxed ops/s"
+		<< std::setw(16) << "strict ops/s" << '\n';
+
+	std::cout << std::fixed << std::setprecision(0);
+	for(size_t threads = 1; threads <= maxThreads; threads *= 2)
+	{
+		MutexPriorityQueue mutexQueue;
+		ConcurrentPriorityQueue<int> relaxedQueue(0, PriorityOrder::Relaxed);
+		ConcurrentPriorityQueue<int> strictQueue(0, PriorityOrder::Strict);
+
+		double mutexOps = runBenchmark(mutexQueue, threads, seconds);
+		double relaxedOps = runBenchmark(relaxedQueue, threads, seconds);
+		double strictOps = runBenchmark(strictQueue, threads, seconds);
+
+		std::cout << std::left << std::setw(20) << (std::to_string(threads) + "/" + std::to_string(threads))
+			<< std::right << std::setw(16) << mutexOps
+			<< std::setw(16) << relaxedOps
+			<< std::setw(16) << strictOps << '\n';
+	}
+
+	return 0;
+}
@@ -0,0 +1,180 @@
+// C++
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Templates
+#include "concurrent_priority_queue.hpp"
+
+// Consts
+const size_t PRODUCER_COUNTS[] = { 1, 8, 128 };
+
+// std::priority_queue keeps its heap in a protected member, reach it so batches can be merged in place
+class MergeablePriorityQueue : public std::priority_queue<int>
+{
+	public:
+		std::vector<int>& getContainer() { return this->c; }
+};
+
+// The single mutex and std::priority_queue threaded_input_loop started out with, timing how long its lock is held
+class TimedPriorityQueue
+{
+	public:
+		void push(int _value)
+		{
+			std::lock_guard<std::mutex> lock(this->m);
+			std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+			this->q.push(_value);
+			this->held += std::chrono::steady_clock::now() - begin;
+			this->acquisitions++;
+		}
+
+		// The batched path, one lock and the same heap merge as ConcurrentPriorityQueue::pushBulk per batch
+		void pushBulk(const std::vector<int>& _values)
+		{
+			std::lock_guard<std::mutex> lock(this->m);
+			std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+			appendToHeap(this->q.getContainer(), _values.begin(), _values.end());
+			this->held += std::chrono::steady_clock::now() - begin;
+			this->acquisitions++;
+		}
+
+		size_t getAcquisitions() const { return this->acquisitions; }
+		std::chrono::duration<double> getHeldTime() const { return this->held; }
+
+	private:
+		std::mutex m;
+		MergeablePriorityQueue q;
+		size_t acquisitions = 0;
+		std::chrono::duration<double> held = std::chrono::duration<double>(0);
+};
+
+// Starts _producers threads that each run _produce(thread index) and returns how long they all took
+template <typename Produce>
+double runProducers(size_t _producers, Produce&& _produce)
+{
+	std::atomic<bool> go = false;
+	std::vector<std::thread> threads;
+	for(size_t i = 0; i < _producers; ++i)
+	{
+		threads.emplace_back([&go, &_produce, i]()
+		{
+			while(!go.load(std::memory_order_acquire))
+			{
+				std::this_thread::yield();
+			}
+			_produce(i);
+		});
+	}
+
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	go = true;
+	for(std::thread& thread : threads)
+	{
+		thread.join();
+	}
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+int value(size_t _producer, size_t _index)
+{
+	return static_cast<int>((_producer * 2654435761u + _index * 40503u) & 0xFFFFFF);
+}
+
+int main(int argc, char* argv[])
+{
+	// Usage: producer_batch_benchmark [elements per producer] [batch size]
+	// Hold times include a clock read per acquisition, compare them with each other rather than as absolutes
+	size_t elements = argc > 1 ? std::stoul(argv[1]) : 10000;
+	size_t batchSize = argc > 2 ? std::stoul(argv[2]) : ConcurrentPriorityQueue<int>::Producer::DEFAULT_BATCH_SIZE;
+
+	std::cout << "Hardware threads: " << std::thread::hardware_concurrency() << ", elements per producer: " << elements << ", batch size: " << batchSize << '\n';
+	std::cout << std::left << std::setw(28) << "mutex + std::priority_queue" << std::right
+		<< std::setw(14) << "locks" << std::setw(14) << "held ms" << std::setw(14) << "ns per lock" << std::setw(16) << "elements/s" << '\n';
+
+	for(size_t producers : PRODUCER_COUNTS)
+	{
+		TimedPriorityQueue single;
+		double singleTime = runProducers(producers, [&single, elements](size_t _producer)
+		{
+			for(size_t i = 0; i < elements; ++i)
+			{
+				single.push(value(_producer, i));
+			}
+		});
+
+		TimedPriorityQueue batched;
+		double batchedTime = runProducers(producers, [&batched, elements, batchSize](size_t _producer)
+		{
+			std::vector<int> batch;
+			batch.reserve(batchSize);
+			for(size_t i = 0; i < elements; ++i)
+			{
+				batch.push_back(value(_producer, i));
+				if(batch.size() >= batchSize)
+				{
+					batched.pushBulk(batch);
+					batch.clear();
+				}
+			}
+			if(!batch.empty())
+			{
+				batched.pushBulk(batch);
+			}
+		});
+
+		double total = static_cast<double>(producers * elements);
+		for(int i = 0; i < 2; ++i)
+		{
+			TimedPriorityQueue& queue = i == 0 ? single : batched;
+			double seconds = i == 0 ? singleTime : batchedTime;
+			std::cout << std::left << std::setw(28) << (std::to_string(producers) + (i == 0 ? " producers, push" : " producers, batched"))
+				<< std::right << std::fixed << std::setprecision(0) << std::setw(14) << queue.getAcquisitions()
+				<< std::setprecision(2) << std::setw(14) << queue.getHeldTime().count() * 1000.0
+				<< std::setprecision(0) << std::setw(14) << queue.getHeldTime().count() * 1e9 / queue.getAcquisitions()
+				<< std::setw(16) << total / seconds << '\n';
+		}
+	}
+
+	std::cout << '\n' << std::left << std::setw(28) << "ConcurrentPriorityQueue" << std::right
+		<< std::setw(14) << "locks" << std::setw(16) << "elements/s" << '\n';
+	for(size_t producers : PRODUCER_COUNTS)
+	{
+		ConcurrentPriorityQueue<int> single;
+		double singleTime = runProducers(producers, [&single, elements](size_t _producer)
+		{
+			for(size_t i = 0; i < elements; ++i)
+			{
+				single.push(value(_producer, i));
+			}
+		});
+
+		ConcurrentPriorityQueue<int> batched;
+		double batchedTime = runProducers(producers, [&batched, elements, batchSize](size_t _producer)
+		{
+			ConcurrentPriorityQueue<int>::Producer producer(batched, batchSize);
+			for(size_t i = 0; i < elements; ++i)
+			{
+				producer.push(value(_producer, i));
+			}
+		});
+
+		double total = static_cast<double>(producers * elements);
+		size_t batchesPerProducer = (elements + batchSize - 1) / batchSize;
+		std::cout << std::fixed << std::setprecision(0);
+		std::cout << std::left << std::setw(28) << (std::to_string(producers) + " producers, push") << std::right
+			<< std::setw(14) << producers * elements << std::setw(16) << total / singleTime << '\n';
+		std::cout << std::left << std::setw(28) << (std::to_string(producers) + " producers, Producer") << std::right
+			<< std::setw(14) << producers * batchesPerProducer << std::setw(16) << total / batchedTime << '\n';
+	}
+
+	return 0;
+}
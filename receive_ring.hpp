@@ -0,0 +1,123 @@
+#ifndef RECEIVERING_H
+#define RECEIVERING_H
+
+// C++
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <span>
+
+// Boost
+#include <boost/asio/buffer.hpp>
+
+// Templates
+#include "buffer_pool.hpp"
+
+// A received message, only valid for the duration of the message handler it's passed to
+typedef std::span<const std::byte> MessageView;
+
+// Opt-in copy for messages that have to outlive the message handler, comes from the packet pool
+inline PacketBuffer copyMessage(MessageView _message) { return PacketBuffer::copyOf(_message.data(), _message.size()); }
+
+// Per-connection receive buffer. The socket reads straight into the free space at the back,
+// messages are handed out as views into the unread bytes at the front.
+// The storage itself comes from the packet pool, so connection churn doesn't hit malloc either.
+// Unread bytes are always contiguous: instead of wrapping around, the (usually tiny) partial message
+// left over at the end of a read is moved back to the front when we run out of room.
+class ReceiveRing
+{
+	public:
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		ReceiveRing() : ReceiveRing(8192) {}
+
+		// Parameterized constructors
+		explicit ReceiveRing(size_t _capacity) : buffer(PacketBuffer::allocate(_capacity)), capacity(buffer.capacity()) {}
+
+		// Views into the ring would dangle, don't copy it
+		ReceiveRing(const ReceiveRing& other) = delete;
+		ReceiveRing& operator=(const ReceiveRing& other) = delete;
+
+		// Destructor
+		~ReceiveRing() {}
+
+		/*****************
+		 * Ring Functions
+		 ****************/
+		// Free space for the next socket read, at least _size bytes
+		boost::asio::mutable_buffer prepare(size_t _size)
+		{
+			if(this->capacity - this->writePosition < _size)
+			{
+				this->compact();
+			}
+
+			if(this->capacity - this->writePosition < _size)
+			{
+				this->grow(this->size() + _size);
+			}
+
+			return boost::asio::buffer(this->buffer.data() + this->writePosition, this->capacity - this->writePosition);
+		}
+
+		// Make _size bytes written into prepare() readable
+		void commit(size_t _size)
+		{
+			this->writePosition += std::min(_size, this->capacity - this->writePosition);
+		}
+
+		// Release _size bytes from the front, any views into them are invalidated
+		void consume(size_t _size)
+		{
+			this->readPosition += std::min(_size, this->size());
+
+			// Rewinding an empty ring is free and saves a compaction later
+			if(this->readPosition == this->writePosition)
+			{
+				this->readPosition = 0;
+				this->writePosition = 0;
+			}
+		}
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		MessageView data() const { return MessageView(this->buffer.data() + this->readPosition, this->size()); }
+		// For transforming unread bytes in place, e.g. decryption
+		std::span<std::byte> mutableData() { return std::span<std::byte>(this->buffer.data() + this->readPosition, this->size()); }
+		size_t size() const { return this->writePosition - this->readPosition; }
+		size_t getCapacity() const { return this->capacity; }
+
+	private:
+		void compact()
+		{
+			if(this->readPosition == 0)
+			{
+				return;
+			}
+
+			std::memmove(this->buffer.data(), this->buffer.data() + this->readPosition, this->size());
+			this->writePosition -= this->readPosition;
+			this->readPosition = 0;
+		}
+
+		void grow(size_t _minimumCapacity)
+		{
+			PacketBuffer newBuffer = PacketBuffer::allocate(std::max(this->capacity * 2, _minimumCapacity));
+			std::memcpy(newBuffer.data(), this->buffer.data() + this->readPosition, this->size());
+
+			this->writePosition = this->size();
+			this->readPosition = 0;
+			this->buffer = std::move(newBuffer);
+			this->capacity = this->buffer.capacity();
+		}
+
+		PacketBuffer buffer;
+		size_t capacity = 0;
+		size_t readPosition = 0;
+		size_t writePosition = 0;
+};
+
+#endif
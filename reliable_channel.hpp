@@ -0,0 +1,553 @@
+#ifndef RELIABLECHANNEL_H
+#define RELIABLECHANNEL_H
+
+// C++
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <utility>
+#include <vector>
+
+// Templates
+#include "buffer_pool.hpp"
+
+enum class ChannelMode : uint8_t
+{
+	// Resent until acked, handed over strictly in send order. A loss only holds up its own channel
+	ReliableOrdered,
+	// Resent until acked, handed over as soon as it arrives, duplicates filtered out
+	ReliableUnordered,
+	// Never resent, anything older than the newest message already handed over is dropped
+	UnreliableSequenced
+};
+
+struct ReliableConnectionStats
+{
+	size_t packetsSent = 0;
+	size_t packetsReceived = 0;
+	// Sent only because there was nothing to piggyback the ack on
+	size_t acksSent = 0;
+	size_t retransmits = 0;
+	size_t messagesSent = 0;
+	size_t messagesDelivered = 0;
+	// Already delivered, arrived again after a resend
+	size_t duplicates = 0;
+	// Unreliable messages that lost the race to a newer one
+	size_t stale = 0;
+	// Too short or for a channel that doesn't exist
+	size_t invalid = 0;
+};
+
+// A lightweight reliability layer for one UDP peer, modelled on the classic game networking scheme:
+// every datagram carries a packet sequence number plus an ack of the newest packet received and a
+// bitfield of the 32 before it, so every packet acks up to 33 others and lost acks rarely matter.
+// Reliable messages are resent when their retransmission timeout runs out, the timeout follows
+// the measured round trip time (RFC 6298 smoothing) and backs off per resend.
+// Each datagram holds one message:
+//   packet sequence (2) | ack (2) | ack bits (4) | flags and channel (1) | message sequence (2) | payload
+// all little endian. The top bit of the channel byte says the ack fields are valid.
+// Transport agnostic: datagrams come in through receive() and go out through getOutgoing(),
+// the owner moves them onto its socket. Not thread safe, keep each connection on one thread.
+class ReliableConnection
+{
+	public:
+		static constexpr size_t HEADER_SIZE = 11;
+		static constexpr size_t MAX_CHANNELS = 16;
+		// Reliable messages in flight per channel, send() refuses more until some are acked. A power of two
+		static constexpr size_t WINDOW_SIZE = 1024;
+		// Sent packets remembered for acks and round trip samples. A power of two
+		static constexpr size_t SENT_PACKET_HISTORY = 1024;
+		static constexpr std::chrono::nanoseconds INITIAL_TIMEOUT = std::chrono::milliseconds(200);
+		static constexpr std::chrono::nanoseconds MIN_TIMEOUT = std::chrono::milliseconds(10);
+		static constexpr std::chrono::nanoseconds MAX_TIMEOUT = std::chrono::seconds(2);
+
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		ReliableConnection() = delete;
+
+		// Parameterized constructors
+		// Channel i runs _modes[i]. No datagram will be bigger than _maxDatagramSize
+		ReliableConnection(std::span<const ChannelMode> _modes, size_t _maxDatagramSize)
+			: maxPayloadSize(_maxDatagramSize > HEADER_SIZE ? _maxDatagramSize - HEADER_SIZE : 0),
+			  sentPackets(SENT_PACKET_HISTORY)
+		{
+			size_t count = std::min(_modes.size(), MAX_CHANNELS);
+			this->channels.reserve(count);
+			for(size_t i = 0; i < count; ++i)
+			{
+				this->channels.emplace_back(_modes[i]);
+			}
+		}
+
+		/*****************
+		 * Channel Functions
+		 ****************/
+		// Queues _message as one datagram. Returns false if the channel doesn't exist, the message is
+		// too big for one datagram or the channel already has WINDOW_SIZE reliable messages in flight
+		bool send(uint8_t _channel, std::span<const std::byte> _message, std::chrono::steady_clock::time_point _now)
+		{
+			if(_channel >= this->channels.size() || _message.size() > this->maxPayloadSize)
+			{
+				return false;
+			}
+
+			Channel& channel = this->channels[_channel];
+			uint16_t messageSequence = channel.nextSendSequence;
+			if(channel.mode != ChannelMode::UnreliableSequenced && static_cast<uint16_t>(messageSequence - channel.oldestUnacked) >= WINDOW_SIZE)
+			{
+				return false;
+			}
+			channel.nextSendSequence++;
+			this->stats.messagesSent++;
+
+			PacketBuffer datagram = PacketBuffer::allocate(HEADER_SIZE + _message.size());
+			std::byte* header = datagram.data();
+			writeUint16(header + 9, messageSequence);
+			std::memcpy(header + HEADER_SIZE, _message.data(), _message.size());
+
+			if(channel.mode == ChannelMode::UnreliableSequenced)
+			{
+				this->transmit(datagram, _channel, messageSequence, _now);
+				return true;
+			}
+
+			PendingMessage& pending = channel.sendWindow[messageSequence & (WINDOW_SIZE - 1)];
+			pending.datagram = std::move(datagram);
+			pending.sequence = messageSequence;
+			pending.timeout = this->getTimeout();
+			pending.inUse = true;
+			this->transmit(pending.datagram, _channel, messageSequence, _now);
+			pending.lastSent = _now;
+			this->nextResendCheck = std::min(this->nextResendCheck, _now + pending.timeout);
+			return true;
+		}
+
+		// Processes one datagram from the peer. _deliver(uint8_t channel, std::span<const std::byte> message)
+		// is called for every message it makes deliverable, the span is only valid for that call
+		template <typename Deliver>
+		void receive(std::span<const std::byte> _datagram, std::chrono::steady_clock::time_point _now, Deliver&& _deliver)
+		{
+			if(_datagram.size() < HEADER_SIZE)
+			{
+				this->stats.invalid++;
+				return;
+			}
+
+			const std::byte* header = _datagram.data();
+			uint16_t packetSequence = readUint16(header);
+			uint8_t channelIndex = static_cast<uint8_t>(header[8]) & CHANNEL_MASK;
+			if(channelIndex != ACK_ONLY && channelIndex >= this->channels.size())
+			{
+				this->stats.invalid++;
+				return;
+			}
+			this->stats.packetsReceived++;
+
+			if(static_cast<uint8_t>(header[8]) & HAS_ACKS)
+			{
+				this->processAcks(readUint16(header + 2), readUint32(header + 4), _now);
+			}
+			if(channelIndex == ACK_ONLY)
+			{
+				return;
+			}
+
+			// Acked whether or not it's a duplicate, the first ack may have been the one that got lost
+			this->ackPending = true;
+			if(!this->recordReceived(packetSequence))
+			{
+				this->stats.duplicates++;
+				return;
+			}
+
+			uint16_t messageSequence = readUint16(header + 9);
+			std::span<const std::byte> message = _datagram.subspan(HEADER_SIZE);
+			Channel& channel = this->channels[channelIndex];
+			switch(channel.mode)
+			{
+				case ChannelMode::ReliableOrdered:
+					this->receiveOrdered(channel, channelIndex, messageSequence, message, _deliver);
+					break;
+				case ChannelMode::ReliableUnordered:
+					this->receiveUnordered(channel, channelIndex, messageSequence, message, _deliver);
+					break;
+				case ChannelMode::UnreliableSequenced:
+					if(channel.receivedAny && !sequenceGreater(messageSequence, channel.nextReceiveSequence))
+					{
+						this->stats.stale++;
+						break;
+					}
+					// nextReceiveSequence holds the newest delivered on this channel
+					channel.receivedAny = true;
+					channel.nextReceiveSequence = messageSequence;
+					this->deliver(channelIndex, message, _deliver);
+					break;
+			}
+		}
+
+		// Resends reliable messages whose timeout ran out and acks anything received since the last
+		// outgoing packet. Call it after every receive() and on a short timer
+		void update(std::chrono::steady_clock::time_point _now)
+		{
+			if(_now >= this->nextResendCheck)
+			{
+				this->resendExpired(_now);
+			}
+
+			if(this->ackPending)
+			{
+				PacketBuffer ack = PacketBuffer::allocate(HEADER_SIZE);
+				writeUint16(ack.data() + 9, 0);
+				this->transmit(ack, ACK_ONLY, 0, _now);
+				this->stats.acksSent++;
+			}
+		}
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		// Datagrams waiting for the socket, the owner sends them in order and clears the vector
+		std::vector<PacketBuffer>& getOutgoing() { return this->outgoing; }
+		const ReliableConnectionStats& getStats() const { return this->stats; }
+		size_t getChannelCount() const { return this->channels.size(); }
+		size_t getMaxMessageSize() const { return this->maxPayloadSize; }
+		std::chrono::nanoseconds getRoundTripTime() const { return std::chrono::nanoseconds(static_cast<int64_t>(this->smoothedRoundTrip)); }
+
+		// Current retransmission timeout for new messages
+		std::chrono::nanoseconds getTimeout() const
+		{
+			if(!this->roundTripMeasured)
+			{
+				return INITIAL_TIMEOUT;
+			}
+			std::chrono::nanoseconds timeout(static_cast<int64_t>(this->smoothedRoundTrip + 4 * this->roundTripVariance));
+			return std::clamp(timeout, MIN_TIMEOUT, MAX_TIMEOUT);
+		}
+
+		// True if _a is newer than _b, allowing for wrap around
+		static bool sequenceGreater(uint16_t _a, uint16_t _b) { return _a != _b && static_cast<uint16_t>(_a - _b) < 0x8000; }
+
+	private:
+		// Channel byte of a packet that only carries acks
+		static constexpr uint8_t ACK_ONLY = 0x7F;
+		static constexpr uint8_t CHANNEL_MASK = 0x7F;
+		// Set once we've heard from the peer, until then there's nothing to ack
+		static constexpr uint8_t HAS_ACKS = 0x80;
+
+		struct PendingMessage
+		{
+			// Header and payload, the header's packet fields are rewritten on every resend
+			PacketBuffer datagram;
+			std::chrono::steady_clock::time_point lastSent;
+			std::chrono::nanoseconds timeout = INITIAL_TIMEOUT;
+			uint16_t sequence = 0;
+			bool inUse = false;
+		};
+
+		struct ReceivedMessage
+		{
+			// Payload of an ordered message that arrived early
+			PacketBuffer payload;
+			uint16_t sequence = 0;
+			bool present = false;
+		};
+
+		struct Channel
+		{
+			explicit Channel(ChannelMode _mode) : mode(_mode)
+			{
+				if(_mode != ChannelMode::UnreliableSequenced)
+				{
+					this->sendWindow.resize(WINDOW_SIZE);
+					this->receiveWindow.resize(WINDOW_SIZE);
+				}
+			}
+
+			ChannelMode mode;
+			uint16_t nextSendSequence = 0;
+			uint16_t oldestUnacked = 0;
+			std::vector<PendingMessage> sendWindow;
+			// Next message to deliver, for unreliable channels the newest one delivered
+			uint16_t nextReceiveSequence = 0;
+			bool receivedAny = false;
+			std::vector<ReceivedMessage> receiveWindow;
+		};
+
+		struct SentPacket
+		{
+			std::chrono::steady_clock::time_point sentAt;
+			uint16_t sequence = 0;
+			uint16_t messageSequence = 0;
+			uint8_t channel = ACK_ONLY;
+			bool pending = false;
+		};
+
+		// Stamps the packet fields into _datagram's header and queues it. A datagram still referenced by
+		// an earlier send is copied first so the bytes already queued don't change underneath the socket
+		void transmit(PacketBuffer& _datagram, uint8_t _channel, uint16_t _messageSequence, std::chrono::steady_clock::time_point _now)
+		{
+			if(_datagram.useCount() > 1)
+			{
+				_datagram = PacketBuffer::copyOf(_datagram.data(), _datagram.size());
+			}
+
+			uint16_t packetSequence = this->nextPacketSequence++;
+			std::byte* header = _datagram.data();
+			writeUint16(header, packetSequence);
+			writeUint16(header + 2, this->remoteSequence);
+			writeUint32(header + 4, this->remoteAckBits);
+			header[8] = static_cast<std::byte>(_channel | (this->receivedAnyPacket ? HAS_ACKS : 0));
+			this->ackPending = false;
+
+			SentPacket& sent = this->sentPackets[packetSequence & (SENT_PACKET_HISTORY - 1)];
+			sent.sentAt = _now;
+			sent.sequence = packetSequence;
+			sent.messageSequence = _messageSequence;
+			sent.channel = _channel;
+			sent.pending = true;
+
+			this->outgoing.push_back(_datagram);
+			this->stats.packetsSent++;
+		}
+
+		void processAcks(uint16_t _ack, uint32_t _ackBits, std::chrono::steady_clock::time_point _now)
+		{
+			this->processAck(_ack, _now);
+			for(uint16_t i = 0; i < 32; ++i)
+			{
+				if(_ackBits & (uint32_t(1) << i))
+				{
+					this->processAck(static_cast<uint16_t>(_ack - 1 - i), _now);
+				}
+			}
+		}
+
+		void processAck(uint16_t _sequence, std::chrono::steady_clock::time_point _now)
+		{
+			SentPacket& sent = this->sentPackets[_sequence & (SENT_PACKET_HISTORY - 1)];
+			if(!sent.pending || sent.sequence != _sequence)
+			{
+				return;
+			}
+			sent.pending = false;
+
+			// Every resend is a new packet, so each sample is unambiguous
+			this->sampleRoundTrip(static_cast<double>((_now - sent.sentAt).count()));
+
+			if(sent.channel == ACK_ONLY || this->channels[sent.channel].mode == ChannelMode::UnreliableSequenced)
+			{
+				return;
+			}
+
+			Channel& channel = this->channels[sent.channel];
+			PendingMessage& pending = channel.sendWindow[sent.messageSequence & (WINDOW_SIZE - 1)];
+			if(!pending.inUse || pending.sequence != sent.messageSequence)
+			{
+				return;
+			}
+			pending.inUse = false;
+			pending.datagram.reset();
+
+			while(channel.oldestUnacked != channel.nextSendSequence && !channel.sendWindow[channel.oldestUnacked & (WINDOW_SIZE - 1)].inUse)
+			{
+				channel.oldestUnacked++;
+			}
+		}
+
+		void sampleRoundTrip(double _roundTrip)
+		{
+			if(!this->roundTripMeasured)
+			{
+				this->smoothedRoundTrip = _roundTrip;
+				this->roundTripVariance = _roundTrip / 2;
+				this->roundTripMeasured = true;
+				return;
+			}
+			this->roundTripVariance = 0.75 * this->roundTripVariance + 0.25 * std::abs(this->smoothedRoundTrip - _roundTrip);
+			this->smoothedRoundTrip = 0.875 * this->smoothedRoundTrip + 0.125 * _roundTrip;
+		}
+
+		// Remembers _sequence for the ack bits we send back, returns false if it was already received
+		bool recordReceived(uint16_t _sequence)
+		{
+			if(!this->receivedAnyPacket)
+			{
+				this->receivedAnyPacket = true;
+				this->remoteSequence = _sequence;
+				this->remoteAckBits = 0;
+				return true;
+			}
+
+			if(sequenceGreater(_sequence, this->remoteSequence))
+			{
+				// The old newest becomes bit (distance - 1)
+				uint64_t distance = static_cast<uint16_t>(_sequence - this->remoteSequence);
+				uint64_t bits = distance > 32 ? 0 : ((uint64_t(this->remoteAckBits) << distance) | (uint64_t(1) << (distance - 1)));
+				this->remoteAckBits = static_cast<uint32_t>(bits);
+				this->remoteSequence = _sequence;
+				return true;
+			}
+
+			uint16_t distance = static_cast<uint16_t>(this->remoteSequence - _sequence);
+			if(distance == 0)
+			{
+				return false;
+			}
+			if(distance > 32)
+			{
+				// Too old to track, the message sequence decides whether it's a duplicate
+				return true;
+			}
+			uint32_t bit = uint32_t(1) << (distance - 1);
+			if(this->remoteAckBits & bit)
+			{
+				return false;
+			}
+			this->remoteAckBits |= bit;
+			return true;
+		}
+
+		template <typename Deliver>
+		void receiveOrdered(Channel& _channel, uint8_t _channelIndex, uint16_t _sequence, std::span<const std::byte> _message, Deliver& _deliver)
+		{
+			if(_sequence == _channel.nextReceiveSequence)
+			{
+				this->deliver(_channelIndex, _message, _deliver);
+				_channel.nextReceiveSequence++;
+
+				// Hand over everything that was waiting on this one
+				ReceivedMessage* next = &_channel.receiveWindow[_channel.nextReceiveSequence & (WINDOW_SIZE - 1)];
+				while(next->present && next->sequence == _channel.nextReceiveSequence)
+				{
+					PacketBuffer payload = std::move(next->payload);
+					next->present = false;
+					this->deliver(_channelIndex, payload.view(), _deliver);
+					_channel.nextReceiveSequence++;
+					next = &_channel.receiveWindow[_channel.nextReceiveSequence & (WINDOW_SIZE - 1)];
+				}
+				return;
+			}
+
+			if(!sequenceGreater(_sequence, _channel.nextReceiveSequence) || static_cast<uint16_t>(_sequence - _channel.nextReceiveSequence) >= WINDOW_SIZE)
+			{
+				this->stats.duplicates++;
+				return;
+			}
+
+			ReceivedMessage& early = _channel.receiveWindow[_sequence & (WINDOW_SIZE - 1)];
+			if(early.present && early.sequence == _sequence)
+			{
+				this->stats.duplicates++;
+				return;
+			}
+			early.payload = PacketBuffer::copyOf(_message.data(), _message.size());
+			early.sequence = _sequence;
+			early.present = true;
+		}
+
+		template <typename Deliver>
+		void receiveUnordered(Channel& _channel, uint8_t _channelIndex, uint16_t _sequence, std::span<const std::byte> _message, Deliver& _deliver)
+		{
+			// Everything before nextReceiveSequence has been delivered, the window marks what arrived past it
+			if(!sequenceGreater(_sequence, static_cast<uint16_t>(_channel.nextReceiveSequence - 1)) || static_cast<uint16_t>(_sequence - _channel.nextReceiveSequence) >= WINDOW_SIZE)
+			{
+				this->stats.duplicates++;
+				return;
+			}
+
+			ReceivedMessage& received = _channel.receiveWindow[_sequence & (WINDOW_SIZE - 1)];
+			if(received.present && received.sequence == _sequence)
+			{
+				this->stats.duplicates++;
+				return;
+			}
+			received.sequence = _sequence;
+			received.present = true;
+			this->deliver(_channelIndex, _message, _deliver);
+
+			ReceivedMessage* next = &_channel.receiveWindow[_channel.nextReceiveSequence & (WINDOW_SIZE - 1)];
+			while(next->present && next->sequence == _channel.nextReceiveSequence)
+			{
+				next->present = false;
+				_channel.nextReceiveSequence++;
+				next = &_channel.receiveWindow[_channel.nextReceiveSequence & (WINDOW_SIZE - 1)];
+			}
+		}
+
+		template <typename Deliver>
+		void deliver(uint8_t _channelIndex, std::span<const std::byte> _message, Deliver& _deliver)
+		{
+			this->stats.messagesDelivered++;
+			_deliver(_channelIndex, _message);
+		}
+
+		void resendExpired(std::chrono::steady_clock::time_point _now)
+		{
+			this->nextResendCheck = std::chrono::steady_clock::time_point::max();
+			for(size_t i = 0; i < this->channels.size(); ++i)
+			{
+				Channel& channel = this->channels[i];
+				if(channel.mode == ChannelMode::UnreliableSequenced)
+				{
+					continue;
+				}
+
+				for(uint16_t sequence = channel.oldestUnacked; sequence != channel.nextSendSequence; ++sequence)
+				{
+					PendingMessage& pending = channel.sendWindow[sequence & (WINDOW_SIZE - 1)];
+					if(!pending.inUse)
+					{
+						continue;
+					}
+					if(_now - pending.lastSent >= pending.timeout)
+					{
+						this->transmit(pending.datagram, static_cast<uint8_t>(i), sequence, _now);
+						pending.lastSent = _now;
+						pending.timeout = std::min(pending.timeout * 2, MAX_TIMEOUT);
+						this->stats.retransmits++;
+					}
+					this->nextResendCheck = std::min(this->nextResendCheck, pending.lastSent + pending.timeout);
+				}
+			}
+		}
+
+		static void writeUint16(std::byte* _out, uint16_t _value)
+		{
+			_out[0] = static_cast<std::byte>(_value);
+			_out[1] = static_cast<std::byte>(_value >> 8);
+		}
+
+		static void writeUint32(std::byte* _out, uint32_t _value)
+		{
+			writeUint16(_out, static_cast<uint16_t>(_value));
+			writeUint16(_out + 2, static_cast<uint16_t>(_value >> 16));
+		}
+
+		static uint16_t readUint16(const std::byte* _in) { return static_cast<uint16_t>(std::to_integer<uint16_t>(_in[0]) | (std::to_integer<uint16_t>(_in[1]) << 8)); }
+		static uint32_t readUint32(const std::byte* _in) { return readUint16(_in) | (uint32_t(readUint16(_in + 2)) << 16); }
+
+		size_t maxPayloadSize;
+		std::vector<Channel> channels;
+		std::vector<SentPacket> sentPackets;
+		std::vector<PacketBuffer> outgoing;
+		uint16_t nextPacketSequence = 0;
+		// Newest packet received from the peer and which of the 32 before it arrived
+		uint16_t remoteSequence = 0;
+		uint32_t remoteAckBits = 0;
+		bool receivedAnyPacket = false;
+		// Something arrived that no outgoing packet has acked yet
+		bool ackPending = false;
+		double smoothedRoundTrip = 0;
+		double roundTripVariance = 0;
+		bool roundTripMeasured = false;
+		std::chrono::steady_clock::time_point nextResendCheck = std::chrono::steady_clock::time_point::max();
+		ReliableConnectionStats stats;
+};
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef SESSIONTASK_H
+#define SESSIONTASK_H
+
+// C++
+#include <coroutine>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <utility>
+
+// Boost
+#include <boost/asio.hpp>
+
+// Templates
+#include "buffer_pool.hpp"
+#include "receive_ring.hpp"
+
+template <typename T = void>
+class SessionTask;
+
+// What a session gets back from co_await readFrame().
+// message is only valid until the session's next readFrame(), use copyMessage() to keep it
+struct SessionRead
+{
+	boost::system::error_code error;
+	MessageView message;
+
+	explicit operator bool() const { return !this->error; }
+};
+
+// Shared by every SessionTask promise.
+// Frames come from the packet pool's size classes, so starting a session per connection doesn't hit malloc
+class SessionPromiseBase
+{
+	public:
+		/*****************
+		 * Memory Functions
+		 ****************/
+		static void* operator new(size_t _size) { return BufferPool::allocate(_size)->data(); }
+		static void operator delete(void* _pointer) { BufferPool::release(reinterpret_cast<PacketBlock*>(_pointer) - 1); }
+
+		/*****************
+		 * Coroutine Functions
+		 ****************/
+		// Tasks are lazy, nothing runs until they're awaited or spawned
+		std::suspend_always initial_suspend() noexcept { return {}; }
+
+		// Hands control straight back to whoever awaited us, without growing the stack
+		struct FinalAwaiter
+		{
+			bool await_ready() const noexcept { return false; }
+
+			template <typename Promise>
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> _coroutine) noexcept
+			{
+				SessionPromiseBase& promise = _coroutine.promise();
+				if(promise.continuation)
+				{
+					return promise.continuation;
+				}
+
+				// Nobody owns a spawned session, it cleans up after itself
+				if(promise.detached)
+				{
+					if(promise.exception)
+					{
+						try
+						{
+							std::rethrow_exception(promise.exception);
+						}
+						catch(const std::exception& _error)
+						{
+							std::cout << "Error: " << _error.what() << '\n';
+						}
+					}
+					_coroutine.destroy();
+				}
+				return std::noop_coroutine();
+			}
+
+			void await_resume() const noexcept {}
+		};
+
+		FinalAwaiter final_suspend() noexcept { return {}; }
+		void unhandled_exception() { this->exception = std::current_exception(); }
+
+		std::coroutine_handle<> continuation;
+		std::exception_ptr exception;
+		bool detached = false;
+};
+
+template <typename T>
+class SessionPromise : public SessionPromiseBase
+{
+	public:
+		SessionTask<T> get_return_object();
+		void return_value(T _value) { this->value = std::move(_value); }
+
+		T getResult()
+		{
+			if(this->exception)
+			{
+				std::rethrow_exception(this->exception);
+			}
+			return std::move(*this->value);
+		}
+
+	private:
+		std::optional<T> value;
+};
+
+template <>
+class SessionPromise<void> : public SessionPromiseBase
+{
+	public:
+		SessionTask<void> get_return_object();
+		void return_void() {}
+
+		void getResult()
+		{
+			if(this->exception)
+			{
+				std::rethrow_exception(this->exception);
+			}
+		}
+};
+
+// A coroutine a connection runs its session in, and the return type of any helper coroutine it awaits.
+// Nothing here is bound by shared_from_this(), the session holds the connection once for its whole life
+// instead of every read and write copying a shared_ptr
+template <typename T>
+class SessionTask
+{
+	public:
+		typedef SessionPromise<T> promise_type;
+		typedef std::coroutine_handle<promise_type> Handle;
+
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		SessionTask() = delete;
+
+		// Parameterized constructors
+		explicit SessionTask(Handle _coroutine) : coroutine(_coroutine) {}
+
+		// A task owns its frame, move it, don't copy it
+		SessionTask(const SessionTask& other) = delete;
+		SessionTask& operator=(const SessionTask& other) = delete;
+		SessionTask(SessionTask&& other) noexcept : coroutine(std::exchange(other.coroutine, nullptr)) {}
+
+		// Destructor
+		~SessionTask()
+		{
+			if(this->coroutine)
+			{
+				this->coroutine.destroy();
+			}
+		}
+
+		/*****************
+		 * Overloaded Operators
+		 ****************/
+		// co_await a task to run it to completion, its result or exception comes back to the awaiter
+		auto operator co_await() && noexcept
+		{
+			struct Awaiter
+			{
+				Handle coroutine;
+
+				bool await_ready() const noexcept { return false; }
+
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<> _awaiting) noexcept
+				{
+					this->coroutine.promise().continuation = _awaiting;
+					return this->coroutine;
+				}
+
+				T await_resume() { return this->coroutine.promise().getResult(); }
+			};
+			return Awaiter { this->coroutine };
+		}
+
+		/*****************
+		 * Task Functions
+		 ****************/
+		// Gives up ownership, a detached frame destroys itself once it finishes
+		Handle release()
+		{
+			this->coroutine.promise().detached = true;
+			return std::exchange(this->coroutine, nullptr);
+		}
+
+	private:
+		Handle coroutine;
+};
+
+template <typename T>
+inline SessionTask<T> SessionPromise<T>::get_return_object() { return SessionTask<T>(SessionTask<T>::Handle::from_promise(*this)); }
+
+inline SessionTask<void> SessionPromise<void>::get_return_object() { return SessionTask<void>(SessionTask<void>::Handle::from_promise(*this)); }
+
+// Runs _session on _executor until its first suspension and lets it finish on its own
+template <typename Executor>
+inline void spawnSession(const Executor& _executor, SessionTask<void> _session)
+{
+	std::coroutine_handle<> coroutine = _session.release();
+	boost::asio::dispatch(_executor, [coroutine]() { coroutine.resume(); });
+}
+
+// co_await connection.readFrame(). Completes without suspending when a whole frame is already buffered
+template <typename Connection>
+class ReadFrameAwaiter
+{
+	public:
+		explicit ReadFrameAwaiter(Connection& _connection) : connection(_connection) {}
+
+		bool await_ready() { return this->connection.pollFrame(this->result); }
+		void await_suspend(std::coroutine_handle<> _coroutine) { this->connection.readFrameAsync(_coroutine, this->result); }
+		SessionRead await_resume() const { return this->result; }
+
+	private:
+		Connection& connection;
+		SessionRead result;
+};
+
+// co_await connection.asyncSend(). Completes once every queued packet, the new one included, is on the wire
+template <typename Connection>
+class SendAwaiter
+{
+	public:
+		explicit SendAwaiter(Connection& _connection) : connection(_connection) {}
+
+		bool await_ready() { return this->connection.pollWrites(this->error); }
+		void await_suspend(std::coroutine_handle<> _coroutine) { this->connection.waitForWrites(_coroutine, this->error); }
+		boost::system::error_code await_resume() const { return this->error; }
+
+	private:
+		Connection& connection;
+		boost::system::error_code error;
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef SUBMISSIONQUEUE_H
+#define SUBMISSIONQUEUE_H
+
+// C++
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+// Templates
+#include "buffer_pool.hpp"
+
+// Lock-free multiple producer, single consumer queue for handing work to an IO thread.
+// Producers push onto an atomic list head with a single CAS. The consumer swaps the whole list out
+// at once and drains it in push order, so a burst of sends costs it one atomic exchange.
+// push() reports when the queue went from empty to non-empty, that producer (and only that one)
+// posts a wakeup to the consumer, so a burst of sends costs one post no matter how many threads took part.
+// Nodes come from the packet pool's per-thread caches, producers don't touch malloc or a lock in steady state.
+template <typename T>
+class SubmissionQueue
+{
+	public:
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		SubmissionQueue() = default;
+
+		// Producers hold on to the queue's address, don't copy it
+		SubmissionQueue(const SubmissionQueue& other) = delete;
+		SubmissionQueue& operator=(const SubmissionQueue& other) = delete;
+
+		// Destructor
+		~SubmissionQueue()
+		{
+			this->drain([](T&& _value) {});
+		}
+
+		/*****************
+		 * Queue Functions
+		 ****************/
+		// Safe from any thread. Returns true when the queue was empty, the caller then owes the consumer a wakeup
+		bool push(T _value)
+		{
+			Node* node = new (BufferPool::allocate(sizeof(Node))->data()) Node { nullptr, std::move(_value) };
+			Node* head = this->head.load(std::memory_order_relaxed);
+			do
+			{
+				node->next = head;
+			}
+			while(!this->head.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+			return head == nullptr;
+		}
+
+		// Consumer only. Hands everything pushed so far to _consume, oldest first, and returns how many there were.
+		// Anything pushed while this runs is left for the next wakeup
+		template <typename Consume>
+		size_t drain(Consume&& _consume)
+		{
+			// The list comes out newest first, turn it around
+			Node* node = this->head.exchange(nullptr, std::memory_order_acquire);
+			Node* oldest = nullptr;
+			while(node != nullptr)
+			{
+				Node* next = node->next;
+				node->next = oldest;
+				oldest = node;
+				node = next;
+			}
+
+			size_t count = 0;
+			while(oldest != nullptr)
+			{
+				Node* next = oldest->next;
+				_consume(std::move(oldest->value));
+				oldest->~Node();
+				BufferPool::release(reinterpret_cast<PacketBlock*>(oldest) - 1);
+				oldest = next;
+				count++;
+			}
+			return count;
+		}
+
+		bool empty() const { return this->head.load(std::memory_order_acquire) == nullptr; }
+
+	private:
+		struct Node
+		{
+			Node* next;
+			T value;
+		};
+
+		std::atomic<Node*> head = nullptr;
+};
+
+#endif
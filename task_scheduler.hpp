@@ -0,0 +1,415 @@
+#ifndef TASKSCHEDULER_H
+#define TASKSCHEDULER_H
+
+// C++
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Templates
+#include "buffer_pool.hpp"
+
+class TaskGroup;
+
+// Work-stealing thread pool for background jobs, instead of starting a std::thread per job.
+// Every worker has its own deque. A worker pushes and pops the back of its own (newest first, still warm in cache)
+// and only when that's empty steals from the front of someone else's, so workers rarely touch the same lock.
+// Jobs submitted from outside the pool are dealt round-robin over the workers' deques
+class TaskScheduler
+{
+	friend class TaskGroup;
+	public:
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		TaskScheduler() : TaskScheduler(0) {}
+
+		// Parameterized constructors
+		// A thread count of 0 means one worker per hardware thread
+		explicit TaskScheduler(size_t _threadCount)
+		{
+			if(_threadCount == 0)
+			{
+				_threadCount = std::max(1u, std::thread::hardware_concurrency());
+			}
+
+			this->workers = std::vector<Worker>(_threadCount);
+			for(size_t i = 0; i < _threadCount; ++i)
+			{
+				this->threads.emplace_back([this, i]() { this->workerLoop(i); });
+			}
+		}
+
+		// Workers hold on to the scheduler's address, don't copy it
+		TaskScheduler(const TaskScheduler& other) = delete;
+		TaskScheduler& operator=(const TaskScheduler& other) = delete;
+
+		// Destructor
+		// Runs whatever is still queued, then joins the workers
+		~TaskScheduler()
+		{
+			{
+				std::lock_guard<std::mutex> lock(this->sleepMutex);
+				this->stopping = true;
+			}
+			this->wakeup.notify_all();
+			for(std::thread& thread : this->threads)
+			{
+				thread.join();
+			}
+		}
+
+		/*****************
+		 * Task Functions
+		 ****************/
+		// Queues _function, its result (or exception) comes back through the future
+		template <typename Function>
+		std::future<std::invoke_result_t<std::decay_t<Function>>> submit(Function&& _function)
+		{
+			typedef std::invoke_result_t<std::decay_t<Function>> Result;
+			std::packaged_task<Result()> task(std::forward<Function>(_function));
+			std::future<Result> future = task.get_future();
+			this->spawn(std::move(task));
+			return future;
+		}
+
+		// Queues _function with nothing to wait on, exceptions it throws are caught and dropped
+		template <typename Function>
+		void spawn(Function&& _function)
+		{
+			this->push(Task(std::forward<Function>(_function)));
+		}
+
+		// Calls _function(i) for every i in [_begin, _end) and returns once they've all run.
+		// The range is cut into chunks of _grain (0 picks a few chunks per worker), the calling thread works on them too
+		template <typename Function>
+		void parallelFor(size_t _begin, size_t _end, Function&& _function, size_t _grain = 0);
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		size_t getThreadCount() const { return this->workers.size(); }
+		// True on one of this scheduler's workers
+		bool isWorkerThread() const { return currentScheduler() == this; }
+
+	private:
+		// A move-only type-erased job. Its storage comes from the packet pool's size classes,
+		// so queueing a job doesn't hit malloc in steady state
+		class Task
+		{
+			public:
+				/*****************
+				 * Constructors
+				 ****************/
+				// Default constructor
+				Task() = default;
+
+				// Parameterized constructors
+				template <typename Function, typename = std::enable_if_t<!std::is_same_v<std::decay_t<Function>, Task>>>
+				explicit Task(Function&& _function)
+				{
+					typedef Callable<std::decay_t<Function>> Type;
+					this->callable = new (BufferPool::allocate(sizeof(Type))->data()) Type(std::forward<Function>(_function));
+				}
+
+				// A task owns its callable, move it, don't copy it
+				Task(const Task& other) = delete;
+				Task& operator=(const Task& other) = delete;
+				Task(Task&& other) noexcept : callable(std::exchange(other.callable, nullptr)) {}
+				Task& operator=(Task&& other) noexcept
+				{
+					std::swap(this->callable, other.callable);
+					return *this;
+				}
+
+				// Destructor
+				~Task()
+				{
+					if(this->callable != nullptr)
+					{
+						this->callable->~CallableBase();
+						BufferPool::release(reinterpret_cast<PacketBlock*>(this->callable) - 1);
+					}
+				}
+
+				// Whatever a spawned job throws is dropped here, so it can't take down the worker or a thread helping in TaskGroup::wait
+				void operator()()
+				{
+					try
+					{
+						this->callable->run();
+					}
+					catch(...)
+					{
+					}
+				}
+
+			private:
+				struct CallableBase
+				{
+					virtual ~CallableBase() = default;
+					virtual void run() = 0;
+				};
+
+				template <typename Function>
+				struct Callable : CallableBase
+				{
+					template <typename F>
+					explicit Callable(F&& _function) : function(std::forward<F>(_function)) {}
+					void run() override { this->function(); }
+
+					Function function;
+				};
+
+				CallableBase* callable = nullptr;
+		};
+
+		struct alignas(64) Worker
+		{
+			std::mutex m;
+			std::deque<Task> tasks;
+		};
+
+		// Which scheduler, if any, the current thread works for, and its index there
+		static TaskScheduler*& currentScheduler()
+		{
+			thread_local TaskScheduler* scheduler = nullptr;
+			return scheduler;
+		}
+
+		static size_t& currentWorker()
+		{
+			thread_local size_t index = 0;
+			return index;
+		}
+
+		void push(Task&& _task)
+		{
+			// Workers keep what they spawn, anyone else deals jobs out round-robin
+			size_t index = this->isWorkerThread() ? currentWorker() : this->nextWorker.fetch_add(1, std::memory_order_relaxed) % this->workers.size();
+			{
+				std::lock_guard<std::mutex> lock(this->workers[index].m);
+				this->workers[index].tasks.push_back(std::move(_task));
+			}
+			this->queued.fetch_add(1);
+
+			// A worker about to sleep holds sleepMutex from its last look at queued until it's waiting,
+			// taking it here means the notify can't land in between
+			if(this->sleeping.load() > 0)
+			{
+				std::lock_guard<std::mutex> lock(this->sleepMutex);
+			}
+			this->wakeup.notify_one();
+		}
+
+		// Own deque newest first, then steal the oldest from the others
+		bool tryTake(size_t _index, Task& _task)
+		{
+			for(size_t i = 0; i < this->workers.size(); ++i)
+			{
+				Worker& worker = this->workers[(_index + i) % this->workers.size()];
+				std::lock_guard<std::mutex> lock(worker.m);
+				if(worker.tasks.empty())
+				{
+					continue;
+				}
+
+				if(i == 0 && this->isWorkerThread())
+				{
+					_task = std::move(worker.tasks.back());
+					worker.tasks.pop_back();
+				}
+				else
+				{
+					_task = std::move(worker.tasks.front());
+					worker.tasks.pop_front();
+				}
+				this->queued.fetch_sub(1);
+				return true;
+			}
+			return false;
+		}
+
+		// Runs one queued job on the calling thread, for threads that would otherwise block on a TaskGroup
+		bool runOne()
+		{
+			size_t index = this->isWorkerThread() ? currentWorker() : this->nextWorker.fetch_add(1, std::memory_order_relaxed) % this->workers.size();
+			Task task;
+			if(!this->tryTake(index, task))
+			{
+				return false;
+			}
+			task();
+			return true;
+		}
+
+		void workerLoop(size_t _index)
+		{
+			currentScheduler() = this;
+			currentWorker() = _index;
+
+			Task task;
+			while(true)
+			{
+				if(this->tryTake(_index, task))
+				{
+					task();
+					task = Task();
+					continue;
+				}
+
+				std::unique_lock<std::mutex> lock(this->sleepMutex);
+				this->sleeping.fetch_add(1);
+				this->wakeup.wait(lock, [this]() { return this->queued.load() > 0 || this->stopping; });
+				this->sleeping.fetch_sub(1);
+				if(this->stopping && this->queued.load() == 0)
+				{
+					break;
+				}
+			}
+		}
+
+		std::vector<Worker> workers;
+		std::vector<std::thread> threads;
+		std::atomic<size_t> nextWorker = 0;
+		// Jobs sitting in any deque
+		std::atomic<size_t> queued = 0;
+		std::atomic<size_t> sleeping = 0;
+		std::mutex sleepMutex;
+		std::condition_variable wakeup;
+		bool stopping = false;
+};
+
+// A set of jobs to wait on together.
+// wait() runs queued jobs while it waits instead of blocking, so waiting from inside a job doesn't tie up a worker.
+// The first exception any job throws is rethrown from wait()
+class TaskGroup
+{
+	public:
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		TaskGroup() = delete;
+
+		// Parameterized constructors
+		explicit TaskGroup(TaskScheduler& _scheduler) : scheduler(_scheduler) {}
+
+		// Jobs hold on to the group's address, don't copy it
+		TaskGroup(const TaskGroup& other) = delete;
+		TaskGroup& operator=(const TaskGroup& other) = delete;
+
+		// Destructor
+		// Jobs still running would outlive the group, wait for them. Call wait() first to see their exceptions
+		~TaskGroup()
+		{
+			this->waitForJobs();
+		}
+
+		/*****************
+		 * Task Functions
+		 ****************/
+		template <typename Function>
+		void run(Function&& _function)
+		{
+			this->pending.fetch_add(1);
+			this->scheduler.spawn([this, function = std::forward<Function>(_function)]() mutable
+			{
+				try
+				{
+					function();
+				}
+				catch(...)
+				{
+					std::lock_guard<std::mutex> lock(this->m);
+					if(!this->exception)
+					{
+						this->exception = std::current_exception();
+					}
+				}
+
+				// Counted down and notified under the lock, the group may be destroyed as soon as it's released
+				std::lock_guard<std::mutex> lock(this->m);
+				if(this->pending.fetch_sub(1) == 1)
+				{
+					this->done.notify_all();
+				}
+			});
+		}
+
+		// Blocks until every job run() so far has finished
+		void wait()
+		{
+			this->waitForJobs();
+
+			std::exception_ptr exception;
+			{
+				std::lock_guard<std::mutex> lock(this->m);
+				exception = std::exchange(this->exception, nullptr);
+			}
+			if(exception)
+			{
+				std::rethrow_exception(exception);
+			}
+		}
+
+	private:
+		// Only returns once the last job has let go of m, so the group can be destroyed right after
+		void waitForJobs()
+		{
+			while(this->pending.load() > 0 && this->scheduler.runOne())
+			{
+			}
+
+			// Nothing left to help with, what's left of the group is running on other threads
+			std::unique_lock<std::mutex> lock(this->m);
+			this->done.wait(lock, [this]() { return this->pending.load() == 0; });
+		}
+
+		TaskScheduler& scheduler;
+		std::atomic<size_t> pending = 0;
+		std::mutex m;
+		std::condition_variable done;
+		std::exception_ptr exception;
+};
+
+template <typename Function>
+void TaskScheduler::parallelFor(size_t _begin, size_t _end, Function&& _function, size_t _grain)
+{
+	if(_begin >= _end)
+	{
+		return;
+	}
+	if(_grain == 0)
+	{
+		_grain = std::max<size_t>(1, (_end - _begin) / (this->workers.size() * 4));
+	}
+
+	TaskGroup group(*this);
+	for(size_t chunk = _begin; chunk < _end; chunk += _grain)
+	{
+		size_t chunkEnd = std::min(_end, chunk + _grain);
+		group.run([&_function, chunk, chunkEnd]()
+		{
+			for(size_t i = chunk; i < chunkEnd; ++i)
+			{
+				_function(i);
+			}
+		});
+	}
+	group.wait();
+}
+
+#endif
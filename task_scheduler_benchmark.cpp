@@ -0,0 +1,118 @@
+// C++
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Templates
+#include "task_scheduler.hpp"
+
+// Keeps the compiler from optimizing the work away
+std::atomic<uint64_t> sink = 0;
+
+// A few microseconds of arithmetic, about the size of a small background job
+void work(size_t _iterations)
+{
+	uint64_t value = _iterations;
+	for(size_t i = 0; i < _iterations; ++i)
+	{
+		value = value * 6364136223846793005ULL + 1442695040888963407ULL;
+	}
+	sink.fetch_add(value, std::memory_order_relaxed);
+}
+
+double percentile(std::vector<double>& _samples, double _fraction)
+{
+	std::sort(_samples.begin(), _samples.end());
+	return _samples[static_cast<size_t>(_fraction * (_samples.size() - 1))];
+}
+
+// Time from asking for a job to it starting, one job at a time, in microseconds
+template <typename Spawn>
+std::vector<double> measureLatency(size_t _samples, Spawn&& _spawn)
+{
+	std::vector<double> latencies;
+	latencies.reserve(_samples);
+	for(size_t i = 0; i < _samples; ++i)
+	{
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		std::chrono::steady_clock::time_point started;
+		_spawn([&started]() { started = std::chrono::steady_clock::now(); });
+		latencies.push_back(std::chrono::duration<double, std::micro>(started - begin).count());
+	}
+	return latencies;
+}
+
+int main(int argc, char* argv[])
+{
+	// Usage: task_scheduler_benchmark [jobs] [work iterations per job] [threads]
+	// Compares a std::thread per job, the way threaded_input_loop used to run its jobs, against TaskScheduler
+	size_t jobs = argc > 1 ? std::stoul(argv[1]) : 20000;
+	size_t iterations = argc > 2 ? std::stoul(argv[2]) : 1000;
+	size_t threadCount = argc > 3 ? std::stoul(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+
+	TaskScheduler scheduler(threadCount);
+	std::cout << "Threads: " << scheduler.getThreadCount() << ", jobs: " << jobs << ", work iterations per job: " << iterations << '\n';
+	std::cout << std::fixed << std::setprecision(1);
+
+	// Spawn latency
+	size_t samples = std::min<size_t>(jobs, 2000);
+	std::vector<double> threadLatency = measureLatency(samples, [](auto _job)
+	{
+		std::thread thread(_job);
+		thread.join();
+	});
+	std::vector<double> schedulerLatency = measureLatency(samples, [&scheduler](auto _job)
+	{
+		scheduler.submit(_job).get();
+	});
+
+	std::cout << "spawn latency     p50 us    p99 us" << '\n';
+	std::cout << "std::thread  " << std::setw(11) << percentile(threadLatency, 0.5) << std::setw(10) << percentile(threadLatency, 0.99) << '\n';
+	std::cout << "TaskScheduler" << std::setw(11) << percentile(schedulerLatency, 0.5) << std::setw(10) << percentile(schedulerLatency, 0.99) << '\n';
+
+	// Throughput, threadCount jobs in flight at a time for the raw threads, as many as there are for the scheduler
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	for(size_t done = 0; done < jobs; done += threadCount)
+	{
+		std::vector<std::thread> threads;
+		for(size_t i = done; i < std::min(jobs, done + threadCount); ++i)
+		{
+			threads.emplace_back(work, iterations);
+		}
+		for(std::thread& thread : threads)
+		{
+			thread.join();
+		}
+	}
+	std::chrono::duration<double> threadTime = std::chrono::steady_clock::now() - begin;
+
+	begin = std::chrono::steady_clock::now();
+	{
+		TaskGroup group(scheduler);
+		for(size_t i = 0; i < jobs; ++i)
+		{
+			group.run([iterations]() { work(iterations); });
+		}
+		group.wait();
+	}
+	std::chrono::duration<double> groupTime = std::chrono::steady_clock::now() - begin;
+
+	begin = std::chrono::steady_clock::now();
+	scheduler.parallelFor(0, jobs, [iterations](size_t) { work(iterations); });
+	std::chrono::duration<double> parallelForTime = std::chrono::steady_clock::now() - begin;
+
+	std::cout << std::setprecision(0);
+	std::cout << "throughput           jobs/s" << '\n';
+	std::cout << "std::thread  " << std::setw(14) << jobs / threadTime.count() << '\n';
+	std::cout << "TaskGroup    " << std::setw(14) << jobs / groupTime.count() << '\n';
+	std::cout << "parallelFor  " << std::setw(14) << jobs / parallelForTime.count() << '\n';
+
+	return 0;
+}
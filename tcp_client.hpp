@@ -0,0 +1,484 @@
+#ifndef TCPCLIENT_H
+#define TCPCLIENT_H
+
+// C++
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Boost
+#include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+
+// Templates
+#include "buffer_pool.hpp"
+#include "handler_allocator.hpp"
+#include "maple_cipher.hpp"
+#include "packet_framer.hpp"
+#include "packet_logger.hpp"
+#include "receive_ring.hpp"
+#include "session_task.hpp"
+#include "submission_queue.hpp"
+
+class TCPClient : public std::enable_shared_from_this<TCPClient>
+{
+    public:
+		// Upper bounds for coalescing queued packets into a single gather write
+		static constexpr size_t MAX_WRITE_BUFFERS = 64;
+		static constexpr size_t MAX_WRITE_BYTES = 64 * 1024;
+
+		// Called once per received message on the IO thread.
+		// _message points into the receive ring, use copyMessage() to keep it past the call
+		typedef std::function<void(TCPClient& _client, MessageView _message)> MessageHandler;
+		// Replaces the MessageHandler when set. Returns the coroutine the client runs its whole session in,
+		// on the socket's io_context. The session keeps the client alive until it returns
+		typedef std::function<SessionTask<>(std::shared_ptr<TCPClient> _client)> SessionHandler;
+
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+        TCPClient() = delete;
+
+		// Parameterized constructor
+		TCPClient(boost::asio::io_context& io_context, const std::string& server, size_t port) : ioContext(io_context), socket(io_context), resolver(io_context)
+        {
+			// Initialize and connect the socket
+			boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address::from_string(server), port);
+			try
+			{
+				this->socket.connect(endpoint);
+				this->mSocketActive = true;
+    		}
+			catch(const std::exception& e)
+			{
+				std::cerr << e.what() << '\n';
+			}
+	    }
+		
+		// Deconstructor
+		~TCPClient()
+		{
+			this->socket.close();
+		}
+
+		/*****************
+		 * Server Functions
+		 ****************/
+		void start()
+		{
+			if(this->sessionHandler)
+			{
+				spawnSession(this->socket.get_executor(), this->sessionHandler(shared_from_this()));
+				return;
+			}
+			this->read();
+		}
+
+		void shutdown()
+		{
+			// Handles and ignores
+			// `The I/O operation has been aborted because of either a thread exit or an application request` exception
+			// for a quick and dirty shutdown
+			try
+			{
+				// Shutdown read/write and the socket itself
+				this->socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both);
+				this->socket.close();
+				this->mSocketActive = false;
+			}
+			catch(std::exception _error)
+			{
+				std::cout << "Error: " << _error.what() << '\n';
+			}
+		}
+
+        void read()
+        {
+			// Read whatever the socket has into readBuffer, the framer splits it into messages
+			this->socket.async_read_some(this->readBuffer.prepare(this->framer.getReadSize()),
+										 makeAllocHandler(this->readHandlerMemory,
+														  boost::bind(&TCPClient::handleRead,
+																	  shared_from_this(),
+																	  boost::asio::placeholders::error,
+																	  boost::asio::placeholders::bytes_transferred)));
+		}
+
+		// Safe from any thread, writes from anywhere but the IO thread are posted to it
+		void write()
+		{
+			if(!this->ioContext.get_executor().running_in_this_thread())
+			{
+				boost::asio::post(this->ioContext, boost::bind(&TCPClient::write, shared_from_this()));
+				return;
+			}
+
+			// Async write
+			// Only one write in flight at a time, anything queued meanwhile goes out with the next one
+			if(this->writeBufferQueue.size() > 0 && this->mSocketActive && this->writeBuffersInFlight == 0)
+			{
+				// Gather as many queued packets as the limits allow into one write
+				size_t bytes = 0;
+				this->writeBuffers.clear();
+				for(const PacketBuffer& packet : this->writeBufferQueue)
+				{
+					if(this->writeBuffers.size() == MAX_WRITE_BUFFERS || (bytes > 0 && bytes + packet.size() > MAX_WRITE_BYTES))
+					{
+						break;
+					}
+					this->writeBuffers.push_back(boost::asio::buffer(packet.data(), packet.size()));
+					bytes += packet.size();
+				}
+				this->writeBuffersInFlight = this->writeBuffers.size();
+
+				// Pass the gather list as a span, async_write would otherwise copy the vector every write
+				boost::asio::async_write(this->socket,
+										std::span<const boost::asio::const_buffer>(this->writeBuffers),
+										makeAllocHandler(this->writeHandlerMemory,
+														 boost::bind(&TCPClient::handleWrite,
+																	 shared_from_this(),
+																	 boost::asio::placeholders::error,
+																	 boost::asio::placeholders::bytes_transferred)));
+			}
+		}
+
+		void pushOntoWriteQueue(const std::string& _str)
+		{
+			this->pushOntoWriteQueue(std::as_bytes(std::span(_str)));
+		}
+
+		// Safe from any thread. On the IO thread the message is queued for the next write().
+		// Anywhere else it's copied onto the submission queue and goes out as soon as the IO thread drains it,
+		// framing and encryption stay on the IO thread so the sender never waits on it
+		void pushOntoWriteQueue(MessageView _message)
+		{
+			if(this->ioContext.get_executor().running_in_this_thread())
+			{
+				this->queueMessage(_message);
+				return;
+			}
+
+			if(this->submissions.push(copyMessage(_message)))
+			{
+				boost::asio::post(this->ioContext, boost::bind(&TCPClient::drainSubmissions, shared_from_this()));
+			}
+		}
+
+		// Default message handler, dumps the message
+		static void print(TCPClient& _client, MessageView _message)
+		{
+			std::cout << "Bytes received: ";
+			for(std::byte b : _message)
+			{
+				std::cout << std::hex << std::to_integer<unsigned int>(b) << ' ';
+			}
+			std::cout << "\n\n";
+		}
+
+		/*****************
+		 * Session Functions
+		 ****************/
+		// Only from the client's session coroutine.
+		// co_await readFrame() gives the next message, or an error once the connection is gone
+		ReadFrameAwaiter<TCPClient> readFrame() { return ReadFrameAwaiter<TCPClient>(*this); }
+
+		// Queues and writes _message, co_await it to wait until the write queue has drained
+		SendAwaiter<TCPClient> asyncSend(MessageView _message)
+		{
+			this->pushOntoWriteQueue(_message);
+			this->write();
+			return SendAwaiter<TCPClient>(*this);
+		}
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		bool isSocketActive() { return this->mSocketActive; }
+		PacketFramer& getFramer() { return this->framer; }
+		void setMessageHandler(MessageHandler _messageHandler) { this->messageHandler = std::move(_messageHandler); }
+		// Set before start()
+		void setSessionHandler(SessionHandler _sessionHandler) { this->sessionHandler = std::move(_sessionHandler); }
+		// Expect the server to encrypt everything after the handshake, set before start()
+		void setCipherEnabled(bool _cipherEnabled) { this->cipherEnabled = _cipherEnabled; }
+
+    private:
+		void handleRead(const boost::system::error_code& _error, size_t _bytes_transferred)
+        {
+			// If theres an async error, close the connection
+			if (!_error)
+			{
+				this->readBuffer.commit(_bytes_transferred);
+
+				// A single read can hold several messages, handle every complete one before reading again
+				// Messages are handed out as views into the receive ring, no copies
+				MessageView message;
+				PacketFramer::Status status;
+				while((status = this->takeFrame(message)) == PacketFramer::Status::Complete)
+				{
+					// Process data
+					this->messageHandler(*this, message);
+				}
+
+				if(status == PacketFramer::Status::Invalid)
+				{
+					return;
+				}
+
+				this->read();
+			}
+			else
+			{
+				std::cout << "Error: " << _error.message() << '\n';
+			}
+        }
+
+		// Consumes the message handed out last, then pulls the next complete one out of the ring.
+		// A malformed frame or handshake shuts the client down
+		PacketFramer::Status takeFrame(MessageView& _message)
+		{
+			// Clear the last message from the read buffer, this invalidates its view
+			this->readBuffer.consume(this->takenFrameSize);
+			this->takenFrameSize = 0;
+
+			PacketFramer::Frame frame;
+			PacketFramer::Status status = this->framer.nextFrame(this->readBuffer.data(), frame);
+			if(status == PacketFramer::Status::Invalid)
+			{
+				std::cout << "Error: invalid frame" << '\n';
+				this->shutdown();
+				return status;
+			}
+			if(status == PacketFramer::Status::Incomplete)
+			{
+				return status;
+			}
+
+			_message = this->readBuffer.data().subspan(frame.bodyOffset, frame.bodySize);
+			if(this->cipherActive)
+			{
+				// Decrypt in place, the ring owns these bytes until they're consumed
+				this->receiveCipher.decrypt(this->readBuffer.mutableData().data() + frame.bodyOffset, frame.bodySize);
+			}
+			else if(this->cipherEnabled && !this->startCipher(_message))
+			{
+				std::cout << "Error: invalid handshake" << '\n';
+				this->shutdown();
+				return PacketFramer::Status::Invalid;
+			}
+			PacketLogger::log(0, PacketDirection::Received, this->readBuffer.data().first(frame.frameSize));
+
+			this->takenFrameSize = frame.frameSize;
+			return status;
+		}
+
+		/*****************
+		 * Session awaiter hooks
+		 ****************/
+		template <typename> friend class ReadFrameAwaiter;
+		template <typename> friend class SendAwaiter;
+
+		// True when readFrame() can complete without reading from the socket
+		bool pollFrame(SessionRead& _result)
+		{
+			if(!this->mSocketActive)
+			{
+				_result.error = boost::asio::error::not_connected;
+				return true;
+			}
+
+			PacketFramer::Status status = this->takeFrame(_result.message);
+			if(status == PacketFramer::Status::Invalid)
+			{
+				_result.error = boost::system::errc::make_error_code(boost::system::errc::bad_message);
+			}
+			return status != PacketFramer::Status::Incomplete;
+		}
+
+		// Reads until a whole frame is in, then resumes the session.
+		// The session holds the client, so the handler doesn't need its own shared_ptr
+		void readFrameAsync(std::coroutine_handle<> _session, SessionRead& _result)
+		{
+			this->socket.async_read_some(this->readBuffer.prepare(this->framer.getReadSize()),
+										 makeAllocHandler(this->readHandlerMemory,
+														  [this, _session, &_result](const boost::system::error_code& _error, size_t _bytes_transferred)
+										 {
+											 if(_error)
+											 {
+												 std::cout << "Error: " << _error.message() << '\n';
+												 _result.error = _error;
+												 _session.resume();
+												 return;
+											 }
+
+											 this->readBuffer.commit(_bytes_transferred);
+											 if(this->pollFrame(_result))
+											 {
+												 _session.resume();
+											 }
+											 else
+											 {
+												 this->readFrameAsync(_session, _result);
+											 }
+										 }));
+		}
+
+		// True when nothing is left to write
+		bool pollWrites(boost::system::error_code& _error)
+		{
+			if(!this->mSocketActive)
+			{
+				_error = boost::asio::error::not_connected;
+				return true;
+			}
+			return this->writeBufferQueue.empty();
+		}
+
+		void waitForWrites(std::coroutine_handle<> _session, boost::system::error_code& _error)
+		{
+			this->writeWaiter = _session;
+			this->writeWaiterError = &_error;
+		}
+
+		void resumeWriteWaiter(const boost::system::error_code& _error)
+		{
+			if(this->writeWaiter)
+			{
+				*this->writeWaiterError = _error;
+				std::exchange(this->writeWaiter, nullptr).resume();
+			}
+		}
+
+		// The first message is the server's handshake:
+		// [version (2)][patch string length (2)][patch string][receive IV (4)][send IV (4)][locale (1)]
+		// We send with the server's receive IV and receive with its send IV
+		bool startCipher(MessageView _handshake)
+		{
+			const unsigned char* data = reinterpret_cast<const unsigned char*>(_handshake.data());
+			if(_handshake.size() < 4)
+			{
+				return false;
+			}
+
+			uint16_t version = static_cast<uint16_t>(data[0] | (data[1] << 8));
+			size_t ivOffset = 4 + static_cast<size_t>(data[2] | (data[3] << 8));
+			if(_handshake.size() < ivOffset + 8)
+			{
+				return false;
+			}
+
+			this->receiveCipher = MapleCipher(data + ivOffset + 4, 0xFFFF - version);
+			this->framer = MapleCipher::makeFramer(this->receiveCipher);
+			this->sendCipher = MapleCipher(data + ivOffset, version);
+			this->cipherActive = true;
+
+			for(const PacketBuffer& message : this->pendingMessages)
+			{
+				this->queuePacket(message.view());
+			}
+			this->pendingMessages.clear();
+			return true;
+		}
+
+		// IO thread only, moves everything other threads submitted onto the write queue and writes it
+		void drainSubmissions()
+		{
+			this->submissions.drain([this](PacketBuffer _message)
+			{
+				this->queueMessage(_message.view());
+			});
+			this->write();
+		}
+
+		// IO thread only
+		void queueMessage(MessageView _message)
+		{
+			// Nothing can go out before the handshake tells us how to encrypt it
+			if(this->cipherEnabled && !this->cipherActive)
+			{
+				this->pendingMessages.push_back(copyMessage(_message));
+				return;
+			}
+			this->queuePacket(_message);
+		}
+
+		// IO thread only, packets are encrypted in the order they're queued
+		void queuePacket(MessageView _message)
+		{
+			// Frame straight into a pooled packet
+			PacketBuffer packet = PacketBuffer::allocate(_message.size() + this->framer.getFrameOverhead());
+			this->framer.encode(packet.data(), _message.data(), _message.size());
+			PacketLogger::log(0, PacketDirection::Sent, packet.view());
+
+			if(this->cipherActive)
+			{
+				this->sendCipher.encrypt(packet.data(), packet.data() + MapleCipher::HEADER_SIZE, packet.size() - MapleCipher::HEADER_SIZE);
+			}
+			this->writeBufferQueue.push_back(std::move(packet));
+		}
+
+        void handleWrite(const boost::system::error_code& _error, size_t _bytes_transferred)
+        {
+			// If theres an async error, close the connection
+			if (!_error)
+			{
+				// Pop every packet that went out with the write
+				this->writeBufferQueue.erase(this->writeBufferQueue.begin(), this->writeBufferQueue.begin() + this->writeBuffersInFlight);
+				this->writeBuffersInFlight = 0;
+
+				if(this->writeBufferQueue.size() > 0)
+				{
+					this->write();
+				}
+				else
+				{
+					this->resumeWriteWaiter(_error);
+				}
+			}
+			else
+			{
+				std::cout << "Error: " << _error.message() << '\n';
+				this->resumeWriteWaiter(_error);
+			}
+        }
+
+		bool mSocketActive = false;
+		boost::asio::io_context& ioContext;
+        boost::asio::ip::tcp::socket socket;
+        boost::asio::ip::tcp::resolver resolver;
+		ReceiveRing readBuffer;
+		// Size of the frame takeFrame() handed out last, it stays in the ring until the next takeFrame()
+		size_t takenFrameSize = 0;
+		// Pooled, already framed packets
+		std::deque<PacketBuffer> writeBufferQueue;
+		// The gather list for the write in flight, reused between writes
+		std::vector<boost::asio::const_buffer> writeBuffers;
+		size_t writeBuffersInFlight = 0;
+		// Completion handler memory, one read and one write are in flight at most
+		HandlerMemory readHandlerMemory;
+		HandlerMemory writeHandlerMemory;
+		PacketFramer framer;
+		// One cipher per direction, both only touched on the IO thread
+		MapleCipher receiveCipher;
+		MapleCipher sendCipher;
+		bool cipherEnabled = false;
+		bool cipherActive = false;
+		// Messages pushed before the handshake arrived
+		std::vector<PacketBuffer> pendingMessages;
+		// Messages from other threads on their way to the IO thread
+		SubmissionQueue<PacketBuffer> submissions;
+		MessageHandler messageHandler = print;
+		SessionHandler sessionHandler;
+		// The session waiting in asyncSend() for the write queue to drain
+		std::coroutine_handle<> writeWaiter;
+		boost::system::error_code* writeWaiterError = nullptr;
+};
+
+#endif
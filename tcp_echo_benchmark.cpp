@@ -0,0 +1,225 @@
+// C++
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Boost
+#include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+
+// Templates
+#include "handler_allocator.hpp"
+#include "io_context_pool.hpp"
+#include "packet_framer.hpp"
+#include "receive_ring.hpp"
+#include "tcp_server.hpp"
+
+// Namespaces
+using boost::asio::ip::tcp;
+
+// Shared across every benchmark connection
+std::atomic<size_t> messagesEchoed = 0;
+std::atomic<bool> running = true;
+
+// Every heap allocation in the process, so we can check the echo loop itself doesn't allocate.
+// With the server in process that covers TCPConnection's echo path as well as these clients
+std::atomic<size_t> heapAllocations = 0;
+
+void* operator new(size_t _size)
+{
+	heapAllocations.fetch_add(1, std::memory_order_relaxed);
+	if(void* memory = std::malloc(_size == 0 ? 1 : _size))
+	{
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+
+// The sized delete is left to the standard library, it forwards to this one.
+// Replacing it too lets GCC inline free() into delete expressions and report -Wmismatched-new-delete
+void operator delete(void* _pointer) noexcept { std::free(_pointer); }
+
+// Sends a message, waits for the server to echo it back and repeats until the benchmark ends
+class EchoConnection : public std::enable_shared_from_this<EchoConnection>
+{
+	public:
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		EchoConnection() = delete;
+
+		// Parameterized constructor
+		EchoConnection(boost::asio::io_context& _ioContext, size_t _messageSize) : socket(_ioContext)
+		{
+			this->message = this->framer.encode(std::string(_messageSize, 'x'));
+		}
+
+		/*****************
+		 * Benchmark Functions
+		 ****************/
+		void start(const tcp::endpoint& _endpoint)
+		{
+			this->socket.connect(_endpoint);
+			this->socket.set_option(tcp::no_delay(true));
+
+			// The server handshake arrives first, it's discarded before we start echoing
+			this->read();
+		}
+
+	private:
+		void write()
+		{
+			boost::asio::async_write(this->socket,
+									 boost::asio::buffer(this->message),
+									 makeAllocHandler(this->writeHandlerMemory,
+													  boost::bind(&EchoConnection::handleWrite,
+																  shared_from_this(),
+																  boost::asio::placeholders::error)));
+		}
+
+		void read()
+		{
+			this->socket.async_read_some(this->readBuffer.prepare(this->framer.getReadSize()),
+										 makeAllocHandler(this->readHandlerMemory,
+														  boost::bind(&EchoConnection::handleRead,
+																	  shared_from_this(),
+																	  boost::asio::placeholders::error,
+																	  boost::asio::placeholders::bytes_transferred)));
+		}
+
+		void handleWrite(const boost::system::error_code& _error)
+		{
+			// A read is always outstanding, the echo drives the next write
+		}
+
+		void handleRead(const boost::system::error_code& _error, size_t _bytes_transferred)
+		{
+			if(_error)
+			{
+				return;
+			}
+
+			this->readBuffer.commit(_bytes_transferred);
+
+			PacketFramer::Frame frame;
+			while(this->framer.nextFrame(this->readBuffer.data(), frame) == PacketFramer::Status::Complete)
+			{
+				this->readBuffer.consume(frame.frameSize);
+
+				if(this->handshakeReceived)
+				{
+					messagesEchoed.fetch_add(1, std::memory_order_relaxed);
+				}
+				this->handshakeReceived = true;
+
+				// One message in flight at a time
+				if(running.load(std::memory_order_relaxed))
+				{
+					this->write();
+				}
+			}
+
+			this->read();
+		}
+
+		tcp::socket socket;
+		ReceiveRing readBuffer;
+		PacketFramer framer;
+		std::string message;
+		bool handshakeReceived = false;
+		HandlerMemory readHandlerMemory;
+		HandlerMemory writeHandlerMemory;
+};
+
+int main(int argc, char* argv[])
+{
+	// Usage: tcp_echo_benchmark [port] [connections] [threads] [seconds] [message size] [in process]
+	// Run it against asio_tcp_server started with different thread counts to see how the server scales.
+	// An in process of 1 runs a TCPServer with as many IO threads in this process instead, so the
+	// heap allocation count covers the server's steady state reads and writes too
+	size_t port = argc > 1 ? std::stoul(argv[1]) : 1111;
+	size_t connectionCount = argc > 2 ? std::stoul(argv[2]) : 64;
+	size_t threadCount = argc > 3 ? std::stoul(argv[3]) : 0;
+	size_t seconds = argc > 4 ? std::stoul(argv[4]) : 10;
+	size_t messageSize = argc > 5 ? std::stoul(argv[5]) : 64;
+	bool inProcess = argc > 6 && std::stoul(argv[6]) != 0;
+
+	// Declared before its thread, so the thread is joined before the server goes
+	std::shared_ptr<TCPServer> server;
+	std::jthread serverThread;
+	if(inProcess)
+	{
+		server = std::make_shared<TCPServer>(port, threadCount);
+		server->startAccept();
+		server->startReaping();
+		serverThread = std::jthread([&server]() { server->run(); });
+	}
+
+	IOContextPool ioContextPool(threadCount);
+	tcp::endpoint endpoint(boost::asio::ip::address::from_string("127.0.0.1"), port);
+
+	try
+	{
+		for(size_t i = 0; i < connectionCount; ++i)
+		{
+			std::shared_ptr<EchoConnection> connection = std::make_shared<EchoConnection>(ioContextPool.getIOContext(), messageSize);
+			connection->start(endpoint);
+		}
+	}
+	catch(const std::exception& e)
+	{
+		std::cerr << e.what() << '\n';
+		if(server)
+		{
+			server->stop();
+		}
+		return 1;
+	}
+
+	// Stop the pool once the benchmark has run its course
+	std::jthread timer([&]()
+	{
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+		size_t warmupMessages = messagesEchoed.load();
+		size_t warmupAllocations = heapAllocations.load();
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+		std::this_thread::sleep_for(std::chrono::seconds(seconds));
+		size_t messages = messagesEchoed.load() - warmupMessages;
+		size_t allocations = heapAllocations.load() - warmupAllocations;
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+		running = false;
+		ioContextPool.stop();
+		if(server)
+		{
+			server->stop();
+		}
+
+		std::cout << "Connections: " << connectionCount << '\n';
+		std::cout << "Client threads: " << ioContextPool.size() << '\n';
+		if(server)
+		{
+			std::cout << "In process server threads: " << server->getThreadCount() << '\n';
+		}
+		std::cout << "Messages echoed: " << messages << '\n';
+		std::cout << "Messages/s: " << messages / elapsed << '\n';
+		std::cout << "MB/s (each way): " << messages * (messageSize + 2) / elapsed / (1024.0 * 1024.0) << '\n';
+		// Both should be 0 once the connections are warmed up
+		std::cout << "Heap allocations/message: " << static_cast<double>(allocations) / std::max<size_t>(messages, 1) << '\n';
+		std::cout << "Handler heap fallbacks: " << HandlerMemory::getHeapAllocations() << '\n';
+	});
+
+	ioContextPool.run();
+
+	return 0;
+}
@@ -0,0 +1,228 @@
+// C++
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Boost
+#include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+
+// Templates
+#include "io_context_pool.hpp"
+#include "metrics.hpp"
+#include "tcp_client.hpp"
+
+// Consts
+// Every message starts with the time it was sent, the echo brings it back
+const size_t TIMESTAMP_SIZE = sizeof(int64_t);
+
+// Only messages sent and echoed inside the measurement window are counted
+std::atomic<bool> measuring = false;
+
+// One simulated client. Closed loop clients send their next message as soon as the last one is echoed,
+// open loop clients send on a fixed schedule whether or not the server keeps up
+class LoadClient : public std::enable_shared_from_this<LoadClient>
+{
+	public:
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		LoadClient() = delete;
+
+		// Parameterized constructor
+		// A _rate of 0 runs closed loop, otherwise it's messages per second
+		LoadClient(boost::asio::io_context& _ioContext, size_t _port, size_t _messageSize, double _rate, std::chrono::nanoseconds _startOffset)
+			: client(std::make_shared<TCPClient>(_ioContext, "127.0.0.1", _port)),
+			  timer(_ioContext),
+			  message(std::max(_messageSize, TIMESTAMP_SIZE), std::byte { 'x' }),
+			  interval(_rate > 0 ? std::chrono::nanoseconds(static_cast<int64_t>(1e9 / _rate)) : std::chrono::nanoseconds(0)),
+			  startOffset(_startOffset)
+		{
+		}
+
+		/*****************
+		 * Load Functions
+		 ****************/
+		void start(bool _cipherEnabled)
+		{
+			// The TCPClient outlives every callback, it's only destroyed once the pool has stopped
+			this->client->setCipherEnabled(_cipherEnabled);
+			this->client->setMessageHandler([this](TCPClient& _client, MessageView _message) { this->handleMessage(_message); });
+			this->client->start();
+		}
+
+		bool isConnected() { return this->client->isSocketActive(); }
+
+	private:
+		void handleMessage(MessageView _message)
+		{
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+			// The server speaks first, start sending once its handshake is in
+			if(!this->handshakeReceived)
+			{
+				this->handshakeReceived = true;
+				if(this->interval.count() == 0)
+				{
+					this->send(now);
+				}
+				else
+				{
+					this->nextSend = now + this->startOffset;
+					this->schedule();
+				}
+				return;
+			}
+
+			if(measuring && _message.size() >= TIMESTAMP_SIZE)
+			{
+				int64_t sentAt;
+				std::memcpy(&sentAt, _message.data(), TIMESTAMP_SIZE);
+				Metrics::record(MetricHistogram::RoundTrip, now.time_since_epoch() - std::chrono::nanoseconds(sentAt));
+				Metrics::add(MetricCounter::MessagesReceived);
+				Metrics::add(MetricCounter::BytesReceived, static_cast<int64_t>(_message.size()));
+			}
+
+			if(this->interval.count() == 0)
+			{
+				this->send(now);
+			}
+		}
+
+		void send(std::chrono::steady_clock::time_point _sentAt)
+		{
+			int64_t sentAt = std::chrono::duration_cast<std::chrono::nanoseconds>(_sentAt.time_since_epoch()).count();
+			std::memcpy(this->message.data(), &sentAt, TIMESTAMP_SIZE);
+
+			this->client->pushOntoWriteQueue(MessageView(this->message));
+			this->client->write();
+			if(measuring)
+			{
+				Metrics::add(MetricCounter::MessagesSent);
+			}
+		}
+
+		void schedule()
+		{
+			this->timer.expires_at(this->nextSend);
+			this->timer.async_wait(boost::bind(&LoadClient::handleTimer, shared_from_this(), boost::asio::placeholders::error));
+		}
+
+		void handleTimer(const boost::system::error_code& _error)
+		{
+			if(!_error && this->client->isSocketActive())
+			{
+				// Stamp with the time the message was due, not when the timer got around to it,
+				// so a stalled server shows up as latency instead of as fewer messages
+				this->send(this->nextSend);
+				this->nextSend += this->interval;
+				this->schedule();
+			}
+		}
+
+		std::shared_ptr<TCPClient> client;
+		boost::asio::steady_timer timer;
+		std::vector<std::byte> message;
+		std::chrono::nanoseconds interval;
+		// Spreads open loop clients over one interval so they don't all send at once
+		std::chrono::nanoseconds startOffset;
+		std::chrono::steady_clock::time_point nextSend;
+		bool handshakeReceived = false;
+};
+
+int main(int argc, char* argv[])
+{
+	// Usage: tcp_loadgen [port] [clients] [threads] [seconds] [message size] [rate] [cipher]
+	// Rate is messages per second per client, 0 (default) runs closed loop.
+	// A cipher of 1 is for servers started with their cipher on.
+	// Run it against asio_tcp_server with packet logging off, e.g. asio_tcp_server 1111 0 0 0
+	// To compare reactors, run the same load against a server built with and without -DASIO_IO_URING=ON,
+	// counting the server's system calls with e.g. perf stat -e raw_syscalls:sys_enter -p <server pid>
+	size_t port = argc > 1 ? std::stoul(argv[1]) : 1111;
+	size_t clientCount = argc > 2 ? std::stoul(argv[2]) : 1000;
+	size_t threadCount = argc > 3 ? std::stoul(argv[3]) : 0;
+	size_t seconds = argc > 4 ? std::stoul(argv[4]) : 10;
+	size_t messageSize = argc > 5 ? std::max<size_t>(std::stoul(argv[5]), TIMESTAMP_SIZE) : 64;
+	double rate = argc > 6 ? std::stod(argv[6]) : 0;
+	bool cipherEnabled = argc > 7 && std::stoul(argv[7]) != 0;
+
+	IOContextPool ioContextPool(threadCount);
+
+	// Connecting is synchronous, every client is connected before any traffic starts
+	std::vector<std::shared_ptr<LoadClient>> clients;
+	clients.reserve(clientCount);
+	size_t connected = 0;
+	for(size_t i = 0; i < clientCount; ++i)
+	{
+		std::chrono::nanoseconds startOffset(rate > 0 ? static_cast<int64_t>(1e9 / rate * static_cast<double>(i) / static_cast<double>(clientCount)) : 0);
+		std::shared_ptr<LoadClient> client = std::make_shared<LoadClient>(ioContextPool.getIOContext(), port, messageSize, rate, startOffset);
+		if(client->isConnected())
+		{
+			client->start(cipherEnabled);
+			connected++;
+		}
+		clients.push_back(std::move(client));
+	}
+
+	if(connected == 0)
+	{
+		std::cout << "Error: no clients connected to port " << port << '\n';
+		return 1;
+	}
+
+	// Warm up, measure, then stop the pool
+	double elapsed = 0;
+	std::jthread timer([&]()
+	{
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+		measuring = true;
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+		std::this_thread::sleep_for(std::chrono::seconds(seconds));
+		measuring = false;
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+		ioContextPool.stop();
+	});
+
+	ioContextPool.run();
+	timer.join();
+
+	MetricsSnapshot snapshot = Metrics::getSnapshot();
+	const HistogramSnapshot& roundTrip = snapshot.get(MetricHistogram::RoundTrip);
+	double messages = static_cast<double>(snapshot.get(MetricCounter::MessagesReceived));
+	double megabytes = static_cast<double>(snapshot.get(MetricCounter::BytesReceived)) / (1024.0 * 1024.0);
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "Clients: " << connected << " connected of " << clientCount << " over " << ioContextPool.size() << " threads" << '\n';
+	if(rate > 0)
+	{
+		std::cout << "Mode: open loop, " << rate << " messages/s per client" << '\n';
+	}
+	else
+	{
+		std::cout << "Mode: closed loop" << '\n';
+	}
+	std::cout << "Message size: " << messageSize << " bytes" << '\n';
+	std::cout << "Messages sent: " << snapshot.get(MetricCounter::MessagesSent) << '\n';
+	std::cout << "Messages echoed: " << snapshot.get(MetricCounter::MessagesReceived) << '\n';
+	std::cout << "Messages/s: " << messages / elapsed << '\n';
+	std::cout << "MB/s: " << megabytes / elapsed << '\n';
+	std::cout << "Round trip p50: " << static_cast<double>(roundTrip.getPercentile(50)) / 1000.0 << " us" << '\n';
+	std::cout << "Round trip p99: " << static_cast<double>(roundTrip.getPercentile(99)) / 1000.0 << " us" << '\n';
+	std::cout << "Round trip p99.9: " << static_cast<double>(roundTrip.getPercentile(99.9)) / 1000.0 << " us" << '\n';
+	std::cout << "Round trip max: " << static_cast<double>(roundTrip.max) / 1000.0 << " us" << '\n';
+
+	// Nothing echoed means something is broken, fail loudly for scripts
+	return roundTrip.total > 0 ? 0 : 1;
+}
@@ -0,0 +1,1125 @@
+#ifndef TCPSERVER_H
+#define TCPSERVER_H
+
+// C++
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+// Boost
+#include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+
+// Templates
+#include "buffer_pool.hpp"
+#include "connection_registry.hpp"
+#include "handler_allocator.hpp"
+#include "io_context_pool.hpp"
+#include "maple_cipher.hpp"
+#include "metrics.hpp"
+#include "packet_logger.hpp"
+#include "packet_framer.hpp"
+#include "receive_ring.hpp"
+#include "session_task.hpp"
+#include "submission_queue.hpp"
+#include "timing_wheel.hpp"
+#include "write_backpressure.hpp"
+
+// How long a connection may sit without progress before the server gives up on it, zero turns one off
+struct ConnectionTimeouts
+{
+	// Defaults
+	static constexpr std::chrono::seconds IDLE_TIMEOUT = std::chrono::seconds(120);
+	static constexpr std::chrono::seconds WRITE_STALL_TIMEOUT = std::chrono::seconds(30);
+	static constexpr std::chrono::seconds KEEPALIVE_INTERVAL = std::chrono::seconds(0);
+
+	// Nothing received
+	std::chrono::steady_clock::duration idle = IDLE_TIMEOUT;
+	// A write in flight without completing
+	std::chrono::steady_clock::duration writeStall = WRITE_STALL_TIMEOUT;
+	// Nothing sent, the connection sends KEEPALIVE_MESSAGE
+	std::chrono::steady_clock::duration keepAlive = KEEPALIVE_INTERVAL;
+};
+
+class TCPConnection : public std::enable_shared_from_this<TCPConnection>
+{
+	public:
+		// Upper bounds for coalescing queued packets into a single gather write
+		static constexpr size_t MAX_WRITE_BUFFERS = 64;
+		static constexpr size_t MAX_WRITE_BYTES = 64 * 1024;
+		// Game version sent in the handshake, encrypted connections check every header against it
+		static constexpr uint16_t MAPLE_VERSION = 83;
+		// MapleStory's server to client ping opcode
+		static constexpr unsigned char KEEPALIVE_MESSAGE[] = { 0x11, 0x00 };
+
+		// Called once per received message on the connection's strand.
+		// _message points into the receive ring, use copyMessage() to keep it past the call
+		typedef std::function<void(TCPConnection& _connection, MessageView _message)> MessageHandler;
+		// Called once, on the connection's strand, when the connection is shut down
+		typedef std::function<void(TCPConnection& _connection)> CloseHandler;
+		// Replaces the MessageHandler when set. Returns the coroutine the connection runs its whole session in,
+		// on the connection's strand. The session keeps the connection alive until it returns
+		typedef std::function<SessionTask<>(std::shared_ptr<TCPConnection> _connection)> SessionHandler;
+		// Called on the connection's strand when its write queue reaches the high watermark (true)
+		// and again once it has drained to the low watermark (false). Reads are paused in between
+		typedef std::function<void(TCPConnection& _connection, bool _backedUp)> BackpressureHandler;
+		// The socket is typed on its strand instead of the type-erased any_io_executor,
+		// which would otherwise heap allocate a copy of the strand for every completion
+		typedef boost::asio::strand<boost::asio::io_context::executor_type> Strand;
+		typedef boost::asio::basic_stream_socket<boost::asio::ip::tcp, Strand> Socket;
+
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		TCPConnection() = delete;
+
+		// Deconstructor
+		~TCPConnection()
+		{
+			// The last reference can go on any thread, so a shut down connection must not hold a Timer still linked into its
+			// wheel (~Timer would unlink it off the wheel's thread). Only connections torn down with the server skip handleShutdown()
+			assert(this->mSocketActive || (!this->idleTimer.isArmed() && !this->writeStallTimer.isArmed()
+											&& !this->keepAliveTimer.isArmed() && !this->slowConsumerTimer.isArmed()));
+
+			// Packets that never made it out no longer count as queued
+			Metrics::add(MetricCounter::WriteQueueDepth, -static_cast<int64_t>(this->writeBufferQueue.size()));
+			WriteBudget::release(this->queuedBytes);
+		}
+
+		// Every connection gets its own strand so its handlers never run concurrently,
+		// no matter how many threads end up running _ioContext
+		static std::shared_ptr<TCPConnection> create(boost::asio::io_context& _ioContext, MessageHandler _messageHandler = echo)
+		{
+			return std::shared_ptr<TCPConnection>(new TCPConnection(_ioContext, std::move(_messageHandler)));
+		}
+
+		/*****************
+		 * Server Functions
+		 ****************/
+		void start()
+		{
+			unsigned char iv1[4] = { 70, 114, 122, static_cast<unsigned char>(rand() % 127) };
+			unsigned char iv2[4] = { 82,  48, 120, static_cast<unsigned char>(rand() % 127) };
+		
+			// This is the packet for the MapleStory Global(NA) handshake
+			// The framer prepends the 2 byte length (0x0E)
+			std::vector<unsigned char> buff;
+			buff.push_back(MAPLE_VERSION & 0xFF);
+			buff.push_back(MAPLE_VERSION >> 8);
+			buff.push_back(1);
+			buff.push_back(0);
+			buff.push_back(49);
+			for(int i = 0; i < 4; ++i) { buff.push_back(iv1[i]); }
+			for(int i = 0; i < 4; ++i) { buff.push_back(iv2[i]); }
+			buff.push_back(8);
+
+			this->send(std::as_bytes(std::span(buff)));
+			this->startTimers();
+
+			// The handshake itself goes out in the clear, everything after it is encrypted.
+			// We receive with iv1 and send with iv2
+			if(this->cipherEnabled)
+			{
+				this->receiveCipher = MapleCipher(iv1, MAPLE_VERSION);
+				this->sendCipher = MapleCipher(iv2, 0xFFFF - MAPLE_VERSION);
+				this->framer = MapleCipher::makeFramer(this->receiveCipher);
+				this->cipherActive = true;
+			}
+
+			// We're already on the strand, the session runs inline up to its first read
+			if(this->sessionHandler)
+			{
+				spawnSession(this->socket.get_executor(), this->sessionHandler(shared_from_this()));
+				return;
+			}
+			this->read();
+		}
+
+		void shutdown()
+		{
+			// The socket may only be touched from the connection's strand.
+			// Runs inline when we're already on it (i.e. from handleRead/handleWrite)
+			boost::asio::dispatch(this->socket.get_executor(),
+								  boost::bind(&TCPConnection::handleShutdown, shared_from_this()));
+		}
+
+		void read()
+		{
+			// A handler may have shut the connection down, the socket is closed
+			if(!this->mSocketActive)
+			{
+				return;
+			}
+
+			// The write queue is backed up, the read is issued once it drains
+			if(this->backedUp)
+			{
+				this->readDeferred = true;
+				return;
+			}
+
+			// Read whatever the socket has into readBuffer, the framer splits it into messages
+			this->socket.async_read_some(this->readBuffer.prepare(this->framer.getReadSize()),
+										 makeAllocHandler(this->readHandlerMemory,
+														  boost::bind(&TCPConnection::handleRead,
+																	  shared_from_this(),
+																	  boost::asio::placeholders::error,
+																	  boost::asio::placeholders::bytes_transferred)));
+		}
+
+		void write()
+		{
+			// Async write
+			// Only one write in flight at a time, anything queued meanwhile goes out with the next one
+			if(this->writeBufferQueue.size() > 0 && this->mSocketActive && this->writeBuffersInFlight == 0)
+			{
+				// Gather as many queued packets as the limits allow into one write
+				size_t bytes = 0;
+				this->writeBuffers.clear();
+				for(const QueuedPacket& queued : this->writeBufferQueue)
+				{
+					const PacketBuffer& packet = queued.packet;
+					if(this->writeBuffers.size() == MAX_WRITE_BUFFERS || (bytes > 0 && bytes + packet.size() > MAX_WRITE_BYTES))
+					{
+						break;
+					}
+					this->writeBuffers.push_back(boost::asio::buffer(packet.data(), packet.size()));
+					bytes += packet.size();
+				}
+				this->writeBuffersInFlight = this->writeBuffers.size();
+
+				// Armed once per run of writes, handleWrite() stamps each completion and the timer checks the stamp
+				if(this->timingWheel != nullptr && this->timeouts.writeStall > std::chrono::steady_clock::duration::zero())
+				{
+					this->lastWriteAt = this->timingWheel->now();
+					if(!this->writeStallTimer.isArmed())
+					{
+						this->timingWheel->schedule(this->writeStallTimer, this->timeouts.writeStall);
+					}
+				}
+
+				// Pass the gather list as a span, async_write would otherwise copy the vector every write
+				boost::asio::async_write(this->socket,
+										std::span<const boost::asio::const_buffer>(this->writeBuffers),
+										makeAllocHandler(this->writeHandlerMemory,
+														 boost::bind(&TCPConnection::handleWrite,
+																	 shared_from_this(),
+																	 boost::asio::placeholders::error,
+																	 boost::asio::placeholders::bytes_transferred)));
+			}
+		}
+
+		// Frame and queue a message, must be called from the connection's strand
+		void send(MessageView _message)
+		{
+			PacketBuffer packet = PacketBuffer::allocate(_message.size() + this->framer.getFrameOverhead());
+			this->framer.encode(packet.data(), _message.data(), _message.size());
+
+			this->sendPacket(std::move(packet));
+		}
+
+		// Queue an already framed packet, must be called from the connection's strand.
+		// The packet can be shared with any number of other connections' queues
+		void sendPacket(PacketBuffer _packet, PacketPriority _priority = PacketPriority::Normal)
+		{
+			this->queuePacket(std::move(_packet), _priority);
+			this->write();
+		}
+
+		// sendPacket() from any thread. Packets go through the connection's submission queue, only the first
+		// packet into an empty queue posts to the strand and the strand takes the whole batch in one write
+		void postPacket(PacketBuffer _packet, PacketPriority _priority = PacketPriority::Normal)
+		{
+			if(this->submissions.push(PostedPacket { std::move(_packet), _priority }))
+			{
+				boost::asio::post(this->socket.get_executor(),
+								  boost::bind(&TCPConnection::drainSubmissions, shared_from_this()));
+			}
+		}
+
+		// Queue a packet for the next write(), must be called from the connection's strand.
+		// Returns false if backpressure turned it away or the connection is already shut down
+		bool queuePacket(PacketBuffer _packet, PacketPriority _priority = PacketPriority::Normal)
+		{
+			// Nothing goes out after shutdown, and nothing may reserve budget or arm timers that handleShutdown() already let go of
+			if(!this->mSocketActive)
+			{
+				return false;
+			}
+
+			// Turned away before it's logged or encrypted, the cipher only advances for packets that go out
+			size_t size = _packet.size();
+			if(!this->admitPacket(size, _priority))
+			{
+				return false;
+			}
+
+			// Traced before encryption, the log is for reading
+			PacketLogger::log(this->sessionId, PacketDirection::Sent, _packet.view());
+
+			// Packets are encrypted in the order they're queued, which is the order the peer decrypts them in
+			if(this->cipherActive)
+			{
+				// The cipher state is per connection, a packet other queues still hold gets a private copy first
+				if(_packet.useCount() > 1)
+				{
+					_packet = PacketBuffer::copyOf(_packet.data(), _packet.size());
+				}
+				this->sendCipher.encrypt(_packet.data(), _packet.data() + MapleCipher::HEADER_SIZE, _packet.size() - MapleCipher::HEADER_SIZE);
+			}
+
+			this->writeBufferQueue.push_back(QueuedPacket { std::move(_packet), std::chrono::steady_clock::now() });
+			Metrics::add(MetricCounter::WriteQueueDepth);
+			ConnectionStats::add(this->stats.writeQueueDepth);
+			ConnectionStats::add(this->stats.writeQueueBytes, size);
+			if(this->timingWheel != nullptr)
+			{
+				this->lastSendAt = this->timingWheel->now();
+			}
+
+			this->queuedBytes += size;
+			if(!this->backedUp && this->queuedBytes >= this->watermarks.high)
+			{
+				this->startBackpressure();
+			}
+			return true;
+		}
+
+		// Default message handler, echoes the message back
+		static void echo(TCPConnection& _connection, MessageView _message)
+		{
+			_connection.send(_message);
+		}
+
+		/*****************
+		 * Session Functions
+		 ****************/
+		// Only from the connection's session coroutine.
+		// co_await readFrame() gives the next message, or an error once the connection is gone
+		ReadFrameAwaiter<TCPConnection> readFrame() { return ReadFrameAwaiter<TCPConnection>(*this); }
+
+		// Queues _message like send() does, co_await it to wait until the write queue has drained
+		SendAwaiter<TCPConnection> asyncSend(MessageView _message)
+		{
+			this->send(_message);
+			return SendAwaiter<TCPConnection>(*this);
+		}
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		Socket& getSocket() { return this->socket; }
+		PacketFramer& getFramer() { return this->framer; }
+		bool isSocketActive() const { return this->mSocketActive; }
+		uint64_t getSessionId() const { return this->sessionId; }
+		const ConnectionStats& getStats() const { return this->stats; }
+
+		// Only set these before the connection is started
+		void setSessionId(uint64_t _sessionId) { this->sessionId = _sessionId; }
+		void setCloseHandler(CloseHandler _closeHandler) { this->closeHandler = std::move(_closeHandler); }
+		void setSessionHandler(SessionHandler _sessionHandler) { this->sessionHandler = std::move(_sessionHandler); }
+		// Encrypts everything after the handshake with the MapleStory packet cipher
+		void setCipherEnabled(bool _cipherEnabled) { this->cipherEnabled = _cipherEnabled; }
+		void setBackpressureHandler(BackpressureHandler _backpressureHandler) { this->backpressureHandler = std::move(_backpressureHandler); }
+		// The slow consumer deadline needs a timing wheel
+		void setWriteWatermarks(const WriteWatermarks& _watermarks) { this->watermarks = _watermarks; }
+		bool isBackedUp() const { return this->backedUp; }
+		// The wheel must belong to the io_context the connection runs on, no wheel means no timeouts
+		void setTimingWheel(TimingWheel* _timingWheel, const ConnectionTimeouts& _timeouts)
+		{
+			this->timingWheel = _timingWheel;
+			this->timeouts = _timeouts;
+		}
+
+	private:
+		TCPConnection(boost::asio::io_context& _ioContext, MessageHandler _messageHandler) : socket(boost::asio::make_strand(_ioContext.get_executor())), messageHandler(std::move(_messageHandler))
+		{
+			this->mSocketActive = true;
+		}
+
+		void drainSubmissions()
+		{
+			this->submissions.drain([this](PostedPacket _posted)
+			{
+				this->queuePacket(std::move(_posted.packet), _posted.priority);
+			});
+			this->write();
+		}
+
+		void handleShutdown()
+		{
+			// Read and write errors can both end up here, only the first shutdown counts
+			if(!this->mSocketActive)
+			{
+				return;
+			}
+			this->mSocketActive = false;
+			Metrics::add(MetricCounter::Disconnects);
+			this->idleTimer.cancel();
+			this->writeStallTimer.cancel();
+			this->keepAliveTimer.cancel();
+			this->slowConsumerTimer.cancel();
+
+			// Handles and ignores
+			// `The I/O operation has been aborted because of either a thread exit or an application request` exception
+			// for a quick and dirty shutdown
+			try
+			{
+				// Shutdown read/write
+				this->socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both);
+			}
+			catch(std::exception _error)
+			{
+				std::cout << "Error: " << _error.what() << '\n';
+			}
+
+			// Close the socket itself even if the peer was already gone and shutdown threw
+			boost::system::error_code error;
+			this->socket.close(error);
+
+			if(this->closeHandler)
+			{
+				this->closeHandler(*this);
+			}
+
+			// A session parked on a paused read would never hear the connection went away
+			if(this->deferredSession)
+			{
+				this->deferredResult->error = boost::asio::error::not_connected;
+				std::exchange(this->deferredSession, nullptr).resume();
+			}
+		}
+
+		void handleRead(const boost::system::error_code& _error, size_t _bytes_transferred)
+		{
+			// If theres an async error, close the connection
+			if (!_error)
+			{
+				this->commitRead(_bytes_transferred);
+
+				// A single read can hold several messages, handle every complete one before reading again
+				// Messages are handed out as views into the receive ring, no copies
+				// A handler can shut the connection down (send() does when the write budget runs out), stop handing out messages then
+				MessageView message;
+				PacketFramer::Status status = PacketFramer::Status::Incomplete;
+				while(this->mSocketActive && (status = this->takeFrame(message)) == PacketFramer::Status::Complete)
+				{
+					// Process data
+					std::chrono::steady_clock::time_point handlerStart = std::chrono::steady_clock::now();
+					this->messageHandler(*this, message);
+					Metrics::record(MetricHistogram::HandlerTime, std::chrono::steady_clock::now() - handlerStart);
+					Metrics::add(MetricCounter::MessagesReceived);
+					ConnectionStats::add(this->stats.messagesReceived);
+				}
+
+				if(status == PacketFramer::Status::Invalid || !this->mSocketActive)
+				{
+					return;
+				}
+
+				this->read();
+			}
+			else
+			{
+				this->failRead(_error);
+			}
+		}
+
+		void commitRead(size_t _bytes_transferred)
+		{
+			this->readBuffer.commit(_bytes_transferred);
+			Metrics::add(MetricCounter::BytesReceived, static_cast<int64_t>(_bytes_transferred));
+			ConnectionStats::add(this->stats.bytesReceived, _bytes_transferred);
+
+			// Just a stamp, the idle timer checks it when it fires instead of every read rescheduling it
+			if(this->timingWheel != nullptr)
+			{
+				this->lastReadAt = this->timingWheel->now();
+			}
+		}
+
+		void failRead(const boost::system::error_code& _error)
+		{
+			// A read aborted by our own shutdown isn't an error, the shutdown already said why
+			if(!this->mSocketActive)
+			{
+				return;
+			}
+
+			if(!isPeerClosed(_error))
+			{
+				Metrics::add(MetricCounter::Errors);
+			}
+			std::cout << "Error: " << _error.message() << '\n';
+			this->shutdown();
+		}
+
+		// The peer hanging up, cleanly or not, is a disconnect rather than an error
+		static bool isPeerClosed(const boost::system::error_code& _error)
+		{
+			return _error == boost::asio::error::eof || _error == boost::asio::error::connection_reset || _error == boost::asio::error::broken_pipe;
+		}
+
+		// Consumes the message handed out last, then pulls the next complete one out of the ring.
+		// A malformed or oversized frame shuts the connection down
+		PacketFramer::Status takeFrame(MessageView& _message)
+		{
+			// Clear the last message from the read buffer, this invalidates its view
+			this->readBuffer.consume(this->takenFrameSize);
+			this->takenFrameSize = 0;
+
+			PacketFramer::Frame frame;
+			PacketFramer::Status status = this->framer.nextFrame(this->readBuffer.data(), frame);
+			if(status == PacketFramer::Status::Complete)
+			{
+				// Decrypt in place, the ring owns these bytes until they're consumed
+				if(this->cipherActive)
+				{
+					this->receiveCipher.decrypt(this->readBuffer.mutableData().data() + frame.bodyOffset, frame.bodySize);
+				}
+				PacketLogger::log(this->sessionId, PacketDirection::Received, this->readBuffer.data().first(frame.frameSize));
+
+				_message = this->readBuffer.data().subspan(frame.bodyOffset, frame.bodySize);
+				this->takenFrameSize = frame.frameSize;
+			}
+			else if(status == PacketFramer::Status::Invalid)
+			{
+				std::cout << "Error: invalid frame" << '\n';
+				this->shutdown();
+			}
+			return status;
+		}
+
+		/*****************
+		 * Session awaiter hooks
+		 ****************/
+		template <typename> friend class ReadFrameAwaiter;
+		template <typename> friend class SendAwaiter;
+
+		// True when readFrame() can complete without reading from the socket
+		bool pollFrame(SessionRead& _result)
+		{
+			if(!this->mSocketActive)
+			{
+				_result.error = boost::asio::error::not_connected;
+				return true;
+			}
+
+			PacketFramer::Status status = this->takeFrame(_result.message);
+			if(status == PacketFramer::Status::Complete)
+			{
+				Metrics::add(MetricCounter::MessagesReceived);
+				ConnectionStats::add(this->stats.messagesReceived);
+				return true;
+			}
+			if(status == PacketFramer::Status::Invalid)
+			{
+				_result.error = boost::system::errc::make_error_code(boost::system::errc::bad_message);
+				return true;
+			}
+			return false;
+		}
+
+		// Reads until a whole frame is in, then resumes the session.
+		// The session holds the connection, so the handler doesn't need its own shared_ptr
+		void readFrameAsync(std::coroutine_handle<> _session, SessionRead& _result)
+		{
+			if(this->backedUp)
+			{
+				this->deferredSession = _session;
+				this->deferredResult = &_result;
+				this->readDeferred = true;
+				return;
+			}
+
+			this->socket.async_read_some(this->readBuffer.prepare(this->framer.getReadSize()),
+										 makeAllocHandler(this->readHandlerMemory,
+														  [this, _session, &_result](const boost::system::error_code& _error, size_t _bytes_transferred)
+										 {
+											 if(_error)
+											 {
+												 this->failRead(_error);
+												 _result.error = _error;
+												 _session.resume();
+												 return;
+											 }
+
+											 this->commitRead(_bytes_transferred);
+											 if(this->pollFrame(_result))
+											 {
+												 _session.resume();
+											 }
+											 else
+											 {
+												 this->readFrameAsync(_session, _result);
+											 }
+										 }));
+		}
+
+		// True when nothing is left to write
+		bool pollWrites(boost::system::error_code& _error)
+		{
+			if(!this->mSocketActive)
+			{
+				_error = boost::asio::error::not_connected;
+				return true;
+			}
+			return this->writeBufferQueue.empty();
+		}
+
+		void waitForWrites(std::coroutine_handle<> _session, boost::system::error_code& _error)
+		{
+			this->writeWaiter = _session;
+			this->writeWaiterError = &_error;
+		}
+
+		void resumeWriteWaiter(const boost::system::error_code& _error)
+		{
+			if(this->writeWaiter)
+			{
+				*this->writeWaiterError = _error;
+				std::exchange(this->writeWaiter, nullptr).resume();
+			}
+		}
+
+		void handleWrite(const boost::system::error_code& _error, size_t _bytes_transferred)
+		{
+			// If theres an async error, close the connection
+			if (!_error)
+			{
+				std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+				for(size_t i = 0; i < this->writeBuffersInFlight; ++i)
+				{
+					Metrics::record(MetricHistogram::QueueToWire, now - this->writeBufferQueue[i].queuedAt);
+				}
+				Metrics::add(MetricCounter::Writes);
+				Metrics::add(MetricCounter::BytesSent, static_cast<int64_t>(_bytes_transferred));
+				Metrics::add(MetricCounter::MessagesSent, static_cast<int64_t>(this->writeBuffersInFlight));
+				Metrics::add(MetricCounter::WriteQueueDepth, -static_cast<int64_t>(this->writeBuffersInFlight));
+				ConnectionStats::add(this->stats.bytesSent, _bytes_transferred);
+				ConnectionStats::add(this->stats.messagesSent, this->writeBuffersInFlight);
+				ConnectionStats::subtract(this->stats.writeQueueDepth, this->writeBuffersInFlight);
+
+				// Pop every packet that went out with the write
+				size_t writtenBytes = 0;
+				for(size_t i = 0; i < this->writeBuffersInFlight; ++i)
+				{
+					writtenBytes += this->writeBufferQueue[i].packet.size();
+				}
+				this->writeBufferQueue.erase(this->writeBufferQueue.begin(), this->writeBufferQueue.begin() + this->writeBuffersInFlight);
+				this->writeBuffersInFlight = 0;
+				this->queuedBytes -= writtenBytes;
+				WriteBudget::release(writtenBytes);
+				ConnectionStats::subtract(this->stats.writeQueueBytes, writtenBytes);
+				if(this->backedUp && this->queuedBytes <= this->watermarks.low)
+				{
+					this->stopBackpressure();
+				}
+
+				if(this->writeBufferQueue.size() > 0)
+				{
+					this->write();
+				}
+				else
+				{
+					this->writeStallTimer.cancel();
+					this->resumeWriteWaiter(_error);
+				}
+			}
+			else
+			{
+				// A write aborted by our own shutdown isn't an error, the shutdown already said why
+				if(!this->mSocketActive)
+				{
+					this->resumeWriteWaiter(_error);
+					return;
+				}
+
+				if(!isPeerClosed(_error))
+				{
+					Metrics::add(MetricCounter::Errors);
+				}
+				std::cout << "Error: " << _error.message() << '\n';
+				this->shutdown();
+				this->resumeWriteWaiter(_error);
+			}
+		}
+
+		/*****************
+		 * Backpressure Functions
+		 ****************/
+		bool admitPacket(size_t _size, PacketPriority _priority)
+		{
+			if(_priority == PacketPriority::Low && this->backedUp && this->watermarks.policy == SlowConsumerPolicy::DropLowPriority)
+			{
+				Metrics::add(MetricCounter::PacketsDropped);
+				return false;
+			}
+			if(WriteBudget::tryReserve(_size))
+			{
+				return true;
+			}
+
+			// Out of budget. Low priority packets go first, then whichever connections are sitting on the budget
+			if(_priority == PacketPriority::Low)
+			{
+				Metrics::add(MetricCounter::PacketsDropped);
+				return false;
+			}
+			if(this->queuedBytes > this->watermarks.low)
+			{
+				Metrics::add(MetricCounter::SlowConsumers);
+				std::cout << "Error: write budget exhausted" << '\n';
+				this->shutdown();
+				return false;
+			}
+
+			// A connection that keeps up gets its packet even over budget, it isn't what's holding it
+			WriteBudget::reserve(_size);
+			return true;
+		}
+
+		void startBackpressure()
+		{
+			this->backedUp = true;
+			if(this->watermarks.policy == SlowConsumerPolicy::Disconnect && this->timingWheel != nullptr
+			   && this->watermarks.slowConsumerDeadline > std::chrono::steady_clock::duration::zero())
+			{
+				this->slowConsumerTimer.setCallback(this->makeTimeoutCallback(&TCPConnection::handleSlowConsumer));
+				this->timingWheel->schedule(this->slowConsumerTimer, this->watermarks.slowConsumerDeadline);
+			}
+			if(this->backpressureHandler)
+			{
+				this->backpressureHandler(*this, true);
+			}
+		}
+
+		void stopBackpressure()
+		{
+			this->backedUp = false;
+			this->slowConsumerTimer.cancel();
+			if(this->backpressureHandler)
+			{
+				this->backpressureHandler(*this, false);
+			}
+
+			if(this->readDeferred && this->mSocketActive)
+			{
+				this->readDeferred = false;
+				if(this->deferredSession)
+				{
+					this->readFrameAsync(std::exchange(this->deferredSession, nullptr), *this->deferredResult);
+				}
+				else
+				{
+					this->read();
+				}
+			}
+		}
+
+		void handleSlowConsumer()
+		{
+			if(!this->mSocketActive || !this->backedUp)
+			{
+				return;
+			}
+
+			Metrics::add(MetricCounter::SlowConsumers);
+			std::cout << "Error: slow consumer" << '\n';
+			this->shutdown();
+		}
+
+		/*****************
+		 * Timeout Functions
+		 ****************/
+		// The wheel fires on its io_context's thread, each check hops onto the connection's strand before touching it
+		void startTimers()
+		{
+			if(this->timingWheel == nullptr)
+			{
+				return;
+			}
+
+			this->lastReadAt = this->timingWheel->now();
+			this->lastWriteAt = this->lastReadAt;
+			this->lastSendAt = this->lastReadAt;
+			this->idleTimer.setCallback(this->makeTimeoutCallback(&TCPConnection::handleIdleTimeout));
+			this->writeStallTimer.setCallback(this->makeTimeoutCallback(&TCPConnection::handleWriteStall));
+			this->keepAliveTimer.setCallback(this->makeTimeoutCallback(&TCPConnection::handleKeepAlive));
+
+			if(this->timeouts.idle > std::chrono::steady_clock::duration::zero())
+			{
+				this->timingWheel->schedule(this->idleTimer, this->timeouts.idle);
+			}
+			if(this->timeouts.keepAlive > std::chrono::steady_clock::duration::zero())
+			{
+				this->timingWheel->schedule(this->keepAliveTimer, this->timeouts.keepAlive);
+			}
+		}
+
+		// Timers are members, they can't fire once the connection is gone, so the raw this is safe to hold
+		TimingWheel::Timer::Callback makeTimeoutCallback(void (TCPConnection::*_handler)())
+		{
+			return [this, _handler]()
+			{
+				boost::asio::dispatch(this->socket.get_executor(), boost::bind(_handler, shared_from_this()));
+			};
+		}
+
+		void handleIdleTimeout()
+		{
+			if(!this->mSocketActive)
+			{
+				return;
+			}
+
+			std::chrono::steady_clock::duration idle = this->timingWheel->now() - this->lastReadAt;
+			if(idle < this->timeouts.idle)
+			{
+				this->timingWheel->schedule(this->idleTimer, this->timeouts.idle - idle);
+				return;
+			}
+
+			Metrics::add(MetricCounter::Timeouts);
+			std::cout << "Error: idle timeout" << '\n';
+			this->shutdown();
+		}
+
+		void handleWriteStall()
+		{
+			if(!this->mSocketActive || this->writeBuffersInFlight == 0)
+			{
+				return;
+			}
+
+			std::chrono::steady_clock::duration stalled = this->timingWheel->now() - this->lastWriteAt;
+			if(stalled < this->timeouts.writeStall)
+			{
+				this->timingWheel->schedule(this->writeStallTimer, this->timeouts.writeStall - stalled);
+				return;
+			}
+
+			Metrics::add(MetricCounter::Timeouts);
+			std::cout << "Error: write stalled" << '\n';
+			this->shutdown();
+		}
+
+		void handleKeepAlive()
+		{
+			if(!this->mSocketActive)
+			{
+				return;
+			}
+
+			// Anything we sent since the last check already told the peer we're alive
+			if(this->timingWheel->now() - this->lastSendAt >= this->timeouts.keepAlive)
+			{
+				this->send(std::as_bytes(std::span(KEEPALIVE_MESSAGE)));
+			}
+
+			// send() shuts the connection down if the write budget has run out, handleShutdown() has let go of the timers then
+			if(!this->mSocketActive)
+			{
+				return;
+			}
+			this->timingWheel->schedule(this->keepAliveTimer, this->timeouts.keepAlive - (this->timingWheel->now() - this->lastSendAt));
+		}
+
+		// A packet waiting for the socket, stamped so we can tell how long it waited
+		struct QueuedPacket
+		{
+			PacketBuffer packet;
+			std::chrono::steady_clock::time_point queuedAt;
+		};
+
+		// A packet on its way from another thread
+		struct PostedPacket
+		{
+			PacketBuffer packet;
+			PacketPriority priority;
+		};
+
+		// Read by the server's reaper from other threads
+		std::atomic<bool> mSocketActive = false;
+		uint64_t sessionId = 0;
+		Socket socket;
+		ReceiveRing readBuffer;
+		// Size of the frame takeFrame() handed out last, it stays in the ring until the next takeFrame()
+		size_t takenFrameSize = 0;
+		// Pooled, already framed packets
+		std::deque<QueuedPacket> writeBufferQueue;
+		// The gather list for the write in flight, reused between writes
+		std::vector<boost::asio::const_buffer> writeBuffers;
+		size_t writeBuffersInFlight = 0;
+		// Completion handler memory, one read and one write are in flight at most
+		HandlerMemory readHandlerMemory;
+		HandlerMemory writeHandlerMemory;
+		PacketFramer framer;
+		// One cipher per direction, each with its own IV. The framer checks headers against receiveCipher
+		MapleCipher receiveCipher;
+		MapleCipher sendCipher;
+		bool cipherEnabled = false;
+		bool cipherActive = false;
+		MessageHandler messageHandler;
+		CloseHandler closeHandler;
+		SessionHandler sessionHandler;
+		// Packets posted from other threads on their way to the strand
+		SubmissionQueue<PostedPacket> submissions;
+		// The session waiting in asyncSend() for the write queue to drain
+		std::coroutine_handle<> writeWaiter;
+		boost::system::error_code* writeWaiterError = nullptr;
+		ConnectionStats stats;
+		// Owned by the server, one per IO thread
+		TimingWheel* timingWheel = nullptr;
+		ConnectionTimeouts timeouts;
+		TimingWheel::Timer idleTimer;
+		TimingWheel::Timer writeStallTimer;
+		TimingWheel::Timer keepAliveTimer;
+		TimingWheel::Timer slowConsumerTimer;
+		// Stamped with the wheel's clock
+		TimingWheel::Clock::time_point lastReadAt;
+		TimingWheel::Clock::time_point lastWriteAt;
+		TimingWheel::Clock::time_point lastSendAt;
+		// Bytes in writeBufferQueue, all of them counted against the WriteBudget
+		size_t queuedBytes = 0;
+		WriteWatermarks watermarks;
+		BackpressureHandler backpressureHandler;
+		// Above the high watermark and not yet back down to the low one, reads are paused
+		bool backedUp = false;
+		// A read that was due while paused, for a session it's the read the session is parked on
+		bool readDeferred = false;
+		std::coroutine_handle<> deferredSession;
+		SessionRead* deferredResult = nullptr;
+};
+
+class TCPServer : public std::enable_shared_from_this<TCPServer>
+{
+	typedef std::shared_ptr<TCPConnection> Connection; 
+	typedef ConnectionRegistry<TCPConnection> Connections;
+	public:
+		// How often the server sweeps its registry for connections that died without telling it
+		static constexpr std::chrono::seconds REAP_INTERVAL = std::chrono::seconds(30);
+
+		// Picks which connections a broadcast goes to, an empty filter means everyone
+		typedef std::function<bool(const TCPConnection& _connection)> BroadcastFilter;
+
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		TCPServer() = delete;
+
+		// Parameterized constructors
+		// A thread count of 0 runs one io_context per hardware thread
+		TCPServer(size_t _port, size_t _threadCount = 0) : ioContextPool(_threadCount),
+														  acceptor(ioContextPool.getIOContext(0), boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), _port)),
+														  reapTimer(ioContextPool.getIOContext(0))
+		{
+			// One timing wheel per IO thread, shared by every connection on it
+			for(size_t i = 0; i < this->ioContextPool.size(); ++i)
+			{
+				this->timingWheels.push_back(std::make_unique<TimingWheel>(this->ioContextPool.getIOContext(i)));
+				this->timingWheels.back()->start();
+			}
+		}
+			
+		// Destructor
+		~TCPServer() 
+		{
+			this->shutdown();
+		}
+		
+		/****************
+		 * Server functions
+		 ***************/
+		void startAccept()
+		{
+			// Async accept connection
+			// New connections are spread round-robin across the io_context pool
+			size_t index = this->ioContextPool.nextIndex();
+			std::shared_ptr<TCPConnection> newConnection = TCPConnection::create(this->ioContextPool.getIOContext(index), this->messageHandler);
+			newConnection->setTimingWheel(this->timingWheels[index].get(), this->timeouts);
+			newConnection->setWriteWatermarks(this->watermarks);
+			newConnection->setBackpressureHandler(this->backpressureHandler);
+			newConnection->setCipherEnabled(this->cipherEnabled);
+			newConnection->setSessionHandler(this->sessionHandler);
+			this->acceptor.async_accept(newConnection->getSocket(),
+										boost::bind(&TCPServer::handleAccept,
+										shared_from_this(),
+										newConnection,
+										boost::asio::placeholders::error));
+		}
+
+		void shutdown()
+		{
+			this->connections.forEach([](Connection& _connection) { _connection->shutdown(); });
+		}
+
+		// Send one message to many connections, safe from any thread.
+		// The message is framed once into a single pooled packet and every recipient's write queue
+		// holds a reference to it, so memory stays flat no matter how many connections it goes to.
+		// Each connection picks it up on its own IO thread. Broadcasts are low priority by default,
+		// the first thing a backed up connection drops. Returns the number of recipients
+		size_t broadcast(MessageView _message, const BroadcastFilter& _filter = nullptr, PacketPriority _priority = PacketPriority::Low)
+		{
+			PacketBuffer packet = PacketBuffer::allocate(_message.size() + this->framer.getFrameOverhead());
+			this->framer.encode(packet.data(), _message.data(), _message.size());
+
+			size_t recipients = 0;
+			this->connections.forEach([&packet, &_filter, _priority, &recipients](Connection& _connection)
+			{
+				if(_connection->isSocketActive() && (!_filter || _filter(*_connection)))
+				{
+					_connection->postPacket(packet, _priority);
+					recipients++;
+				}
+			});
+			return recipients;
+		}
+
+		// Connections normally leave the registry as they shut down, this catches any that didn't
+		void startReaping()
+		{
+			this->reapTimer.expires_after(REAP_INTERVAL);
+			this->reapTimer.async_wait(boost::bind(&TCPServer::handleReap,
+												   shared_from_this(),
+												   boost::asio::placeholders::error));
+		}
+
+		// Process wide metrics followed by up to _connectionLimit connections' own counters
+		void writeStats(std::ostream& _out, size_t _connectionLimit = SIZE_MAX)
+		{
+			Metrics::getSnapshot().writeText(_out);
+			_out << "connections " << this->connections.size() << '\n';
+			_out << "write_budget_bytes " << WriteBudget::getUsed() << " of " << WriteBudget::getLimit() << '\n';
+
+			size_t listed = 0;
+			this->connections.forEach([&_out, &listed, _connectionLimit](Connection& _connection)
+			{
+				if(listed++ >= _connectionLimit)
+				{
+					return;
+				}
+				const ConnectionStats& stats = _connection->getStats();
+				_out << "connection " << _connection->getSessionId()
+					 << " bytes_received " << ConnectionStats::get(stats.bytesReceived)
+					 << " bytes_sent " << ConnectionStats::get(stats.bytesSent)
+					 << " messages_received " << ConnectionStats::get(stats.messagesReceived)
+					 << " messages_sent " << ConnectionStats::get(stats.messagesSent)
+					 << " write_queue_depth " << ConnectionStats::get(stats.writeQueueDepth)
+					 << " write_queue_bytes " << ConnectionStats::get(stats.writeQueueBytes)
+					 << (_connection->isBackedUp() ? " backed_up" : "") << '\n';
+			});
+		}
+
+		// Blocks until stop() is called
+		void run()
+		{
+			this->ioContextPool.run();
+		}
+
+		void stop()
+		{
+			this->ioContextPool.stop();
+		}
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		size_t getThreadCount() const { return this->ioContextPool.size(); }
+		size_t getConnectionCount() const { return this->connections.size(); }
+
+		// Safe from any thread, returns nullptr once the session has disconnected
+		Connection getConnection(uint64_t _sessionId) { return this->connections.find(_sessionId); }
+
+		// Applies to connections accepted after the call
+		void setMessageHandler(TCPConnection::MessageHandler _messageHandler) { this->messageHandler = std::move(_messageHandler); }
+		// Applies to connections accepted after the call, runs each connection as a coroutine instead
+		void setSessionHandler(TCPConnection::SessionHandler _sessionHandler) { this->sessionHandler = std::move(_sessionHandler); }
+		// Applies to connections accepted after the call
+		void setTimeouts(const ConnectionTimeouts& _timeouts) { this->timeouts = _timeouts; }
+		// Apply to connections accepted after the call
+		void setWriteWatermarks(const WriteWatermarks& _watermarks) { this->watermarks = _watermarks; }
+		void setBackpressureHandler(TCPConnection::BackpressureHandler _backpressureHandler) { this->backpressureHandler = std::move(_backpressureHandler); }
+		// Bytes queued for writing over every connection, 0 for no limit. Process wide, shared with any other server
+		void setWriteBudget(size_t _bytes) { WriteBudget::setLimit(_bytes); }
+
+		// Applies to connections accepted after the call.
+		// Broadcasts are framed with room for the cipher's header, each connection encrypts its own copy
+		void setCipherEnabled(bool _cipherEnabled)
+		{
+			this->cipherEnabled = _cipherEnabled;
+			this->framer = _cipherEnabled ? PacketFramer::withHeader(MapleCipher::HEADER_SIZE) : PacketFramer();
+		}
+
+		void handleAccept(std::shared_ptr<TCPConnection> _newConnection, const boost::system::error_code& _error)
+		{
+			// If theres an async error, close the connection
+			if (!_error)
+			{
+				// Register the new connection under a fresh session ID and start communications.
+				// It removes itself from the registry when it shuts down
+				Metrics::add(MetricCounter::Accepts);
+				uint64_t sessionId = this->connections.nextSessionId();
+				std::weak_ptr<TCPServer> weakServer = shared_from_this();
+				_newConnection->setSessionId(sessionId);
+				_newConnection->setCloseHandler([weakServer](TCPConnection& _connection)
+				{
+					if(std::shared_ptr<TCPServer> server = weakServer.lock())
+					{
+						server->connections.remove(_connection.getSessionId());
+					}
+				});
+				this->connections.insert(sessionId, _newConnection);
+
+				// The connection is started on its own strand, not the acceptor's thread
+				boost::asio::post(_newConnection->getSocket().get_executor(),
+								  boost::bind(&TCPConnection::start, _newConnection));
+
+				// Async accept new client
+				this->startAccept();
+			}
+			else
+			{
+				std::cout << _error.message() << '\n';
+			}
+		}
+
+		void handleReap(const boost::system::error_code& _error)
+		{
+			if(!_error)
+			{
+				this->connections.removeIf([](const Connection& _connection) { return !_connection->isSocketActive(); });
+				this->startReaping();
+			}
+		}
+
+	private:
+		// Declared before the acceptor, the acceptor lives on one of the pool's io_contexts
+		IOContextPool ioContextPool;
+		boost::asio::ip::tcp::acceptor acceptor;
+		boost::asio::steady_timer reapTimer;
+		// Declared after the pool so they're torn down before the io_contexts they tick on
+		std::vector<std::unique_ptr<TimingWheel>> timingWheels;
+		ConnectionTimeouts timeouts;
+		WriteWatermarks watermarks;
+		TCPConnection::BackpressureHandler backpressureHandler;
+		Connections connections;
+		// Frames broadcasts, connections use the same framing
+		PacketFramer framer;
+		bool cipherEnabled = false;
+		TCPConnection::MessageHandler messageHandler = TCPConnection::echo;
+		TCPConnection::SessionHandler sessionHandler;
+};
+
+#endif
@@ -1,28 +1,45 @@
+#include <algorithm>
+#include <future>
 #include <iostream>
 #include <ios>
 #include <limits>
-#include <mutex>
 #include <thread>
-#include <queue>
 
-std::mutex m;
-std::priority_queue<int> q;
+#include "concurrent_priority_queue.hpp"
+#include "task_scheduler.hpp"
+
+// Producers push into independently locked shards instead of queueing up on one mutex.
+// Strict so the single threaded drain at the end still comes out in exact priority order
+ConcurrentPriorityQueue<int> q(0, PriorityOrder::Strict);
+// Background jobs run on a fixed set of workers instead of a new std::thread each
+TaskScheduler scheduler;
 
 void threadFunc(int);
-void pushToStack(int);
+void pushToStack(ConcurrentPriorityQueue<int>::Producer&, int);
 
 void threadFunc(int n = 10)
 {
-    for(int i = 0; i < n; ++i)
+    // Split into jobs, idle workers steal a share of them.
+    // Each job batches its pushes and merges them into the queue with one lock when it's done
+    size_t batchSize = ConcurrentPriorityQueue<int>::Producer::DEFAULT_BATCH_SIZE;
+    TaskGroup jobs(scheduler);
+    for(int begin = 0; begin < n; begin += batchSize)
     {
-        pushToStack(i);
+        jobs.run([begin, n, batchSize]()
+        {
+            ConcurrentPriorityQueue<int>::Producer producer(q, batchSize);
+            for(int i = begin; i < std::min<int>(n, begin + batchSize); ++i)
+            {
+                pushToStack(producer, i);
+            }
+        });
     }
+    jobs.wait();
 }
 
-void pushToStack(int i)
+void pushToStack(ConcurrentPriorityQueue<int>::Producer& producer, int i)
 {
-    std::lock_guard<std::mutex> lock(m);
-    q.push(i);
+    producer.push(i);
 }
 
 int main(int argc, char* argv[])
@@ -51,22 +68,23 @@ int main(int argc, char* argv[])
     };
 	
     std::thread t1(inputLoop);
-    std::thread t2(threadFunc, 100);
-    std::thread t3([]{ threadFunc(); }); // Thread function with a default parameter must be called via lambda
+    // inputLoop blocks on std::cin the whole time, it keeps its own thread rather than tying up a worker
+    std::future<void> job1 = scheduler.submit([]{ threadFunc(100); });
+    std::future<void> job2 = scheduler.submit([]{ threadFunc(); }); // Function with a default parameter must be called via lambda
     
     // Do stuff here
     
 	t1.join();
-	t2.join();
-	t3.join();
+	job1.get();
+	job2.get();
 	
     std::cout << '\n';
     std::cout << "Queue length: " << q.size() << '\n';
     int index = 0;
-    while(q.size())
+    int value;
+    while(q.tryPop(value))
     {
-        std::cout << index << ": " << q.top() << '\n';
-        q.pop();
+        std::cout << index << ": " << value << '\n';
         index++;
     }
 	std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
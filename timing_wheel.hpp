@@ -0,0 +1,267 @@
+#ifndef TIMINGWHEEL_H
+#define TIMINGWHEEL_H
+
+// C++
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+// Boost
+#include <boost/asio.hpp>
+
+// Hierarchical timing wheel, one per IO thread, for timeouts on every connection it serves.
+// Time moves in ticks. Level 0 has a slot per tick for the next 64 ticks, every level above covers 64 times
+// the span of the one below, and as time reaches a higher slot its timers cascade down a level.
+// Scheduling and cancelling are O(1) list splices into caller-owned Timers, so arming a timeout never allocates,
+// and a single steady_timer drives the whole wheel however many connections hang off it.
+// Not thread safe, only touch it (and its Timers) from the thread running its io_context
+class TimingWheel
+{
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		static constexpr size_t SLOT_BITS = 6;
+		static constexpr size_t SLOTS = size_t(1) << SLOT_BITS;
+		static constexpr size_t LEVELS = 4;
+		// Timers further out than this are clamped to it, about 19 days at the default tick
+		static constexpr uint64_t MAX_TICKS = (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+		static constexpr Clock::duration DEFAULT_TICK = std::chrono::milliseconds(100);
+
+		// One timeout, embedded in whatever it times out. Destroying an armed Timer cancels it
+		class Timer
+		{
+			friend class TimingWheel;
+			public:
+				typedef std::function<void()> Callback;
+
+				/*****************
+				 * Constructors
+				 ****************/
+				// Default constructor
+				Timer() = default;
+
+				// The wheel links Timers by address, don't copy them
+				Timer(const Timer& other) = delete;
+				Timer& operator=(const Timer& other) = delete;
+
+				// Destructor
+				~Timer()
+				{
+					this->cancel();
+				}
+
+				/*****************
+				 * Timer Functions
+				 ****************/
+				void cancel()
+				{
+					if(this->wheel != nullptr)
+					{
+						this->wheel->unlink(*this);
+					}
+				}
+
+				/*****************
+				 * Getters & Setters
+				 ****************/
+				bool isArmed() const { return this->wheel != nullptr; }
+				// Set once up front, rescheduling keeps it
+				void setCallback(Callback _callback) { this->callback = std::move(_callback); }
+
+			private:
+				// Set while armed
+				TimingWheel* wheel = nullptr;
+				// The list head we're on, so unlinking the first Timer of a slot is O(1) too
+				Timer** slot = nullptr;
+				Timer* prev = nullptr;
+				Timer* next = nullptr;
+				uint64_t expiry = 0;
+				Callback callback;
+		};
+
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		TimingWheel() = delete;
+
+		// Parameterized constructors
+		explicit TimingWheel(boost::asio::io_context& _ioContext, Clock::duration _tick = DEFAULT_TICK) : tickTimer(_ioContext), tick(_tick)
+		{
+			for(std::array<Timer*, SLOTS>& level : this->slots)
+			{
+				level.fill(nullptr);
+			}
+		}
+
+		// Timers point back at the wheel, don't copy it
+		TimingWheel(const TimingWheel& other) = delete;
+		TimingWheel& operator=(const TimingWheel& other) = delete;
+
+		// Destructor
+		// Connections can outlive the wheel, disarm their Timers so they don't reach back into it
+		~TimingWheel()
+		{
+			for(std::array<Timer*, SLOTS>& level : this->slots)
+			{
+				for(Timer*& head : level)
+				{
+					while(head != nullptr)
+					{
+						this->unlink(*head);
+					}
+				}
+			}
+		}
+
+		/*****************
+		 * Wheel Functions
+		 ****************/
+		void start()
+		{
+			this->startTime = Clock::now();
+			this->currentTick = 0;
+			this->waitForTick();
+		}
+
+		void stop()
+		{
+			this->tickTimer.cancel();
+		}
+
+		// (Re)arms _timer to fire _delay from now, rounded up to whole ticks
+		void schedule(Timer& _timer, Clock::duration _delay)
+		{
+			_timer.cancel();
+
+			Clock::duration delay = std::clamp<Clock::duration>(_delay, this->tick, this->tick * MAX_TICKS);
+			_timer.expiry = this->currentTick + static_cast<uint64_t>((delay + this->tick - Clock::duration(1)) / this->tick);
+			this->link(_timer);
+		}
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		// The time of the current tick. Cheaper than Clock::now() and as accurate as the wheel itself
+		Clock::time_point now() const { return this->startTime + this->tick * this->currentTick; }
+		Clock::duration getTick() const { return this->tick; }
+		size_t getArmedCount() const { return this->armedCount; }
+
+	private:
+		void link(Timer& _timer)
+		{
+			// The lowest level whose span reaches the expiry. Expiring this very tick is
+			// possible while cascading, it lands in the level 0 slot about to fire
+			uint64_t delta = _timer.expiry - this->currentTick;
+			size_t level = 0;
+			while(level < LEVELS - 1 && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1))))
+			{
+				level++;
+			}
+
+			Timer*& head = this->slots[level][(_timer.expiry >> (SLOT_BITS * level)) & (SLOTS - 1)];
+			_timer.wheel = this;
+			_timer.slot = &head;
+			_timer.prev = nullptr;
+			_timer.next = head;
+			if(head != nullptr)
+			{
+				head->prev = &_timer;
+			}
+			head = &_timer;
+			this->armedCount++;
+		}
+
+		void unlink(Timer& _timer)
+		{
+			if(_timer.prev != nullptr)
+			{
+				_timer.prev->next = _timer.next;
+			}
+			else
+			{
+				*_timer.slot = _timer.next;
+			}
+			if(_timer.next != nullptr)
+			{
+				_timer.next->prev = _timer.prev;
+			}
+			_timer.wheel = nullptr;
+			_timer.slot = nullptr;
+			_timer.prev = nullptr;
+			_timer.next = nullptr;
+			this->armedCount--;
+		}
+
+		void advance()
+		{
+			this->currentTick++;
+
+			// Highest level first, what it cascades may land in the lower slot that cascades next
+			for(size_t level = LEVELS - 1; level > 0; --level)
+			{
+				if((this->currentTick & ((uint64_t(1) << (SLOT_BITS * level)) - 1)) != 0)
+				{
+					continue;
+				}
+
+				Timer*& head = this->slots[level][(this->currentTick >> (SLOT_BITS * level)) & (SLOTS - 1)];
+				while(head != nullptr)
+				{
+					Timer& timer = *head;
+					this->unlink(timer);
+					this->link(timer);
+				}
+			}
+
+			// Move the due Timers onto a local list first. A callback can cancel, reschedule
+			// or destroy any Timer, including the ones still waiting to fire here
+			Timer* due = std::exchange(this->slots[0][this->currentTick & (SLOTS - 1)], nullptr);
+			for(Timer* timer = due; timer != nullptr; timer = timer->next)
+			{
+				timer->slot = &due;
+			}
+			while(due != nullptr)
+			{
+				Timer& timer = *due;
+				this->unlink(timer);
+				if(timer.callback)
+				{
+					timer.callback();
+				}
+			}
+		}
+
+		void waitForTick()
+		{
+			// Ticks are counted from startTime, so a late wakeup catches up instead of drifting
+			this->tickTimer.expires_at(this->startTime + this->tick * (this->currentTick + 1));
+			this->tickTimer.async_wait([this](const boost::system::error_code& _error)
+			{
+				if(_error)
+				{
+					return;
+				}
+
+				uint64_t elapsed = static_cast<uint64_t>((Clock::now() - this->startTime) / this->tick);
+				while(this->currentTick < elapsed)
+				{
+					this->advance();
+				}
+				this->waitForTick();
+			});
+		}
+
+		boost::asio::steady_timer tickTimer;
+		Clock::duration tick;
+		Clock::time_point startTime = Clock::now();
+		uint64_t currentTick = 0;
+		size_t armedCount = 0;
+		std::array<std::array<Timer*, SLOTS>, LEVELS> slots;
+};
+
+#endif
@@ -0,0 +1,270 @@
+#ifndef UDPSESSIONTABLE_H
+#define UDPSESSIONTABLE_H
+
+// C++
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+// Boost
+#include <boost/asio.hpp>
+
+// Templates
+#include "buffer_pool.hpp"
+#include "reliable_channel.hpp"
+
+// Everything a UDPServer knows about one peer
+struct UDPSession
+{
+	boost::asio::ip::udp::endpoint endpoint;
+	uint64_t hash = 0;
+	std::chrono::steady_clock::time_point firstSeen;
+	std::chrono::steady_clock::time_point lastSeen;
+	size_t bytesReceived = 0;
+	size_t bytesSent = 0;
+	size_t messagesReceived = 0;
+	size_t messagesSent = 0;
+
+	// Packets waiting to go out, sendQueue[sendQueueHead] is next.
+	// A vector instead of a deque so an idle session costs no allocation at all
+	std::vector<PacketBuffer> sendQueue;
+	size_t sendQueueHead = 0;
+	// On the owner's list of peers with something to send
+	bool sendPending = false;
+	// Sequencing, acks and resends, only when the owner runs channels over this peer
+	std::unique_ptr<ReliableConnection> connection;
+
+	std::span<const PacketBuffer> getPending() const { return std::span<const PacketBuffer>(this->sendQueue.data() + this->sendQueueHead, this->sendQueue.size() - this->sendQueueHead); }
+	bool hasPending() const { return this->sendQueueHead < this->sendQueue.size(); }
+
+	void push(PacketBuffer _packet) { this->sendQueue.push_back(std::move(_packet)); }
+
+	// Releases the first _count pending packets, the storage is reused once the queue runs dry
+	void popPending(size_t _count)
+	{
+		for(size_t i = 0; i < _count; ++i)
+		{
+			this->sendQueue[this->sendQueueHead++].reset();
+		}
+		if(this->sendQueueHead == this->sendQueue.size())
+		{
+			this->sendQueue.clear();
+			this->sendQueueHead = 0;
+		}
+	}
+};
+
+// Open addressing hash table of UDPSessions keyed by endpoint.
+// Sessions live densely in one vector, the slots only hold a hash and an index into it, so a lookup
+// is a short linear probe over 16 byte slots and never allocates. Inserting allocates only when the table grows.
+// References to sessions are invalidated by insert() and erase(), don't keep them past the current handler.
+// Not thread safe, the owner locks around it.
+class UDPSessionTable
+{
+	public:
+		// Grow before the slots are more than half full, keeps probes short
+		static constexpr size_t MAX_LOAD_PERCENT = 50;
+		static constexpr size_t MIN_CAPACITY = 16;
+
+		/*****************
+		 * Constructors
+		 ****************/
+		// Default constructor
+		UDPSessionTable() : slots(MIN_CAPACITY) {}
+
+		/*****************
+		 * Table Functions
+		 ****************/
+		UDPSession* find(const boost::asio::ip::udp::endpoint& _endpoint)
+		{
+			uint64_t hash = hashOf(_endpoint);
+			size_t mask = this->slots.size() - 1;
+			for(size_t i = hash & mask; ; i = (i + 1) & mask)
+			{
+				const Slot& slot = this->slots[i];
+				if(slot.index == EMPTY)
+				{
+					return nullptr;
+				}
+				if(slot.hash == hash && this->sessions[slot.index].endpoint == _endpoint)
+				{
+					return &this->sessions[slot.index];
+				}
+			}
+		}
+
+		// Returns the peer's session, creating it if this is the first we've heard of them
+		UDPSession& insert(const boost::asio::ip::udp::endpoint& _endpoint, std::chrono::steady_clock::time_point _now)
+		{
+			if(UDPSession* session = this->find(_endpoint))
+			{
+				return *session;
+			}
+
+			if((this->sessions.size() + 1) * 100 > this->slots.size() * MAX_LOAD_PERCENT)
+			{
+				this->rehash(this->slots.size() * 2);
+			}
+
+			UDPSession& session = this->sessions.emplace_back();
+			session.endpoint = _endpoint;
+			session.hash = hashOf(_endpoint);
+			session.firstSeen = _now;
+			session.lastSeen = _now;
+			this->slots[this->findFreeSlot(session.hash)] = Slot { session.hash, static_cast<uint32_t>(this->sessions.size() - 1) };
+			return session;
+		}
+
+		bool erase(const boost::asio::ip::udp::endpoint& _endpoint)
+		{
+			UDPSession* session = this->find(_endpoint);
+			if(session == nullptr)
+			{
+				return false;
+			}
+			this->eraseAt(static_cast<size_t>(session - this->sessions.data()));
+			return true;
+		}
+
+		// Drops every session that's been quiet for _timeout and has nothing left to send, returns how many went
+		size_t evictIdle(std::chrono::steady_clock::time_point _now, std::chrono::steady_clock::duration _timeout)
+		{
+			size_t evicted = 0;
+			for(size_t i = 0; i < this->sessions.size(); )
+			{
+				const UDPSession& session = this->sessions[i];
+				if(_now - session.lastSeen >= _timeout && !session.hasPending())
+				{
+					// The last session moves into i, look at it next
+					this->eraseAt(i);
+					evicted++;
+				}
+				else
+				{
+					++i;
+				}
+			}
+			return evicted;
+		}
+
+		// Makes room for _count sessions without growing again
+		void reserve(size_t _count)
+		{
+			this->sessions.reserve(_count);
+			size_t capacity = std::bit_ceil(std::max(MIN_CAPACITY, _count * 100 / MAX_LOAD_PERCENT + 1));
+			if(capacity > this->slots.size())
+			{
+				this->rehash(capacity);
+			}
+		}
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		size_t size() const { return this->sessions.size(); }
+		std::span<UDPSession> getSessions() { return this->sessions; }
+
+		// Any endpoint, v4 or v6, folded through a 64 bit finalizer so neighbouring ports spread out
+		static uint64_t hashOf(const boost::asio::ip::udp::endpoint& _endpoint)
+		{
+			uint64_t key = _endpoint.port();
+			if(_endpoint.address().is_v4())
+			{
+				key |= static_cast<uint64_t>(_endpoint.address().to_v4().to_uint()) << 16;
+			}
+			else
+			{
+				for(unsigned char b : _endpoint.address().to_v6().to_bytes())
+				{
+					key = key * 131 + b;
+				}
+			}
+
+			key ^= key >> 33;
+			key *= 0xff51afd7ed558ccdULL;
+			key ^= key >> 33;
+			key *= 0xc4ceb9fe1a85ec53ULL;
+			key ^= key >> 33;
+			return key;
+		}
+
+	private:
+		static constexpr uint32_t EMPTY = UINT32_MAX;
+
+		struct Slot
+		{
+			uint64_t hash = 0;
+			uint32_t index = EMPTY;
+		};
+
+		size_t findFreeSlot(uint64_t _hash) const
+		{
+			size_t mask = this->slots.size() - 1;
+			size_t i = _hash & mask;
+			while(this->slots[i].index != EMPTY)
+			{
+				i = (i + 1) & mask;
+			}
+			return i;
+		}
+
+		size_t findSlotOf(uint32_t _index) const
+		{
+			size_t mask = this->slots.size() - 1;
+			size_t i = this->sessions[_index].hash & mask;
+			while(this->slots[i].index != _index)
+			{
+				i = (i + 1) & mask;
+			}
+			return i;
+		}
+
+		void eraseAt(size_t _index)
+		{
+			uint32_t index = static_cast<uint32_t>(_index);
+			size_t mask = this->slots.size() - 1;
+
+			// Backward shift deletion, no tombstones: pull every later entry of the probe run
+			// back into the hole unless that would move it in front of its home slot
+			size_t hole = this->findSlotOf(index);
+			for(size_t i = (hole + 1) & mask; this->slots[i].index != EMPTY; i = (i + 1) & mask)
+			{
+				size_t home = this->slots[i].hash & mask;
+				if(((i - home) & mask) >= ((i - hole) & mask))
+				{
+					this->slots[hole] = this->slots[i];
+					hole = i;
+				}
+			}
+			this->slots[hole] = Slot();
+
+			// Keep the sessions dense by moving the last one into the gap
+			uint32_t last = static_cast<uint32_t>(this->sessions.size() - 1);
+			if(index != last)
+			{
+				this->slots[this->findSlotOf(last)].index = index;
+				this->sessions[index] = std::move(this->sessions[last]);
+			}
+			this->sessions.pop_back();
+		}
+
+		void rehash(size_t _capacity)
+		{
+			this->slots.assign(_capacity, Slot());
+			for(size_t i = 0; i < this->sessions.size(); ++i)
+			{
+				this->slots[this->findFreeSlot(this->sessions[i].hash)] = Slot { this->sessions[i].hash, static_cast<uint32_t>(i) };
+			}
+		}
+
+		std::vector<Slot> slots;
+		std::vector<UDPSession> sessions;
+};
+
+#endif
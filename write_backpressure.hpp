@@ -0,0 +1,86 @@
+#ifndef WRITEBACKPRESSURE_H
+#define WRITEBACKPRESSURE_H
+
+// C++
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+
+// Low priority packets are the ones a backed up connection may lose, broadcasts by default
+enum class PacketPriority
+{
+	Normal,
+	Low
+};
+
+// What a connection does while its write queue is above the high watermark
+enum class SlowConsumerPolicy
+{
+	// Keep queueing, disconnect if the queue hasn't drained to the low watermark by the deadline
+	Disconnect,
+	// Drop low priority packets until the queue drains to the low watermark
+	DropLowPriority
+};
+
+// Byte based limits on one connection's write queue
+struct WriteWatermarks
+{
+	// Reads pause and the backpressure handler fires once this many bytes are queued
+	size_t high = 1024 * 1024;
+	// Reads resume once the queue is back down to this
+	size_t low = 256 * 1024;
+	SlowConsumerPolicy policy = SlowConsumerPolicy::Disconnect;
+	// How long a connection may stay above the low watermark under SlowConsumerPolicy::Disconnect
+	std::chrono::steady_clock::duration slowConsumerDeadline = std::chrono::seconds(10);
+};
+
+// Bytes queued for writing over every connection in the process, held to one limit.
+// A packet shared by many queues counts once per queue, the budget is what the queues would cost unshared
+class WriteBudget
+{
+	public:
+		static constexpr size_t DEFAULT_LIMIT = 512 * 1024 * 1024;
+
+		/*****************
+		 * Budget Functions
+		 ****************/
+		// Counts _bytes against the budget, or counts nothing and returns false if they don't fit
+		static bool tryReserve(size_t _bytes)
+		{
+			size_t limit = limitBytes().load(std::memory_order_relaxed);
+			size_t used = usedBytes().fetch_add(_bytes, std::memory_order_relaxed) + _bytes;
+			if(limit != 0 && used > limit)
+			{
+				usedBytes().fetch_sub(_bytes, std::memory_order_relaxed);
+				return false;
+			}
+			return true;
+		}
+
+		// Counts _bytes whether they fit or not
+		static void reserve(size_t _bytes) { usedBytes().fetch_add(_bytes, std::memory_order_relaxed); }
+		static void release(size_t _bytes) { usedBytes().fetch_sub(_bytes, std::memory_order_relaxed); }
+
+		/*****************
+		 * Getters & Setters
+		 ****************/
+		// 0 means unlimited
+		static void setLimit(size_t _bytes) { limitBytes().store(_bytes, std::memory_order_relaxed); }
+		static size_t getLimit() { return limitBytes().load(std::memory_order_relaxed); }
+		static size_t getUsed() { return usedBytes().load(std::memory_order_relaxed); }
+
+	private:
+		static std::atomic<size_t>& usedBytes()
+		{
+			static std::atomic<size_t> used = 0;
+			return used;
+		}
+
+		static std::atomic<size_t>& limitBytes()
+		{
+			static std::atomic<size_t> limit = DEFAULT_LIMIT;
+			return limit;
+		}
+};
+
+#endif